@@ -0,0 +1,114 @@
+/*
+  Copyright (c) 2006 - 2024
+  CLST  - Radboud University
+  ILK   - Tilburg University
+
+  This file is part of ticcutils
+
+  ticcutils is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  ticcutils is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+  For questions and suggestions, see:
+      https://github.com/LanguageMachines/ticcutils/issues
+  or send mail to:
+      lamasoftware (at ) science.ru.nl
+*/
+
+#ifndef TICC_CLIENTPOOL_H
+#define TICC_CLIENTPOOL_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <map>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <sys/socket.h>
+#include "ticcutils/SocketBasics.h"
+
+namespace Sockets {
+
+  /// \brief ClientPool keeps connections to servers open for re-use
+  ///
+  /// A client that sends many requests to the same servers acquires a
+  /// connection, uses it for one request and releases it again. The next
+  /// acquire() for that host:port gets the same connection, without a new
+  /// connect or DNS lookup.
+  ///
+  /// Idle connections are checked before they are handed out: when the
+  /// server closed them, or they were idle too long, a new connection is
+  /// made. Resolved addresses are cached for a while. New connections
+  /// may get a time limit, and try all addresses of a server in parallel.
+  ///
+  /// A host name starting with '/' is the path of a Unix domain socket.
+  ///
+  /// All functions are thread-safe. A connection is used by one thread
+  /// at a time.
+  class ClientPool {
+  public:
+    explicit ClientPool( size_t = 8,
+			 std::chrono::seconds = std::chrono::seconds(60),
+			 std::chrono::seconds = std::chrono::seconds(300),
+			 std::chrono::milliseconds
+			 = std::chrono::milliseconds(0) );
+    ~ClientPool();
+    ClientSocket *acquire( const std::string&, const std::string&,
+			   std::string& );
+    void release( ClientSocket *, bool = true );
+    void clear();
+    size_t idle() const;
+    size_t connects() const {
+      /*!
+	\return the number of new connections made
+      */
+      return _connects;
+    };
+    size_t reuses() const {
+      /*!
+	\return the number of times an idle connection was re-used
+      */
+      return _reuses;
+    };
+  private:
+    using clock = std::chrono::steady_clock;
+    /// \brief the cached addresses of a host:port
+    struct Resolved {
+      std::vector<Address> addresses;
+      clock::time_point expires;
+    };
+    /// \brief a connection waiting for re-use
+    struct Idle {
+      ClientSocket *socket;
+      clock::time_point since;
+    };
+    size_t _max_idle;
+    std::chrono::seconds _idle_timeout;
+    std::chrono::seconds _dns_ttl;
+    std::chrono::milliseconds _connect_timeout;
+    std::atomic<size_t> _connects;
+    std::atomic<size_t> _reuses;
+    mutable std::mutex _mutex;
+    std::map<std::string,std::vector<Idle>> _idle;
+    std::map<std::string,Resolved> _resolved;
+    std::map<const ClientSocket*,std::string> _in_use;
+    bool resolve( const std::string&, const std::string&,
+		  std::vector<Address>&, std::string& );
+    void expire( clock::time_point );
+    ClientPool( const ClientPool& ) = delete;
+    ClientPool& operator=( const ClientPool& ) = delete;
+  };
+
+}
+
+#endif // TICC_CLIENTPOOL_H
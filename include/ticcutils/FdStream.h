@@ -29,17 +29,34 @@
 
 #include <string>
 #include <iostream>
+#include <vector>
+#include <chrono>
+#include <cstdint>
+#include <atomic>
 
 /// \brief Specialization of std::streambuf for output to a Unix file descriptor
+///
+/// Output is collected in a buffer and written when it is full, or on
+/// a flush. A buffer size of 0 writes every character immediately
 class fdoutbuf: public std::streambuf {
  public:
+  static const size_t default_buffer_size = 4096;
   explicit fdoutbuf( int );
   fdoutbuf();
+  ~fdoutbuf();
   bool connect( int );
+  int fd() const { return _fd; };
+  uint64_t count() const { return _count; }; // bytes written so far
+  size_t buffer_size() const { return _buffer.size(); };
+  void set_buffer_size( size_t );
  protected:
   virtual int overflow( int );
+  virtual int sync();
   virtual std::streamsize xsputn( const char *, std::streamsize );
+  bool flush_buffer();
   int _fd; // file descriptor
+  std::vector<char> _buffer;
+  std::atomic<uint64_t> _count; // other threads may watch it
 };
 
 /// \brief An output stream connected to a Unix file descriptor
@@ -57,20 +74,35 @@ class fdostream: public std::ostream {
     /// create an fd outputstream
   };
   bool open( int );
+  void set_buffer_size( size_t size ){
+    /// set the size of the output buffer. 0 means unbuffered
+    _buf.set_buffer_size( size );
+  }
+  uint64_t count() const {
+    /// the number of bytes written to the file descriptor so far
+    return _buf.count();
+  }
 };
 
 /// \brief Specialization of std::streambuf for input from a Unix file descriptor
 class fdinbuf: public std::streambuf {
  public:
+  static const size_t default_buffer_size = 8192;
   fdinbuf();
   explicit fdinbuf( int );
   bool connect( int );
+  int fd() const { return _fd; };
+  uint64_t count() const { return _count; }; // bytes read so far
+  size_t buffer_size() const { return _buffer.size() - putbackSize; };
+  void set_buffer_size( size_t );
+  bool take_line( std::string& );
  protected:
   virtual int underflow();
+  virtual std::streamsize xsgetn( char *, std::streamsize );
   int _fd; // file descriptor
   static const int putbackSize = 4;
-  static const int bufferSize = 512;
-  char _buffer[bufferSize];
+  std::vector<char> _buffer;
+  std::atomic<uint64_t> _count; // other threads may watch it
 };
 
 /// \brief An input stream connected to a Unix file descriptor
@@ -88,8 +120,22 @@ class fdistream: public std::istream {
     /// create an fd inputstream
   };
   bool open( int );
+  void set_buffer_size( size_t size ){
+    /// set the size of the input buffer
+    _buf.set_buffer_size( size );
+  }
+  uint64_t count() const {
+    /// the number of bytes read from the file descriptor so far
+    return _buf.count();
+  }
 };
 
 bool nb_getline( std::istream& , std::string& , int& );
 bool nb_putline( std::ostream& , const std::string& , int& );
+bool nb_getline( std::istream& , std::string& , std::chrono::milliseconds&,
+		 size_t = 0 );
+bool nb_putline( std::ostream& , const std::string& ,
+		 std::chrono::milliseconds& );
+bool nb_read( std::istream& , std::string& , size_t,
+	      std::chrono::milliseconds& );
 #endif
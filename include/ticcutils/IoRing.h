@@ -0,0 +1,86 @@
+/*
+  Copyright (c) 2006 - 2024
+  CLST  - Radboud University
+  ILK   - Tilburg University
+
+  This file is part of ticcutils
+
+  ticcutils is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  ticcutils is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+  For questions and suggestions, see:
+      https://github.com/LanguageMachines/ticcutils/issues
+  or send mail to:
+      lamasoftware (at ) science.ru.nl
+*/
+
+#ifndef TICC_IORING_H
+#define TICC_IORING_H
+
+#include <cstddef>
+#include <string>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+namespace TiCC {
+
+  /// \brief IoRing selects the system calls used by the socket and fd
+  /// stream layer
+  ///
+  /// The default backend uses plain read(), write() etc. The io_uring
+  /// backend sends the same operations through an io_uring, one per
+  /// thread, and can accept a batch of connections in one system call.
+  /// It is only available when compiled on Linux with io_uring headers,
+  /// and when the kernel allows it.
+  ///
+  /// The functions behave like the system calls with the same name: they
+  /// return -1 and set errno on failure, honour O_NONBLOCK (EAGAIN) and
+  /// return EINTR when a signal arrives while waiting. So the backend can
+  /// be switched at runtime, to compare both on the same binary.
+  ///
+  /// Every read or write is submitted on its own, and waited for, so it
+  /// still costs one system call (io_uring_enter) plus the ring overhead.
+  /// For reads and writes this backend is therefore slower than the
+  /// default; only accept_batch() saves system calls. To honour
+  /// O_NONBLOCK the ring looks up the status with fcntl(). Callers that
+  /// know it pass it instead, to the overloads with a bool, or with
+  /// MSG_DONTWAIT to send().
+  class IoRing {
+  public:
+    enum Backend { DEFAULT, IO_URING };
+    static bool available();
+    static bool setBackend( Backend );
+    static bool setBackend( const std::string& );
+    static Backend backend();
+    static bool active() {
+      /*!
+	\return true when the io_uring backend is in use
+      */
+      return backend() == IO_URING;
+    };
+    static ssize_t read( int, void *, size_t );
+    static ssize_t read( int, void *, size_t, bool );
+    static ssize_t write( int, const void *, size_t );
+    static ssize_t write( int, const void *, size_t, bool );
+    static ssize_t writev( int, const struct iovec *, int );
+    static ssize_t writev( int, const struct iovec *, int, bool );
+    static ssize_t send( int, const void *, size_t, int );
+    static int accept( int, struct sockaddr *, socklen_t *, int );
+    static int accept_batch( int, int *, struct sockaddr_storage *,
+			     socklen_t *, int, int );
+  };
+
+}
+
+#endif // TICC_IORING_H
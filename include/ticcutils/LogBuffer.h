@@ -32,6 +32,7 @@
 #include <string>
 #include <cstring>
 #include <typeinfo>
+#include <vector>
 #include <iostream>
 #include <sys/time.h>
 #include "ticcutils/StringOps.h"
@@ -52,7 +53,9 @@ template <class charT, class traits = std::char_traits<charT> >
  level(LogNormal),
  threshold_level(LogNormal),
  ass_mess( mess )
- {};
+ {
+   BlockSize( default_block_size );
+ };
   ~basic_log_buffer();
   //
   // setters/getters
@@ -66,10 +69,14 @@ template <class charT, class traits = std::char_traits<charT> >
   void AssocStream( std::basic_ostream<charT,traits>& );
   LogFlag StampFlag() const;
   void StampFlag( const LogFlag );
+  size_t BlockSize() const;
+  void BlockSize( size_t );
+  static const size_t default_block_size = 1024;
  protected:
   int sync();
   int overflow( int );
  private:
+  std::vector<charT> block;
   std::basic_ostream<charT,traits> *ass_stream;
   LogFlag stamp_flag;
   bool in_sync;
@@ -110,25 +117,26 @@ inline std::string time_stamp(){
 /// for a derived output stream, we must provide implementations for
 /// both overflow and sync.
 /// both use a helper function buffer_out to do the real work.
+///
+/// characters are collected in the put area (of BlockSize() characters)
+/// and only handed to the associated stream when that area is full, or on
+/// a sync. So a normal logging line takes one write() instead of one
+/// virtual overflow() call per character.
 template <class charT, class traits >
 int basic_log_buffer<charT,traits>::overflow( int c ) {
   buffer_out();
-  if ( level >= threshold_level && c != '\r' ){
-    //    std::cerr << "overflow OK: " << level << " >= " << threshold_level
-    //	      << "(" << char(c) << ")" << std::endl;
-    if ( c != EOF ){
-      char z = static_cast<char>(c);
-      ass_stream->put( z );
-    }
-    else {
-      return EOF;
-    }
+  if ( c == EOF ){
+    return EOF;
   }
+  // buffer_out() emptied the put area, so there is room for c now
+  *this->pptr() = static_cast<charT>(c);
+  this->pbump( 1 );
   return c;
 }
 
 template <class charT, class traits >
 int basic_log_buffer<charT,traits>::sync() {
+  buffer_out();
   ass_stream->flush();
   in_sync = true;
   return 0;
@@ -136,6 +144,14 @@ int basic_log_buffer<charT,traits>::sync() {
 
 template <class charT, class traits >
 void basic_log_buffer<charT,traits>::buffer_out(){
+  const charT *b = this->pbase();
+  const charT *e = this->pptr();
+  // reset the put area. The characters in [b,e) stay valid until the next
+  // write into the buffer
+  this->setp( block.data(), block.data() + block.size() );
+  if ( b == e ){
+    return;
+  }
   if ( level >= threshold_level ){
     //    std::cerr << "buffer_out OK: " << level << " >= " << threshold_level << std::endl;
     // only output when we are on a high enough level
@@ -151,6 +167,16 @@ void basic_log_buffer<charT,traits>::buffer_out(){
       }
       in_sync = false;
     }
+    // write the whole block at once, but skip carriage returns
+    while ( b < e ){
+      const charT *cr = traits::find( b, e - b, charT('\r') );
+      if ( !cr ){
+	ass_stream->write( b, e - b );
+	break;
+      }
+      ass_stream->write( b, cr - b );
+      b = cr + 1;
+    }
   }
 }
 
@@ -165,11 +191,13 @@ template <class charT, class traits >
 
 template <class charT, class traits >
   void basic_log_buffer<charT,traits>::Message( const std::string& s ){
+  buffer_out(); // the pending output still belongs to the old settings
   ass_mess = s;
 }
 
 template <class charT, class traits >
 void basic_log_buffer<charT,traits>::Threshold( LogLevel l ){
+  buffer_out();
   threshold_level = l;
 }
 
@@ -180,6 +208,7 @@ LogLevel basic_log_buffer<charT,traits>::Threshold() const {
 
 template <class charT, class traits >
 void basic_log_buffer<charT,traits>::Level( LogLevel l ){
+  buffer_out();
   level = l;
 }
 
@@ -195,11 +224,13 @@ std::basic_ostream<charT,traits>& basic_log_buffer<charT,traits>::AssocStream()
 
 template <class charT, class traits >
 void basic_log_buffer<charT,traits>::AssocStream( std::basic_ostream<charT,traits>& os ){
+  buffer_out();
   ass_stream = &os;
 }
 
 template <class charT, class traits >
 void basic_log_buffer<charT,traits>::StampFlag( const LogFlag b ){
+  buffer_out();
   stamp_flag = b;
 }
 
@@ -208,4 +239,21 @@ LogFlag basic_log_buffer<charT,traits>::StampFlag() const {
   return stamp_flag;
 }
 
+template <class charT, class traits >
+size_t basic_log_buffer<charT,traits>::BlockSize() const {
+  return block.size();
+}
+
+template <class charT, class traits >
+void basic_log_buffer<charT,traits>::BlockSize( size_t size ){
+  /// set the size of the internal block
+  /*!
+    \param size the maximum number of characters collected before they are
+    handed to the associated stream. (a sync() always passes them on)
+  */
+  buffer_out();
+  block.assign( size > 0 ? size : 1, charT() );
+  this->setp( block.data(), block.data() + block.size() );
+}
+
 #endif // LOGBUFFER_H
@@ -0,0 +1,109 @@
+/*
+  Copyright (c) 2006 - 2024
+  CLST  - Radboud University
+  ILK   - Tilburg University
+
+  This file is part of ticcutils
+
+  ticcutils is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  ticcutils is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+  For questions and suggestions, see:
+      https://github.com/LanguageMachines/ticcutils/issues
+  or send mail to:
+      lamasoftware (at ) science.ru.nl
+*/
+
+#ifndef TICC_LOGROTATE_H
+#define TICC_LOGROTATE_H
+
+#include <ctime>
+#include <string>
+#include <deque>
+#include <fstream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+namespace TiCC {
+
+  /// \brief the settings for a rotating log file
+  struct LogRotation {
+    std::streamoff max_size = 0; //!< rotate when the file grows beyond this
+                                 //!< many bytes. 0 means: never
+    int interval = 0;            //!< rotate every interval seconds. 0 means:
+                                 //!< never
+    bool compress = false;       //!< gzip rotated files in the background
+    bool active() const { return max_size > 0 || interval > 0; };
+  };
+
+  /// \brief a std::filebuf that rotates the underlying file
+  ///
+  /// The size and age of the file are checked on every sync(), so a
+  /// LogStream will only rotate between complete messages.
+  /// A rotated file is renamed to \e name.YYYYMMDD-HHMMSS and, when
+  /// requested, compressed to \e name.YYYYMMDD-HHMMSS.gz by a background
+  /// thread, so the logging threads never wait for the compression.
+  class rotating_filebuf: public std::filebuf {
+  public:
+    rotating_filebuf( const std::string&,
+		      const LogRotation&,
+		      std::ios_base::openmode = std::ios::out );
+    ~rotating_filebuf();
+    bool rotate();
+    const std::string& name() const { return _name; };
+    const LogRotation& settings() const { return _settings; };
+  protected:
+    int sync() override;
+  private:
+    std::string _name;
+    LogRotation _settings;
+    std::ios_base::openmode _mode;
+    time_t _next_rotation;
+    std::string rotated_name() const;
+    // the background compression
+    std::thread _zipper;
+    std::mutex _zip_mutex;
+    std::condition_variable _zip_cond;
+    std::deque<std::string> _to_zip;
+    bool _stopping;
+    void zip_loop();
+    rotating_filebuf( const rotating_filebuf& ) = delete;
+    rotating_filebuf& operator=( const rotating_filebuf& ) = delete;
+  };
+
+  /// \brief an output stream connected to a rotating file
+  class rotating_ofstream: public std::ostream {
+  public:
+    rotating_ofstream( const std::string& name,
+		       const LogRotation& rot,
+		       std::ios_base::openmode mode = std::ios::out ):
+      std::ostream( &_buf ), _buf( name, rot, mode ) {
+      /// create an output stream on a rotating file
+      /*!
+	\param name the name of the file
+	\param rot the rotation settings
+	\param mode the openmode to use
+      */
+      if ( !_buf.is_open() ){
+	setstate( std::ios::failbit );
+      }
+    };
+    bool rotate() { return _buf.rotate(); };
+  private:
+    rotating_filebuf _buf;
+  };
+
+}
+
+#endif // TICC_LOGROTATE_H
@@ -26,9 +26,14 @@
 #ifndef TICC_LOGSTREAM_H
 #define TICC_LOGSTREAM_H
 
+#include <ctime>
+#include <atomic>
 #include <iostream>
 #include <string>
+#include <memory>
 #include "ticcutils/LogBuffer.h"
+#include "ticcutils/LogRotate.h"
+#include "ticcutils/LogTrace.h"
 
 namespace TiCC {
 
@@ -40,13 +45,18 @@ namespace TiCC {
   class LogStream : public std::ostream {
     friend bool IsActive( LogStream & );
     friend bool IsActive( LogStream * );
+    friend class LogGuard;
   public:
     explicit LogStream();
     explicit LogStream( int );
     LogStream( std::ostream&,
 	       LogFlag = StampBoth );
     LogStream( const LogStream * );
+    ~LogStream();
     LogStream *create( const std::string&, std::ios_base::openmode = std::ios::out );
+    LogStream *create( const std::string&,
+		       const LogRotation&,
+		       std::ios_base::openmode = std::ios::out );
     bool set_single_threaded_mode();
     bool single_threaded() const { return single_threaded_mode; };
     void set_threshold( LogLevel t ){ buf.Threshold( t ); };
@@ -56,76 +66,112 @@ namespace TiCC {
     void associate( std::ostream& os ) { buf.AssocStream( os ); };
     void set_stamp( LogFlag f ){ buf.StampFlag( f ); };
     LogFlag get_stamp() const { return buf.StampFlag(); };
+    void set_block_size( size_t s ){ buf.BlockSize( s ); };
+    size_t get_block_size() const { return buf.BlockSize(); };
     void set_message( const std::string& s ){ buf.Message( s ); };
     void add_message( const std::string& );
     void add_message( const int );
     const std::string& get_message() const { return buf.Message(); };
     static bool Problems();
+    bool set_trace_mode( size_t = 4096 );
+    bool tracing() const { return tracer != 0; };
+    void flush_trace();
+    static void dump_trace_on_crash( int fd = 2 ){
+      /// on a fatal signal, dump the traces of all LogStreams to fd
+      LogTracer::dump_on_crash( fd );
+    };
   private:
+    std::unique_ptr<std::ostream> owned_stream; // must outlive buf
     LogBuffer buf;
     // prohibit assignment
     LogStream& operator=( const LogStream& ) = delete;
     bool IsBlocking();
     bool single_threaded_mode;
+    std::shared_ptr<LogTracer> tracer; // shared with derived LogStreams
   };
 
   bool IsActive( LogStream & );
   bool IsActive( LogStream * );
 
-  /// \brief create a LogStream
-  class Log {
+  /// \brief limit the number of messages from one call site
+  ///
+  /// A LogLimit is meant to be a static object at a call site. It allows
+  /// at most \e per_second messages in every second and, optionally, only
+  /// passes a random sample of them. Suppressed messages don't touch the
+  /// logging mutex at all. The first message that passes again is preceded
+  /// by a line telling how many messages were suppressed. Example:
+  ///
+  ///     static LogLimit limit( 10, 0.5 );
+  ///     *Log( my_log, limit ) << "lookup failed for " << key << endl;
+  class LogLimit {
   public:
-    explicit Log( LogStream * );
-    explicit Log( LogStream& l );
-    ~Log();
-    LogStream& operator *();
+    explicit LogLimit( unsigned int, double = 1.0 );
+    bool allow( size_t& );
+    size_t suppressed() const { return _suppressed; };
   private:
-    LogStream *my_stream;
-    LogLevel my_level;
-    Log( const Log& ) = delete;
-    Log& operator=( const Log& ) = delete;
+    const unsigned int _per_second; // 0 means: no rate limit
+    const double _sample;           // the fraction of messages to keep
+    std::atomic<time_t> _window;
+    std::atomic<unsigned int> _count;
+    std::atomic<size_t> _suppressed;
+    LogLimit( const LogLimit& ) = delete;
+    LogLimit& operator=( const LogLimit& ) = delete;
   };
 
-  /// \brief create a debugging LogStream
-  class Dbg{
+  /// \brief the common part of Log, Dbg, xDbg and xxDbg
+  ///
+  /// it locks the LogStream (when multi threaded) and sets the threshold
+  /// for the lifetime of the object. For a tracing LogStream nothing is
+  /// locked: the output goes to the private stream of the calling thread.
+  class LogGuard {
   public:
-    explicit Dbg( LogStream * );
-    explicit Dbg( LogStream& l );
-    ~Dbg();
     LogStream& operator *();
+  protected:
+    LogGuard( LogStream *, LogLevel, LogLimit * = 0 );
+    ~LogGuard();
   private:
     LogStream *my_stream;
+    LogStream *trace_stream; // the thread's own stream when tracing
     LogLevel my_level;
-    Dbg( const Dbg& ) = delete;
-    Dbg& operator=( const Dbg& ) = delete;
+    bool suppressed;
+    LogGuard( const LogGuard& ) = delete;
+    LogGuard& operator=( const LogGuard& ) = delete;
+  };
+
+  /// \brief create a LogStream
+  class Log: public LogGuard {
+  public:
+    explicit Log( LogStream *os ): LogGuard( os, LogNormal ){};
+    explicit Log( LogStream& os ): LogGuard( &os, LogNormal ){};
+    Log( LogStream *os, LogLimit& l ): LogGuard( os, LogNormal, &l ){};
+    Log( LogStream& os, LogLimit& l ): LogGuard( &os, LogNormal, &l ){};
+  };
+
+  /// \brief create a debugging LogStream
+  class Dbg: public LogGuard {
+  public:
+    explicit Dbg( LogStream *os ): LogGuard( os, LogDebug ){};
+    explicit Dbg( LogStream& os ): LogGuard( &os, LogDebug ){};
+    Dbg( LogStream *os, LogLimit& l ): LogGuard( os, LogDebug, &l ){};
+    Dbg( LogStream& os, LogLimit& l ): LogGuard( &os, LogDebug, &l ){};
   };
 
   /// \brief a debugging LogStream for heavy output
-  class xDbg{
+  class xDbg: public LogGuard {
   public:
-    explicit xDbg( LogStream * );
-    explicit xDbg( LogStream& l );
-    ~xDbg();
-    LogStream& operator *();
-  private:
-    LogStream *my_stream;
-    LogLevel my_level;
-    xDbg( const xDbg& ) = delete;
-    xDbg& operator=( const xDbg& ) = delete;
+    explicit xDbg( LogStream *os ): LogGuard( os, LogHeavy ){};
+    explicit xDbg( LogStream& os ): LogGuard( &os, LogHeavy ){};
+    xDbg( LogStream *os, LogLimit& l ): LogGuard( os, LogHeavy, &l ){};
+    xDbg( LogStream& os, LogLimit& l ): LogGuard( &os, LogHeavy, &l ){};
   };
 
   /// \brief a debugging LogStream for extreme output
-  class xxDbg{
+  class xxDbg: public LogGuard {
   public:
-    explicit xxDbg( LogStream * );
-    explicit xxDbg( LogStream& l );
-    ~xxDbg();
-    LogStream& operator *();
-  private:
-    LogStream *my_stream;
-    LogLevel my_level;
-    xxDbg( const xxDbg& ) = delete;
-    xxDbg& operator=( const xxDbg& ) = delete;
+    explicit xxDbg( LogStream *os ): LogGuard( os, LogExtreme ){};
+    explicit xxDbg( LogStream& os ): LogGuard( &os, LogExtreme ){};
+    xxDbg( LogStream *os, LogLimit& l ): LogGuard( os, LogExtreme, &l ){};
+    xxDbg( LogStream& os, LogLimit& l ): LogGuard( &os, LogExtreme, &l ){};
   };
 
 }
@@ -0,0 +1,105 @@
+/*
+  Copyright (c) 2006 - 2024
+  CLST  - Radboud University
+  ILK   - Tilburg University
+
+  This file is part of ticcutils
+
+  ticcutils is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  ticcutils is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+  For questions and suggestions, see:
+      https://github.com/LanguageMachines/ticcutils/issues
+  or send mail to:
+      lamasoftware (at ) science.ru.nl
+*/
+
+#ifndef TICC_LOGTRACE_H
+#define TICC_LOGTRACE_H
+
+#include <cstdint>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <iosfwd>
+
+namespace TiCC {
+
+  class LogStream;
+
+  /// @cond HIDDEN
+  /// one fixed size entry in a TraceRing. Longer messages are spread over
+  /// several consecutive records
+  struct TraceRecord {
+    static const size_t text_size = 232;
+    uint64_t stamp;   // microseconds since the epoch
+    uint64_t seq;     // position in the ring
+    uint32_t ring;    // the ring (thread) number
+    uint16_t len;
+    uint8_t stamp_time;
+    uint8_t continued; // this record continues the previous one
+    char text[text_size];
+  };
+
+  /// a ring of TraceRecords, written by exactly one thread.
+  /// When full, the oldest records are overwritten.
+  class TraceRing {
+  public:
+    TraceRing( size_t, uint32_t );
+    void add( uint64_t, bool, const std::string& );
+    void collect( std::vector<TraceRecord>& );
+    uint64_t head() const { return _head.load( std::memory_order_acquire ); };
+    uint64_t tail() const { return _tail; };
+    size_t capacity() const { return _capacity; };
+    const TraceRecord& at( uint64_t i ) const { return _records[i % _capacity]; };
+  private:
+    std::unique_ptr<TraceRecord[]> _records;
+    size_t _capacity;
+    uint32_t _number;
+    std::atomic<uint64_t> _head; // only changed by the writing thread
+    std::atomic<uint64_t> _claimed; // idem, the slot being written + 1
+    uint64_t _tail;              // only changed by collect()
+  };
+  /// @endcond
+
+  /// \brief LogTracer collects the per thread output of a tracing LogStream
+  ///
+  /// Every thread logging to a tracing LogStream gets its own LogStream,
+  /// connected to a private TraceRing. So threads never wait for each other.
+  /// write() merges all rings in time order. dump() does the same in an
+  /// async-signal-safe way, for use in a crash handler.
+  class LogTracer {
+  public:
+    explicit LogTracer( size_t );
+    ~LogTracer();
+    LogStream *thread_stream();
+    void commit( const LogStream& );
+    void write( std::ostream& );
+    void dump( int );
+    static void dump_on_crash( int );
+  private:
+    static const int max_rings = 1024;
+    std::atomic<TraceRing*> _rings[max_rings];
+    std::atomic<int> _ring_count;
+    size_t _capacity;
+    uint64_t _id;
+    std::mutex _reader_mutex;
+    LogTracer( const LogTracer& ) = delete;
+    LogTracer& operator=( const LogTracer& ) = delete;
+  };
+
+}
+
+#endif // TICC_LOGTRACE_H
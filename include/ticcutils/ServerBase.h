@@ -29,10 +29,22 @@
 
 #include <iosfwd>
 #include <string>
+#include <map>
+#include <vector>
+#include <set>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <functional>
 #include "ticcutils/LogStream.h"
 #include "ticcutils/Configuration.h"
 #include "ticcutils/SocketBasics.h"
 #include "ticcutils/FdStream.h"
+#include "ticcutils/WorkerPool.h"
+#include "ticcutils/ServerMetrics.h"
+#include "ticcutils/TimerWheel.h"
+#include "ticcutils/CpuAffinity.h"
 
 namespace TiCC { class CL_Options; }
 namespace TiCCServer {
@@ -41,6 +53,14 @@ namespace TiCCServer {
   extern const std::string serv_long_opts;
 
   class childArgs;
+  class eventArgs;
+
+  /// \brief the idle_timeout and request_timeout timers of a connection
+  struct ConnectionTimers {
+    ConnectionTimers(): idle(0), total(0) {};
+    TimerWheel::Id idle;
+    TimerWheel::Id total;
+  };
 
   /// \brief ServerBase provides functions to setup a Server in a generic
   /// way
@@ -53,7 +73,7 @@ namespace TiCCServer {
     ServerBase& operator=( const ServerBase& ) = delete;  // no copies allowed
   public:
     explicit ServerBase( const TiCC::Configuration *, void * );
-    virtual ~ServerBase(){ delete _socket; delete _config; };
+    virtual ~ServerBase();
     bool doDebug() {
       /*!
 	\return true of debugging is on
@@ -69,6 +89,38 @@ namespace TiCCServer {
       */
       return _max_conn;
     };
+    size_t maxFrame() const {
+      /*!
+	\return the largest frame a client may send
+      */
+      return _max_frame;
+    };
+    size_t maxLine() const {
+      /*!
+	\return the longest line a client may send in event mode
+      */
+      return _max_line;
+    };
+    int activeConnections() const {
+      /*!
+	\return the number of connections being served right now
+      */
+      return _active;
+    };
+    size_t waiting() const;
+    const WorkerPool *pool() const {
+      /*!
+	\return the pool of worker threads. (only available after Run()
+	started)
+      */
+      return _pool;
+    };
+    ServerMetrics& metrics() {
+      /*!
+	\return the counters and latency histograms of this server
+      */
+      return _metrics;
+    };
     void setDebug( bool d ){ _debug = d; };
     Sockets::ServerSocket *TcpSocket() const {
       /*!
@@ -99,21 +151,114 @@ namespace TiCCServer {
     virtual void socketChild( childArgs * );
     virtual void callback( childArgs* ) = 0;
     virtual void sendReject( std::ostream& ) const;
+    virtual int priority( const Sockets::ClientSocket * ){
+      /// the priority class of a new connection, for the admission queue
+      /*!
+	\return a higher value is served earlier when connections have to
+	wait for a free slot. The default is 0 for all. Servers may look at
+	e.g. the getClientName() of the socket.
+      */
+      return 0;
+    };
+    virtual void event_open( eventArgs * ){
+      /// called when a new connection is accepted in event mode
+    };
+    virtual void event_input( eventArgs * );
+    virtual void line_callback( eventArgs *, const std::string& );
+    virtual void frame_callback( eventArgs *, const char *, size_t );
+    virtual bool reload( const TiCC::Configuration * ){
+      /// called on SIGHUP with the freshly read configuration
+      /*!
+	\return true when the new configuration is accepted. Servers can
+	load new models here, while the running requests continue.
+	When false is returned, the old configuration stays in use.
+      */
+      return true;
+    };
+    static bool running();
 
   protected:
     TiCC::LogStream _my_log;
     std::string _log_file;
+    TiCC::LogRotation _log_rotation;
     std::string _pid_file;
     std::string _name;
     bool _do_daemon;
-    bool _debug;
-    int _max_conn;
+    std::atomic<bool> _debug;
+    std::atomic<int> _max_conn;
     int _server_port;
+    std::string _unix_socket;
+    unsigned int _backlog;
+    bool _reuse_port;
+    int _acceptors;
+    bool _accept_nonblocking;
     void *_callback_data;
     Sockets::ServerSocket *_socket;
     std::string _protocol;
+    std::string _iomode;
+    std::string _io_backend;
+    bool _framed;
+    size_t _max_frame;
+    size_t _max_line;
+    size_t _workers;
+    WorkerPool *_pool;
+    CpuList _accept_cpus;
+    CpuList _worker_cpus;
+    std::string _worker_pinning;
+    std::vector<CpuList> _worker_places;
+    std::atomic<int> _active;
+    std::atomic<int> _drain_timeout;
+    std::atomic<int> _idle_timeout;
+    std::atomic<int> _request_timeout;
+    size_t _queue_size;
+    std::chrono::milliseconds _queue_timeout;
+    std::string _metrics_port;
+    int _metrics_interval;
+    ServerMetrics _metrics;
     std::string _config_file;
-    const TiCC::Configuration *_config;
+    std::atomic<const TiCC::Configuration*> _config;
+  private:
+    /// \brief a connection waiting in the admission queue
+    struct Waiting {
+      int priority;
+      uint64_t seq;
+      std::chrono::steady_clock::time_point since;
+      std::chrono::steady_clock::time_point deadline;
+      std::function<void()> start;
+      std::function<void()> refuse;
+    };
+    std::vector<Waiting> _waiting;
+    mutable std::mutex _queue_mutex;
+    std::condition_variable _queue_cv;
+    int _admitted;
+    uint64_t _queue_seq;
+    bool _queue_stop;
+    void Admit( const Sockets::ClientSocket *,
+		const std::function<void()>&,
+		const std::function<void()>& );
+    void Release();
+    void SetMaxConn( int );
+    std::vector<Waiting>::iterator
+      BestWaiting( std::chrono::steady_clock::time_point );
+    void AdmissionLoop();
+    void FlushAdmission();
+    std::vector<const TiCC::Configuration*> _old_configs;
+    std::set<childArgs*> _connections;
+    std::mutex _conn_mutex;
+    std::condition_variable _conn_done;
+    std::atomic<bool> _drain_expired;
+    TimerWheel *_timers;
+    void Watch( ConnectionTimers&, int, const std::function<uint64_t()>& );
+    void Unwatch( ConnectionTimers& );
+    void PlaceThreads();
+    void PinWorker( size_t );
+    void Reload();
+    void CheckReload();
+    void Drain();
+    int AcceptLoop( Sockets::ServerSocket& );
+    void MetricsLoop( Sockets::ServerSocket * );
+    void LogMetrics();
+    int RunEvents( const std::vector<Sockets::ServerSocket*>& );
   };
 
   /// \brief childArgs carries important data for Server connections
@@ -121,6 +266,7 @@ namespace TiCCServer {
   /// this is passed using a callback function to every new Socket connection
   /// the Server creates
   class childArgs {
+    friend class ServerBase;
   public:
     childArgs( ServerBase *, Sockets::ClientSocket * );
     ~childArgs();
@@ -166,16 +312,132 @@ namespace TiCCServer {
       */
       return _mother->doDebug();
     };
+    bool sendFile( const std::string& );
+    bool sendFile( int, off_t, size_t );
+    bool sendFile( int, off_t, size_t, std::chrono::milliseconds& );
+    bool sendBuffers( const struct iovec *, int, std::chrono::milliseconds& );
+    bool readFrame( std::string& );
+    bool writeFrame( const char *, size_t );
+    bool writeFrame( const std::string& s ){
+      /// send s as one frame
+      return writeFrame( s.data(), s.size() );
+    };
+    uint64_t traffic() const {
+      /*!
+	\return the number of bytes received and sent so far
+      */
+      return _is.count() + _os.count() + _sent;
+    };
   private:
     ServerBase *_mother;
     Sockets::ClientSocket *_socket;
     int _id;
     fdistream _is;
     fdostream _os;
+    std::atomic<uint64_t> _sent; // bypassing _os
+    ConnectionTimers _timers;
     childArgs( const childArgs& ) = delete; // no copies allowed
     childArgs& operator=( const childArgs& ) = delete; // no copies allowed
   };
 
+  /// \brief eventArgs carries the data of a connection in event mode
+  ///
+  /// In event mode (iomode=epoll) no thread is dedicated to a connection.
+  /// The server calls event_input() on a worker thread whenever new data
+  /// has arrived. Output is queued with write() and sent when the socket
+  /// is writable. At most one worker handles a connection at any time.
+  class eventArgs {
+    friend class ServerBase;
+    friend class HttpServerBase;
+  public:
+    eventArgs( ServerBase *, Sockets::ClientSocket * );
+    ~eventArgs();
+    int id() const {
+      /*!
+	\return the id of the socket
+      */
+      return _id;
+    };
+    ServerBase *mother() const {
+      /*!
+	\return the ServerBase object we belong to
+      */
+      return _mother;
+    };
+    TiCC::LogStream& logstream() {
+      /*!
+	\return the LogStream of the Serverbase
+      */
+      return _mother->logstream();
+    }
+    Sockets::ClientSocket *socket() const {
+      /*!
+	\return the ClientSocket we belong to
+      */
+      return _socket;
+    };
+    bool debug() const {
+      /*!
+	\return the debug status of our ServerBase
+      */
+      return _mother->doDebug();
+    };
+    std::string& input() {
+      /*!
+	\return the received data which is not consumed yet. A callback
+	should erase what it has handled.
+      */
+      return _input;
+    };
+    void write( const std::string& s ) {
+      /// queue s for output
+      _output += s;
+    };
+    void writeFrame( const char *, size_t );
+    void writeFrame( const std::string& s ){
+      /// queue s as one frame
+      writeFrame( s.data(), s.size() );
+    };
+    void close() {
+      /// close the connection as soon as all output is sent
+      _closing = true;
+    };
+    bool closing() const { return _closing; };
+    bool eof() const {
+      /*!
+	\return true when the client has closed its side of the connection
+      */
+      return _eof;
+    };
+    uint64_t traffic() const {
+      /*!
+	\return the number of bytes received and sent so far
+      */
+      return _traffic;
+    };
+    void *data; //!< free for use by the server, e.g. to keep a session
+  private:
+    ServerBase *_mother;
+    Sockets::ClientSocket *_socket;
+    int _id;
+    std::string _input;
+    std::string _output;
+    size_t _written;
+    std::chrono::steady_clock::time_point _start;
+    bool _closing;
+    bool _eof;
+    size_t _scanned; // the start of input() has no newline up to here
+    size_t _wanted;  // input() is of no use before it has this size
+    int _requests;   // the HTTP requests answered
+    std::atomic<uint64_t> _traffic;
+    ConnectionTimers _timers;
+    bool fill();
+    bool flush();
+    bool pending() const { return _written < _output.size(); };
+    eventArgs( const eventArgs& ) = delete; // no copies allowed
+    eventArgs& operator=( const eventArgs& ) = delete; // no copies allowed
+  };
+
   /// \brief TcpServerBase is a baseclass for TCP connections
   class TcpServerBase : public ServerBase {
   public:
@@ -183,13 +445,61 @@ namespace TiCCServer {
 			    void *cb ):ServerBase( c, cb ){};
   };
 
+  /// \brief HttpRequest holds one HTTP request, as read by HttpServerBase
+  struct HttpRequest {
+    std::string method;  //!< GET, POST etc.
+    std::string target;  //!< the request target, like /path?query
+    std::string version; //!< HTTP/1.0 or HTTP/1.1
+    std::map<std::string,std::string> headers; //!< names in lowercase
+    std::string body;    //!< the body, as announced by Content-Length
+    std::string header( const std::string& ) const;
+    bool keep_alive() const;
+  };
+
+  /// \brief HttpResponse is filled in by HttpServerBase::http_request()
+  ///
+  /// Content-Length and Connection are added by the server. Setting
+  /// the Connection header to 'close' ends the connection after this
+  /// response.
+  struct HttpResponse {
+    HttpResponse(): status(200){};
+    int status;          //!< the status code
+    std::string reason;  //!< the reason phrase. Default for the status
+    std::map<std::string,std::string> headers; //!< extra headers
+    std::string body;    //!< the body
+    std::string file;    //!< when set, send this file as the body instead
+  };
+
   /// \brief HttpServerBase is a baseclass for Http connections
+  ///
+  /// Servers may override callback() and handle the connection
+  /// themselves, as before. Otherwise the server reads the requests on
+  /// a connection, calls http_request() for each of them and sends the
+  /// responses. Connections are kept open (HTTP/1.1 keep-alive) and
+  /// pipelined requests are answered in order. With iomode=epoll the
+  /// same happens in event_input(), and http_request() gets 0 for its
+  /// childArgs.
   class HttpServerBase : public ServerBase {
   public:
     void socketChild( childArgs * ) override;
     virtual void sendReject( std::ostream& os ) const override;
-    explicit HttpServerBase( const TiCC::Configuration *c,
-			     void *cb ): ServerBase( c, cb ){};
+    explicit HttpServerBase( const TiCC::Configuration *, void * );
+    void callback( childArgs * ) override;
+    void event_input( eventArgs * ) override;
+    virtual void http_request( childArgs *,
+			       const HttpRequest&,
+			       HttpResponse& );
+  protected:
+    int read_request( childArgs *, HttpRequest&,
+		      std::chrono::milliseconds& );
+    int parse_request( const std::string&, size_t&, HttpRequest& ) const;
+    int body_length( const HttpRequest&, size_t& ) const;
+    std::string response_head( const HttpResponse&, size_t, bool ) const;
+    bool send_response( childArgs *, const HttpRequest&,
+			const HttpResponse&, bool );
+    std::chrono::milliseconds _http_timeout;
+    int _http_max_requests;
+    size_t _http_max_body;
   };
 
   std::string Version();
@@ -0,0 +1,106 @@
+/*
+  Copyright (c) 2006 - 2024
+  CLST  - Radboud University
+  ILK   - Tilburg University
+
+  This file is part of ticcutils
+
+  ticcutils is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  ticcutils is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+  For questions and suggestions, see:
+      https://github.com/LanguageMachines/ticcutils/issues
+  or send mail to:
+      lamasoftware (at ) science.ru.nl
+*/
+
+#ifndef TICC_SERVERMETRICS_H
+#define TICC_SERVERMETRICS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <iosfwd>
+
+namespace TiCCServer {
+
+  /// \brief LatencyHistogram counts durations in log-linear buckets
+  ///
+  /// Like an HDR histogram: every power of 2 is split into 16 buckets, so
+  /// a value is known within ~6%. Only one thread records in a histogram,
+  /// others may read it at any time.
+  class LatencyHistogram {
+  public:
+    static const int sub_bits = 4;
+    static const size_t bucket_count = ( 64 - sub_bits + 1 ) << sub_bits;
+    LatencyHistogram();
+    void record( uint64_t );
+    void add_to( std::vector<uint64_t>& ) const;
+    static size_t index( uint64_t );
+    static uint64_t highest_value( size_t );
+  private:
+    std::atomic<uint64_t> _counts[bucket_count];
+    LatencyHistogram( const LatencyHistogram& ) = delete;
+    LatencyHistogram& operator=( const LatencyHistogram& ) = delete;
+  };
+
+  /// \brief ServerMetrics collects the counters and latencies of a server
+  ///
+  /// Counters are atomics. Latencies are recorded in a histogram per
+  /// thread, so recording never takes a lock. report() merges them.
+  class ServerMetrics {
+  public:
+    enum Kind { REQUEST, CONNECTION, QUEUE };
+    static const int kinds = QUEUE + 1;
+    ServerMetrics();
+    void accepted() { ++_accepted; };
+    void rejected() { ++_rejected; };
+    void timed_out() { ++_timed_out; };
+    void opened() { ++_active; };
+    void closed() { --_active; };
+    void enqueued() { ++_queued; };
+    void dequeued() { --_queued; };
+    void add_bytes( uint64_t in, uint64_t out ){
+      /// count the bytes received and sent
+      _bytes_in += in;
+      _bytes_out += out;
+    };
+    void record( Kind, std::chrono::steady_clock::duration );
+    uint64_t percentile( Kind, double ) const;
+    void report( std::ostream& ) const;
+  private:
+    using clock = std::chrono::steady_clock;
+    const uint64_t _id;
+    clock::time_point _start;
+    std::atomic<uint64_t> _accepted;
+    std::atomic<uint64_t> _rejected;
+    std::atomic<uint64_t> _timed_out;
+    std::atomic<int64_t> _active;
+    std::atomic<int64_t> _queued;
+    std::atomic<uint64_t> _bytes_in;
+    std::atomic<uint64_t> _bytes_out;
+    mutable std::mutex _mutex; // only for (un)registering histograms
+    std::vector<std::unique_ptr<LatencyHistogram>> _histograms[kinds];
+    LatencyHistogram& local( Kind );
+    std::vector<uint64_t> merged( Kind ) const;
+    ServerMetrics( const ServerMetrics& ) = delete;
+    ServerMetrics& operator=( const ServerMetrics& ) = delete;
+  };
+
+}
+
+#endif // TICC_SERVERMETRICS_H
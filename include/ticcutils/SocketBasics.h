@@ -28,14 +28,41 @@
 #define SOCKET_BASICS_H
 
 #include <string>
+#include <vector>
+#include <utility>
+#include <deque>
+#include <chrono>
+#include <cstdint>
 
 #ifdef _WIN32
 #include <winsock.h>
 #else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
 #endif
 
 namespace Sockets {
 
+  /// A frame is a length-prefixed message: 4 bytes with the length of the
+  /// data in network byte order, followed by the data itself. Frames may
+  /// hold any binary data, and are read without scanning for separators.
+  const size_t frame_header_size = 4;
+  const size_t default_max_frame = 16*1024*1024; //!< the default limit
+  void encodeFrameLength( char *, uint32_t );
+  uint32_t decodeFrameLength( const char * );
+
+  /// \brief a resolved address of a server
+  struct Address {
+    struct sockaddr_storage addr;
+    socklen_t len;
+  };
+  bool resolveAddress( const std::string&, const std::string&,
+		       std::vector<Address>&, std::string& );
+  /// the time a connect() to one address gets, before the next is tried
+  /// in parallel. (RFC 8305, Happy Eyeballs)
+  const std::chrono::milliseconds connect_attempt_delay( 250 );
+
   /// \brief The Socket class is a wrapper around the low-level Unix socket routines.
   ///
   /// It provides functions to create connections with associated C++
@@ -44,9 +71,13 @@ namespace Sockets {
   ///
   /// There is also a non-blocking variant, which makes some asynchronous
   /// IO possible, using a timeout value
+  ///
+  /// The read() functions read the socket in chunks and keep the bytes
+  /// after a newline for the next call. So don't mix them with other
+  /// ways of reading the same socket (like an fdistream)
   class Socket {
   public:
-  Socket(): nonBlocking(false),sock(-1){
+  Socket(): nonBlocking(false),sock(-1),in_start(0),in_end(0){
       /// create a new Socket. Not connected yet!
     };
     virtual ~Socket();
@@ -63,16 +94,42 @@ namespace Sockets {
       */
       return sock;
     }
+    size_t pendingInput() const {
+      /*!
+	\return the number of bytes read from the socket, but not consumed
+	by read() yet
+      */
+      return in_end - in_start;
+    }
     bool read( std::string& );
     bool read( std::string&, unsigned int );
     bool write( const std::string& );
     bool write( const std::string&, unsigned int );
+    bool writeBuffer( const char *, size_t );
+    bool writeBuffers( const struct iovec *, int );
+    bool writeBuffers( const struct iovec *, int, std::chrono::milliseconds& );
+    bool readFrame( std::string&, size_t = default_max_frame );
+    bool writeFrame( const char *, size_t );
+    bool writeFrame( const std::string& );
+    bool sendFile( int, off_t, size_t );
+    bool sendFile( int, off_t, size_t, std::chrono::milliseconds& );
     bool setNonBlocking();
     bool setBlocking();
   protected:
     bool nonBlocking; //!< (non-)blocking status. default is false
     int sock;         //!< the id of the internal socket
     std::string mess; //!< a buffer to store error messages
+  private:
+    bool write_all( struct iovec *, int,
+		    const std::chrono::steady_clock::time_point * );
+    bool send_file( int, off_t, size_t,
+		    const std::chrono::steady_clock::time_point * );
+    ssize_t fill_buffer();
+    bool take_line( std::string& );
+    bool read_exact( char *, size_t );
+    std::vector<char> in_buf; //!< bytes read, but not yet consumed
+    size_t in_start;          //!< the first unconsumed byte in in_buf
+    size_t in_end;            //!< the end of the valid bytes in in_buf
   };
 
   /// \brief The ClientSocket implements a connect function to connect a Socket
@@ -81,6 +138,14 @@ namespace Sockets {
     friend class ServerSocket;
   public:
     bool connect( const std::string&, const std::string& );
+    bool connect( const struct sockaddr *, socklen_t );
+    bool connect( const std::string&, const std::string&,
+		  std::chrono::milliseconds );
+    bool connect( const std::vector<Address>&, std::chrono::milliseconds,
+		  std::chrono::milliseconds = connect_attempt_delay );
+    int connectFirst( const std::vector<std::pair<std::string,std::string>>&,
+		      std::chrono::milliseconds );
+    bool connectUnix( const std::string& );
     const std::string& getClientName() const {
       /*!
 	\return the name of the Client (auto-generated on creation)
@@ -89,14 +154,32 @@ namespace Sockets {
     };
   private:
     std::string clientName; //!< store the client's name here
+    int race( const std::vector<Address>&, std::chrono::milliseconds,
+	      std::chrono::milliseconds );
   };
 
   /// The ServerSocket implements functions to set up a Server on a port
+  /// or on a Unix domain socket
   class ServerSocket: public Socket {
   public:
-    bool connect( const std::string& );
+    ~ServerSocket();
+    bool connect( const std::string&, bool = false,
+		  const std::string& = "" );
+    bool connectUnix( const std::string& );
+    bool share( const ServerSocket& );
     bool listen( unsigned int = 5 );
-    bool accept( ClientSocket& newSocket );
+    bool accept( ClientSocket& newSocket, bool = true, bool = false );
+  private:
+    /// \brief a connection accepted in a batch, but not handed out yet
+    struct Pending {
+      int fd;
+      struct sockaddr_storage addr;
+      socklen_t len;
+    };
+    int accept_pending( struct sockaddr_storage&, socklen_t&, bool );
+    std::string unixPath; //!< the file of a Unix domain socket, if any
+    std::deque<Pending> pending; //!< only used by non-blocking sockets
+    bool shared = false; //!< a copy made by share(), it leaves the file
   };
 }
 
@@ -0,0 +1,102 @@
+/*
+  Copyright (c) 2006 - 2024
+  CLST  - Radboud University
+  ILK   - Tilburg University
+
+  This file is part of ticcutils
+
+  ticcutils is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  ticcutils is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+  For questions and suggestions, see:
+      https://github.com/LanguageMachines/ticcutils/issues
+  or send mail to:
+      lamasoftware (at ) science.ru.nl
+*/
+
+#ifndef TICC_TIMERWHEEL_H
+#define TICC_TIMERWHEEL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <chrono>
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+namespace TiCCServer {
+
+  /// \brief TimerWheel runs callbacks after a delay, on its own thread
+  ///
+  /// A hashed timing wheel: a timer is kept in the slot of the tick in
+  /// which it expires, so adding, cancelling and expiring are O(1), also
+  /// with many thousands of timers. Timers more than one turn of the
+  /// wheel away just stay in their slot for more turns. Timers expire at
+  /// most one tick late.
+  ///
+  /// A callback returns the delay after which it wants to run again, or 0
+  /// when it is done. It may not add or cancel timers itself.
+  class TimerWheel {
+  public:
+    typedef uint64_t Id;
+    typedef std::function<std::chrono::milliseconds()> Callback;
+    explicit TimerWheel( std::chrono::milliseconds
+			 = std::chrono::milliseconds( 100 ),
+			 size_t = 512 );
+    ~TimerWheel();
+    Id add( std::chrono::milliseconds, const Callback& );
+    bool cancel( Id );
+    size_t size() const;
+    void stop();
+    std::chrono::milliseconds tick() const {
+      /*!
+	\return the resolution of the wheel
+      */
+      return _tick;
+    };
+  private:
+    using clock = std::chrono::steady_clock;
+    struct Timer {
+      Id id;
+      uint64_t rounds;
+      Callback callback;
+    };
+    typedef std::list<Timer> Slot;
+    static const size_t due_slot = size_t(-1);
+    std::chrono::milliseconds _tick;
+    std::vector<Slot> _slots;
+    Slot _due; // expired, waiting for their callback
+    std::unordered_map<Id,std::pair<size_t,Slot::iterator>> _index;
+    clock::time_point _start;
+    uint64_t _current; // the last tick that is handled
+    Id _last_id;
+    Id _running;
+    bool _stopping;
+    mutable std::mutex _mutex;
+    std::condition_variable _cond;
+    std::condition_variable _done;
+    std::thread _thread;
+    uint64_t now_tick() const;
+    void place( Id, std::chrono::milliseconds, const Callback& );
+    void run();
+    TimerWheel( const TimerWheel& ) = delete;
+    TimerWheel& operator=( const TimerWheel& ) = delete;
+  };
+
+}
+
+#endif // TICC_TIMERWHEEL_H
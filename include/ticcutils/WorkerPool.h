@@ -0,0 +1,95 @@
+/*
+  Copyright (c) 2006 - 2024
+  CLST  - Radboud University
+  ILK   - Tilburg University
+
+  This file is part of ticcutils
+
+  ticcutils is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  ticcutils is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+  For questions and suggestions, see:
+      https://github.com/LanguageMachines/ticcutils/issues
+  or send mail to:
+      lamasoftware (at ) science.ru.nl
+*/
+
+#ifndef TICC_WORKERPOOL_H
+#define TICC_WORKERPOOL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+namespace TiCCServer {
+
+  /// \brief WorkerPool runs tasks on a fixed set of pre-spawned threads
+  class WorkerPool {
+  public:
+    typedef std::function<void(size_t)> StartHook;
+    explicit WorkerPool( size_t, const StartHook& = StartHook() );
+    ~WorkerPool();
+    void submit( const std::function<void()>& );
+    void stop();
+    size_t size() const {
+      /*!
+	\return the number of worker threads
+      */
+      return _threads.size();
+    };
+    size_t queued() const;
+    size_t busy() const {
+      /*!
+	\return the number of workers executing a task right now
+      */
+      return _busy;
+    };
+    uint64_t executed() const {
+      /*!
+	\return the number of tasks started so far
+      */
+      return _executed;
+    };
+    double average_wait() const;
+    double max_wait() const {
+      /*!
+	\return the longest time (in milliseconds) a task waited in the queue
+      */
+      return _max_wait / 1000.0;
+    };
+  private:
+    using clock = std::chrono::steady_clock;
+    std::vector<std::thread> _threads;
+    std::deque<std::pair<std::function<void()>,clock::time_point>> _queue;
+    mutable std::mutex _mutex;
+    std::condition_variable _cond;
+    bool _stopping;
+    std::atomic<size_t> _busy;
+    std::atomic<uint64_t> _executed;
+    std::atomic<uint64_t> _total_wait; // microseconds
+    std::atomic<uint64_t> _max_wait;   // microseconds
+    void work( size_t, const StartHook& );
+    WorkerPool( const WorkerPool& ) = delete;
+    WorkerPool& operator=( const WorkerPool& ) = delete;
+  };
+
+}
+
+#endif // TICC_WORKERPOOL_H
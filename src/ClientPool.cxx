@@ -0,0 +1,234 @@
+/*
+  Copyright (c) 2006 - 2024
+  CLST  - Radboud University
+  ILK   - Tilburg University
+
+  This file is part of ticcutils
+
+  ticcutils is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  ticcutils is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+  For questions and suggestions, see:
+      https://github.com/LanguageMachines/ticcutils/issues
+  or send mail to:
+      lamasoftware (at ) science.ru.nl
+*/
+
+#include "ticcutils/ClientPool.h"
+
+#include <cstring>
+#include <cerrno>
+#include <poll.h>
+
+using namespace std;
+
+namespace Sockets {
+
+  ClientPool::ClientPool( size_t max_idle,
+			  chrono::seconds idle_timeout,
+			  chrono::seconds dns_ttl,
+			  chrono::milliseconds connect_timeout ):
+    _max_idle( max_idle ),
+    _idle_timeout( idle_timeout ),
+    _dns_ttl( dns_ttl ),
+    _connect_timeout( connect_timeout ),
+    _connects( 0 ),
+    _reuses( 0 )
+  {
+    /// create a pool of client connections
+    /*!
+      \param max_idle the maximum number of idle connections kept per
+      host:port
+      \param idle_timeout connections idle for longer are closed
+      \param dns_ttl how long resolved addresses are re-used
+      \param connect_timeout the maximum time a new connection may take.
+      0 means no limit
+    */
+  }
+
+  ClientPool::~ClientPool(){
+    /// destroy the pool, and close the idle connections
+    /*!
+      connections that are still acquired should not be released
+      after this
+    */
+    clear();
+  }
+
+  static bool healthy( const ClientSocket *socket ){
+    /// check that an idle connection is still usable
+    /*!
+      An idle connection should have nothing to read. When it has, the
+      server closed it (EOF), reset it or sent something unexpected.
+    */
+    if ( !socket->isValid() || socket->pendingInput() > 0 ){
+      return false;
+    }
+    struct pollfd pfd;
+    pfd.fd = socket->getSockId();
+    pfd.events = POLLIN;
+#ifdef POLLRDHUP
+    pfd.events |= POLLRDHUP;
+#endif
+    pfd.revents = 0;
+    return poll( &pfd, 1, 0 ) == 0;
+  }
+
+  ClientSocket *ClientPool::acquire( const string& host,
+				     const string& port,
+				     string& mess ){
+    /// get a connection to host:port
+    /*!
+      \param host the name or address of the server. A name starting
+      with '/' is the file of a Unix domain socket
+      \param port the port of the server
+      \param mess on failure, the reason
+      \return a connected ClientSocket, or 0 on failure. Give it back
+      with release() when done.
+
+      The most recently used idle connection is re-used, when it is still
+      healthy. Otherwise a new connection is made, using the cached
+      address of the server when possible.
+    */
+    string key = host + ":" + port;
+    {
+      lock_guard<mutex> lock( _mutex );
+      expire( clock::now() );
+      auto it = _idle.find( key );
+      while ( it != _idle.end() && !it->second.empty() ){
+	ClientSocket *socket = it->second.back().socket;
+	it->second.pop_back();
+	if ( healthy( socket ) ){
+	  _in_use[socket] = key;
+	  ++_reuses;
+	  return socket;
+	}
+	delete socket;
+      }
+    }
+    vector<Address> addresses;
+    if ( !resolve( host, port, addresses, mess ) ){
+      return 0;
+    }
+    ClientSocket *socket = new ClientSocket();
+    socket->connect( addresses, _connect_timeout );
+    lock_guard<mutex> lock( _mutex );
+    if ( !socket->isValid() ){
+      mess = "ClientPool: connection to " + key + " failed: "
+	+ socket->getMessage();
+      delete socket;
+      // the server might have moved. Look it up again next time
+      _resolved.erase( key );
+      return 0;
+    }
+    ++_connects;
+    _in_use[socket] = key;
+    return socket;
+  }
+
+  void ClientPool::release( ClientSocket *socket, bool reuse ){
+    /// give back a connection acquired from this pool
+    /*!
+      \param socket the connection
+      \param reuse when false, close the connection. Use this after an
+      error, or when the answer wasn't read completely.
+
+      The connection is kept for re-use, unless there are max_idle
+      idle connections to the same server already.
+    */
+    if ( !socket ){
+      return;
+    }
+    lock_guard<mutex> lock( _mutex );
+    auto it = _in_use.find( socket );
+    if ( it != _in_use.end() ){
+      string key = it->second;
+      _in_use.erase( it );
+      if ( reuse
+	   && socket->isValid()
+	   && socket->pendingInput() == 0 ){
+	vector<Idle>& idle = _idle[key];
+	if ( idle.size() < _max_idle ){
+	  Idle entry;
+	  entry.socket = socket;
+	  entry.since = clock::now();
+	  idle.push_back( entry );
+	  return;
+	}
+      }
+    }
+    delete socket;
+  }
+
+  void ClientPool::clear(){
+    /// close all idle connections and forget all addresses
+    lock_guard<mutex> lock( _mutex );
+    for ( const auto& it : _idle ){
+      for ( const auto& entry : it.second ){
+	delete entry.socket;
+      }
+    }
+    _idle.clear();
+    _resolved.clear();
+  }
+
+  size_t ClientPool::idle() const {
+    /// the number of idle connections
+    lock_guard<mutex> lock( _mutex );
+    size_t result = 0;
+    for ( const auto& it : _idle ){
+      result += it.second.size();
+    }
+    return result;
+  }
+
+  void ClientPool::expire( clock::time_point now ){
+    /// close the connections that are idle too long. Call with _mutex held
+    for ( auto& it : _idle ){
+      vector<Idle>& idle = it.second;
+      // the oldest are in front
+      size_t old = 0;
+      while ( old < idle.size() && idle[old].since + _idle_timeout <= now ){
+	delete idle[old].socket;
+	++old;
+      }
+      idle.erase( idle.begin(), idle.begin() + old );
+    }
+  }
+
+  bool ClientPool::resolve( const string& host,
+			    const string& port,
+			    vector<Address>& addresses,
+			    string& mess ){
+    /// look up the addresses of host:port, or take them from the cache
+    string key = host + ":" + port;
+    {
+      lock_guard<mutex> lock( _mutex );
+      auto it = _resolved.find( key );
+      if ( it != _resolved.end() && it->second.expires > clock::now() ){
+	addresses = it->second.addresses;
+	return true;
+      }
+    }
+    if ( !resolveAddress( host, port, addresses, mess ) ){
+      mess = "ClientPool: " + mess;
+      return false;
+    }
+    lock_guard<mutex> lock( _mutex );
+    Resolved& r = _resolved[key];
+    r.addresses = addresses;
+    r.expires = clock::now() + _dns_ttl;
+    return true;
+  }
+
+}
@@ -0,0 +1,206 @@
+/*
+  Copyright (c) 2006 - 2024
+  CLST  - Radboud University
+  ILK   - Tilburg University
+
+  This file is part of ticcutils
+
+  ticcutils is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  ticcutils is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+  For questions and suggestions, see:
+      https://github.com/LanguageMachines/ticcutils/issues
+  or send mail to:
+      lamasoftware (at ) science.ru.nl
+*/
+
+#include "ticcutils/CpuAffinity.h"
+
+#include <dirent.h>
+#include <sched.h>
+#include <cerrno>
+#include <cstdlib>
+#include <algorithm>
+#include <fstream>
+#include <thread>
+#include "ticcutils/StringOps.h"
+#include "config.h"
+
+using namespace std;
+
+namespace TiCCServer {
+
+  const int max_cpus = 65536; // sanity limit for CPU numbers
+
+  bool parseCpuList( const string& line, CpuList& result ){
+    /// parse a list of CPU numbers
+    /*!
+      \param line a comma separated list of numbers and ranges, like
+      "0-3,8,10-11". The format of taskset -c and /sys
+      \param result the CPUs found. Sorted, without duplicates
+      \return false when line is empty or not a valid list
+    */
+    result.clear();
+    vector<string> parts = TiCC::split_at( TiCC::trim( line ), "," );
+    if ( parts.empty() ){
+      return false;
+    }
+    for ( const auto& part : parts ){
+      string item = TiCC::trim( part );
+      if ( item.empty() || item.front() == '-' || item.back() == '-' ){
+	return false;
+      }
+      vector<string> range = TiCC::split_at( item, "-" );
+      int low = -1;
+      int high = -1;
+      if ( range.size() == 1 ){
+	if ( !TiCC::stringTo( range[0], low ) ){
+	  return false;
+	}
+	high = low;
+      }
+      else if ( range.size() != 2
+		|| !TiCC::stringTo( range[0], low )
+		|| !TiCC::stringTo( range[1], high ) ){
+	return false;
+      }
+      if ( low < 0 || high < low || high >= max_cpus ){
+	return false;
+      }
+      for ( int cpu=low; cpu <= high; ++cpu ){
+	result.push_back( cpu );
+      }
+    }
+    sort( result.begin(), result.end() );
+    result.erase( unique( result.begin(), result.end() ), result.end() );
+    return true;
+  }
+
+  string formatCpuList( const CpuList& cpus ){
+    /// format a list of CPUs the way parseCpuList() reads it
+    string result;
+    for ( size_t i=0; i < cpus.size(); ){
+      size_t j = i;
+      while ( j+1 < cpus.size() && cpus[j+1] == cpus[j] + 1 ){
+	++j;
+      }
+      if ( !result.empty() ){
+	result += ",";
+      }
+      result += TiCC::toString( cpus[i] );
+      if ( j > i ){
+	result += "-" + TiCC::toString( cpus[j] );
+      }
+      i = j + 1;
+    }
+    return result;
+  }
+
+  CpuList onlineCpus(){
+    /// return the CPUs this process may run on
+    CpuList result;
+#ifdef HAVE_SCHED_SETAFFINITY
+    cpu_set_t set;
+    CPU_ZERO( &set );
+    if ( sched_getaffinity( 0, sizeof(set), &set ) == 0 ){
+      for ( int cpu=0; cpu < CPU_SETSIZE; ++cpu ){
+	if ( CPU_ISSET( cpu, &set ) ){
+	  result.push_back( cpu );
+	}
+      }
+      return result;
+    }
+#endif
+    int num = std::max( 1u, std::thread::hardware_concurrency() );
+    for ( int cpu=0; cpu < num; ++cpu ){
+      result.push_back( cpu );
+    }
+    return result;
+  }
+
+  vector<CpuList> numaNodes(){
+    /// return the CPUs of every NUMA node
+    /*!
+      \return a list per node with CPUs, limited to the ones this process
+      may run on. Nodes without such CPUs are left out. When the system
+      tells nothing about its nodes, all CPUs form one node
+    */
+    const string dir = "/sys/devices/system/node";
+    vector<pair<int,CpuList>> nodes;
+    CpuList allowed = onlineCpus();
+    DIR *dp = opendir( dir.c_str() );
+    if ( dp ){
+      while ( struct dirent *entry = readdir( dp ) ){
+	string name = entry->d_name;
+	int node = -1;
+	if ( name.compare( 0, 4, "node" ) != 0
+	     || !TiCC::stringTo( name.substr( 4 ), node ) ){
+	  continue;
+	}
+	ifstream is( dir + "/" + name + "/cpulist" );
+	string line;
+	CpuList cpus;
+	if ( !getline( is, line ) || !parseCpuList( line, cpus ) ){
+	  continue;
+	}
+	CpuList usable;
+	set_intersection( cpus.begin(), cpus.end(),
+			  allowed.begin(), allowed.end(),
+			  back_inserter( usable ) );
+	if ( !usable.empty() ){
+	  nodes.emplace_back( node, usable );
+	}
+      }
+      closedir( dp );
+    }
+    sort( nodes.begin(), nodes.end() );
+    vector<CpuList> result;
+    for ( const auto& node : nodes ){
+      result.push_back( node.second );
+    }
+    if ( result.empty() ){
+      result.push_back( allowed );
+    }
+    return result;
+  }
+
+  bool pinThread( const CpuList& cpus ){
+    /// restrict the calling thread to some CPUs
+    /*!
+      \param cpus the CPUs to run on
+      \return false when cpus is empty, when none of them is available,
+      or when the system does not support it. errno tells why
+
+      threads started afterwards by this thread inherit the setting
+    */
+#ifdef HAVE_SCHED_SETAFFINITY
+    if ( cpus.empty() ){
+      errno = EINVAL;
+      return false;
+    }
+    cpu_set_t set;
+    CPU_ZERO( &set );
+    for ( auto cpu : cpus ){
+      if ( cpu < CPU_SETSIZE ){
+	CPU_SET( cpu, &set );
+      }
+    }
+    return sched_setaffinity( 0, sizeof(set), &set ) == 0;
+#else
+    (void)cpus;
+    errno = ENOSYS;
+    return false;
+#endif
+  }
+
+}
@@ -25,7 +25,7 @@
 */
 
 #include "ticcutils/FdStream.h"
-#include "ticcutils/Timer.h"
+#include "ticcutils/IoRing.h"
 
 #include <cstring>
 #include <cstdio>
@@ -33,18 +33,31 @@
 #include <csignal>
 #include <iostream>
 #include <stdexcept>
+#include <algorithm>
 #include <unistd.h>
+#include <poll.h>
 
 using namespace std;
 
-fdoutbuf::fdoutbuf(): _fd(-1) {
+fdoutbuf::fdoutbuf(): _fd(-1), _buffer( default_buffer_size ), _count(0) {
   /// constructor for a non-initialized fd output buffer
+  setp( _buffer.data(), _buffer.data() + _buffer.size() );
 }
-fdoutbuf::fdoutbuf( int fd ): _fd(fd) {
+
+fdoutbuf::fdoutbuf( int fd ): _fd(fd), _buffer( default_buffer_size ),
+  _count(0) {
   /// constructor for a fd output buffer connected to a file descriptor
   /*!
     \param fd the file descriptor
   */
+  setp( _buffer.data(), _buffer.data() + _buffer.size() );
+}
+
+fdoutbuf::~fdoutbuf(){
+  /// destructor. Writes what is left in the buffer
+  if ( _fd >= 0 ){
+    flush_buffer();
+  }
 }
 
 bool fdoutbuf::connect( int fd ){
@@ -60,19 +73,91 @@ bool fdoutbuf::connect( int fd ){
   return true;
 }
 
+void fdoutbuf::set_buffer_size( size_t size ){
+  /// change the size of the output buffer
+  /*!
+    \param size the new size. 0 means: no buffering at all
+
+    pending output is written first
+  */
+  if ( _fd >= 0 ){
+    flush_buffer();
+  }
+  size_t pending = pptr() - pbase();
+  if ( pending > size ){
+    // could not be written. keep it
+    size = pending;
+  }
+  vector<char> tmp( size );
+  memcpy( tmp.data(), pbase(), pending );
+  _buffer.swap( tmp );
+  setp( _buffer.data(), _buffer.data() + _buffer.size() );
+  pbump( pending );
+}
+
+bool fdoutbuf::flush_buffer(){
+  /// write the buffered characters to the file descriptor
+  /*!
+    \return true when all is written. When false, errno tells why and
+    the characters that could not be written stay in the buffer
+  */
+  char *start = pbase();
+  bool result = true;
+  while ( start < pptr() ){
+    ssize_t num = TiCC::IoRing::write( _fd, start, pptr() - start );
+    if ( num < 0 ){
+      if ( errno == EINTR ){
+	continue;
+      }
+      result = false;
+      break;
+    }
+    start += num;
+    _count += num;
+  }
+  size_t left = pptr() - start;
+  if ( left > 0 && start != pbase() ){
+    memmove( pbase(), start, left );
+  }
+  setp( pbase(), epptr() );
+  pbump( left );
+  return result;
+}
+
 int fdoutbuf::overflow( int c ){
   /// overloaded version of streambuf::overflow()
   /*!
     \param c the character to write (integer value!)
     \return the character written, OR EOF when we are done
   */
-  if ( c != EOF ){
-    char z = c;
-    if ( write( _fd, &z, 1 ) != 1 ) {
-      return EOF;
+  if ( _buffer.empty() ){
+    if ( c != EOF ){
+      char z = c;
+      if ( TiCC::IoRing::write( _fd, &z, 1 ) != 1 ) {
+	return EOF;
+      }
+      ++_count;
     }
+    return c;
+  }
+  if ( !flush_buffer()
+       && ( pptr() == epptr()
+	    || ( errno != EAGAIN && errno != EWOULDBLOCK ) ) ){
+    return EOF;
   }
-  return c;
+  if ( c != EOF ){
+    *pptr() = c;
+    pbump(1);
+  }
+  return traits_type::not_eof( c );
+}
+
+int fdoutbuf::sync(){
+  /// overloaded version of streambuf::sync()
+  /*!
+    \return 0 when all buffered output is written, -1 otherwise
+  */
+  return flush_buffer() ? 0 : -1;
 }
 
 streamsize fdoutbuf::xsputn( const char *s, streamsize num ){
@@ -81,26 +166,56 @@ streamsize fdoutbuf::xsputn( const char *s, streamsize num ){
     \param s the range of characters to write
     \param num the number of characters to write
     \return the number of characters actually written
+
+    small chunks are collected in the buffer, large ones are written
+    directly
   */
-  return write( _fd, s, num );
+  if ( num <= epptr() - pptr() ){
+    memcpy( pptr(), s, num );
+    pbump( num );
+    return num;
+  }
+  if ( !flush_buffer() ){
+    return 0;
+  }
+  if ( num < epptr() - pbase() ){
+    memcpy( pptr(), s, num );
+    pbump( num );
+    return num;
+  }
+  streamsize done = 0;
+  while ( done < num ){
+    ssize_t res = TiCC::IoRing::write( _fd, s + done, num - done );
+    if ( res < 0 ){
+      if ( errno == EINTR ){
+	continue;
+      }
+      break;
+    }
+    done += res;
+    _count += res;
+  }
+  return done;
 }
 
 
-fdinbuf::fdinbuf(): _fd(-1) {
+fdinbuf::fdinbuf(): _fd(-1), _buffer( default_buffer_size + putbackSize ),
+  _count(0) {
   /// constructor for a non-initialized fd input buffer
-  setg( _buffer + putbackSize,
-	_buffer + putbackSize,
-	_buffer + putbackSize );
+  setg( _buffer.data() + putbackSize,
+	_buffer.data() + putbackSize,
+	_buffer.data() + putbackSize );
 }
 
-fdinbuf::fdinbuf( int fd ): _fd(fd) {
+fdinbuf::fdinbuf( int fd ): _fd(fd),
+  _buffer( default_buffer_size + putbackSize ), _count(0) {
   /// constructor for a fd input buffer connected to a file descriptor
   /*!
     \param fd the file descriptor
   */
-  setg( _buffer + putbackSize,
-	_buffer + putbackSize,
-	_buffer + putbackSize );
+  setg( _buffer.data() + putbackSize,
+	_buffer.data() + putbackSize,
+	_buffer.data() + putbackSize );
 }
 
 bool fdinbuf::connect( int fd ){
@@ -116,6 +231,32 @@ bool fdinbuf::connect( int fd ){
   return true;
 }
 
+void fdinbuf::set_buffer_size( size_t size ){
+  /// change the size of the input buffer
+  /*!
+    \param size the new size. Characters not yet read are kept, so the
+    buffer might become somewhat larger
+  */
+  size_t pending = 0;
+  if ( gptr() ){
+    pending = egptr() - gptr();
+  }
+  if ( size < pending ){
+    size = pending;
+  }
+  if ( size == 0 ){
+    size = 1;
+  }
+  vector<char> tmp( size + putbackSize );
+  if ( pending > 0 ){
+    memcpy( tmp.data() + putbackSize, gptr(), pending );
+  }
+  _buffer.swap( tmp );
+  setg( _buffer.data() + putbackSize,
+	_buffer.data() + putbackSize,
+	_buffer.data() + putbackSize + pending );
+}
+
 int fdinbuf::underflow(){
   /// overloaded version of streambuf::underflow()
   /*!
@@ -128,112 +269,320 @@ int fdinbuf::underflow(){
   if ( numPutBack > putbackSize ) {
     numPutBack = putbackSize;
   }
-
-  std::memmove( _buffer + putbackSize - numPutBack,
-	       gptr() - numPutBack,
-	       numPutBack );
-  int num = read( _fd, _buffer+putbackSize, bufferSize - putbackSize );
+  char *buffer = _buffer.data();
+  std::memmove( buffer + putbackSize - numPutBack,
+		gptr() - numPutBack,
+		numPutBack );
+  ssize_t num;
+  do {
+    num = TiCC::IoRing::read( _fd, buffer+putbackSize,
+			      _buffer.size() - putbackSize );
+  } while ( num < 0 && errno == EINTR );
   if ( num <= 0 ){
     setg( 0, 0, 0 );
     return traits_type::eof();
   }
-  setg( _buffer + putbackSize - numPutBack,
-	_buffer + putbackSize,
-	_buffer + putbackSize + num );
+  _count += num;
+  setg( buffer + putbackSize - numPutBack,
+	buffer + putbackSize,
+	buffer + putbackSize + num );
   return traits_type::to_int_type(*gptr());
 }
 
+streamsize fdinbuf::xsgetn( char *s, streamsize num ){
+  /// overloaded version of streambuf::xsgetn()
+  /*!
+    \param s the buffer to fill
+    \param num the number of characters wanted
+    \return the number of characters actually read
+
+    requests larger than our buffer are read directly into s
+  */
+  streamsize done = 0;
+  while ( done < num ){
+    streamsize avail = egptr() - gptr();
+    if ( avail > 0 ){
+      streamsize chunk = std::min( avail, num - done );
+      memcpy( s + done, gptr(), chunk );
+      gbump( chunk );
+      done += chunk;
+      continue;
+    }
+    streamsize wanted = num - done;
+    if ( wanted < streamsize( buffer_size() ) ){
+      if ( underflow() == traits_type::eof() ){
+	break;
+      }
+      continue;
+    }
+    ssize_t res = TiCC::IoRing::read( _fd, s + done, wanted );
+    if ( res < 0 && errno == EINTR ){
+      continue;
+    }
+    if ( res <= 0 ){
+      setg( 0, 0, 0 );
+      break;
+    }
+    done += res;
+    _count += res;
+    // keep the last characters for putback
+    int numPutBack = std::min( done, streamsize(putbackSize) );
+    char *buffer = _buffer.data();
+    memcpy( buffer + putbackSize - numPutBack, s + done - numPutBack,
+	    numPutBack );
+    setg( buffer + putbackSize - numPutBack,
+	  buffer + putbackSize,
+	  buffer + putbackSize );
+  }
+  return done;
+}
+
 // #define DEBUG
 
-bool nb_getline( istream& is, string& result, int& timeout ){
+bool fdinbuf::take_line( string& line ){
+  /// move buffered characters to line, upto the next newline
+  /*!
+    \param line the string to extend
+    \return true when a newline was found. It is consumed, but not added.
+    false when the buffer is exhausted
+  */
+  if ( gptr() == egptr() ){
+    return false;
+  }
+  streamsize avail = egptr() - gptr();
+  const char *nl = static_cast<const char*>( memchr( gptr(), '\n', avail ) );
+  streamsize take = nl ? nl - gptr() : avail;
+  line.append( gptr(), take );
+  if ( nl ){
+    gbump( take + 1 );
+    return true;
+  }
+  gbump( take );
+  return false;
+}
+
+using namespace std::chrono;
+
+static bool wait_for( int fd, short events,
+		      const steady_clock::time_point& deadline ){
+  /// wait until fd is ready for events, or the deadline has passed
+  /*!
+    \param fd the file descriptor to watch
+    \param events POLLIN or POLLOUT
+    \param deadline the moment to give up
+    \return true when fd is ready (or has an error condition to report).
+    false on timeout
+  */
+  while ( true ){
+    auto left = ceil<milliseconds>( deadline - steady_clock::now() ).count();
+    if ( left <= 0 ){
+      return false;
+    }
+    struct pollfd pfd;
+    pfd.fd = fd;
+    pfd.events = events;
+    pfd.revents = 0;
+    int res = poll( &pfd, 1, left );
+    if ( res > 0 ){
+      return true;
+    }
+    if ( res == 0 || errno != EINTR ){
+      return false;
+    }
+  }
+}
+
+static void set_remaining( milliseconds& timeout,
+			   const steady_clock::time_point& deadline ){
+  /// store the time left until deadline in timeout
+  auto left = ceil<milliseconds>( deadline - steady_clock::now() );
+  timeout = ( left.count() > 0 ) ? left : milliseconds(0);
+}
+
+bool nb_getline( istream& is, string& result, milliseconds& timeout,
+		 size_t max_length ){
   /// a getline for nonblocking connections.
   /*!
     \param is the stream te read from. Should be non-blocking!
     \param result the string read
-    \param timeout the retry time in seconds until failure
+    \param timeout the maximum time to wait for a complete line. On return
+    it holds the time that was left
+    \param max_length when not 0, give up on lines longer than this. Then
+    false is returned, and result holds more than max_length characters
     \return false except when correctly terminated
     ( meaning \n or an EOF after at least some input)
 
-    this function will retry the read for a few special cases until timeout
-    is reached.
+    When is is an fdistream, we wait for new input using poll() and
+    handle the buffered input in chunks. The stream tied to is, if any,
+    is flushed first.
   */
   result = "";
-  char c;
-  int count = 0;
-  while ( is && timeout > 0 ){
-    if ( is.get( c ) ){
-#ifdef DEBUG
-      cerr << "-'" << c << "'-" << endl;
-#endif
-      if ( c == '\n' ){
-	return true;
-      }
-      result += c;
+  fdinbuf *buf = dynamic_cast<fdinbuf*>( is.rdbuf() );
+  if ( !buf ){
+    // no file descriptor to wait for. so no reason to wait
+    return static_cast<bool>( getline( is, result ) );
+  }
+  if ( is.tie() ){
+    // we bypass the sentry, so send a pending prompt ourselves
+    is.tie()->flush();
+  }
+  auto deadline = steady_clock::now() + timeout;
+  while ( is ){
+    bool complete = buf->take_line( result );
+    if ( max_length > 0 && result.size() > max_length ){
+      set_remaining( timeout, deadline );
+      return false;
     }
-    else if ( errno == EAGAIN || errno == EWOULDBLOCK ){
+    if ( complete ){
+      set_remaining( timeout, deadline );
+      return true;
+    }
+    errno = 0;
+    if ( buf->sgetc() != EOF ){
+      continue;
+    }
+    if ( errno == EAGAIN || errno == EWOULDBLOCK ){
 #ifdef DEBUG
       cerr << "Blocked again" << endl;
 #endif
-      is.clear();
-      errno = 0;
-      TiCC::Timer::milli_wait(100);
-      if ( ++count == 10 ){
-	--timeout;
-	count = 0;
+      if ( !wait_for( buf->fd(), POLLIN, deadline ) ){
+	break;
       }
     }
-    else if ( is.eof() && !result.empty() ){
-      return true;
-    }
     else {
-      return false;
+      // EOF or a real error
+      set_remaining( timeout, deadline );
+      if ( result.empty() ){
+	is.setstate( ios::eofbit|ios::failbit );
+	return false;
+      }
+      is.setstate( ios::eofbit );
+      return true;
     }
   }
+  set_remaining( timeout, deadline );
   return false;
 }
 
-bool nb_putline( ostream& os, const string& what, int& timeout ){
+bool nb_getline( istream& is, string& result, int& timeout ){
+  /// a getline for nonblocking connections.
+  /*!
+    \param is the stream te read from. Should be non-blocking!
+    \param result the string read
+    \param timeout the retry time in seconds until failure
+    \return false except when correctly terminated
+    ( meaning \n or an EOF after at least some input)
+
+    See the millisecond version
+  */
+  milliseconds ms = seconds( timeout );
+  bool result_ok = nb_getline( is, result, ms );
+  timeout = ceil<seconds>( ms ).count();
+  return result_ok;
+}
+
+bool nb_read( istream& is, string& result, size_t count,
+	      milliseconds& timeout ){
+  /// read a fixed number of characters from a nonblocking connection
+  /*!
+    \param is the stream to read from. Should be non-blocking!
+    \param result the characters read
+    \param count the number of characters wanted
+    \param timeout the maximum time to wait for all of them. On return
+    it holds the time that was left
+    \return true when count characters are read. false on EOF, error
+    or timeout
+  */
+  result.resize( count );
+  fdinbuf *buf = dynamic_cast<fdinbuf*>( is.rdbuf() );
+  if ( !buf ){
+    is.read( &result[0], count );
+    result.resize( is.gcount() );
+    return result.size() == count;
+  }
+  if ( is.tie() ){
+    is.tie()->flush();
+  }
+  auto deadline = steady_clock::now() + timeout;
+  size_t done = 0;
+  while ( done < count ){
+    errno = 0;
+    done += buf->sgetn( &result[done], count - done );
+    if ( done == count ){
+      break;
+    }
+    if ( ( errno != EAGAIN && errno != EWOULDBLOCK )
+	 || !wait_for( buf->fd(), POLLIN, deadline ) ){
+      break;
+    }
+  }
+  result.resize( done );
+  set_remaining( timeout, deadline );
+  return done == count;
+}
+
+bool nb_putline( ostream& os, const string& what, milliseconds& timeout ){
   /// a putline for nonblocking connections.
   /*!
     \param os the output stream, must be NON-BLOCKING
     \param what the buffer to write
-    \param timeout the time in seconds to wait until failure
-    \return false except when correctly terminated.
-    retry for a few special cases until timeout reached.
+    \param timeout the maximum time to wait until all is written. On return
+    it holds the time that was left
+    \return true when everything is written, false otherwise
 
+    When os is an fdostream, we wait until the connection can take more
+    using poll().
     Must handle SIGPIPE.
   */
-  unsigned int i=0;
-  int count = 0;
-  bool result = true;
+  fdoutbuf *buf = dynamic_cast<fdoutbuf*>( os.rdbuf() );
+  if ( !buf ){
+    os << what;
+    os.flush();
+    return static_cast<bool>( os );
+  }
+  auto deadline = steady_clock::now() + timeout;
   using sig_hndl = void (*)(int);
   sig_hndl sig;
   // specify that the SIGPIPE signal is to be ignored
   sig=signal(SIGPIPE,SIG_IGN);
-  while ( result && i < what.length() && os && timeout > 0 ){
-    if ( os.put( what[i] ) ){
-      ++i;
+  bool result = false;
+  size_t done = 0;
+  while ( os ){
+    errno = 0;
+    done += buf->sputn( what.data() + done, what.length() - done );
+    if ( done == what.length() && buf->pubsync() == 0 ){
+      result = true;
+      break;
+    }
+    if ( errno != EAGAIN && errno != EWOULDBLOCK ){
+      break;
     }
-    else if ( errno == EAGAIN || errno == EWOULDBLOCK ){
 #ifdef DEBUG
-      cerr << "Blocked again" << endl;
+    cerr << "Blocked again" << endl;
 #endif
-      os.clear();
-      errno = 0;
-      TiCC::Timer::milli_wait(100);
-      if ( ++count == 10 ){
-	--timeout;
-	count = 0;
-      }
-    }
-    else
-      result = false;
-    if ( os.eof() ){
-      result = false;
+    if ( !wait_for( buf->fd(), POLLOUT, deadline ) ){
+      break;
     }
   }
   // restore old handler
   signal( SIGPIPE, sig );
+  set_remaining( timeout, deadline );
+  return result;
+}
+
+bool nb_putline( ostream& os, const string& what, int& timeout ){
+  /// a putline for nonblocking connections.
+  /*!
+    \param os the output stream, must be NON-BLOCKING
+    \param what the buffer to write
+    \param timeout the time in seconds to wait until failure
+    \return false except when correctly terminated.
+
+    See the millisecond version
+  */
+  milliseconds ms = seconds( timeout );
+  bool result = nb_putline( os, what, ms );
+  timeout = ceil<seconds>( ms ).count();
   return result;
 }
 
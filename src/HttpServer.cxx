@@ -0,0 +1,586 @@
+/*
+  Copyright (c) 2006 - 2024
+  CLST  - Radboud University
+  ILK   - Tilburg University
+
+  This file is part of ticcutils
+
+  ticcutils is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  ticcutils is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+  For questions and suggestions, see:
+      https://github.com/LanguageMachines/ticcutils/issues
+  or send mail to:
+      lamasoftware (at ) science.ru.nl
+*/
+
+
+#include "ticcutils/ServerBase.h"
+
+#include <string>
+#include <sstream>
+#include <fstream>
+#include <iterator>
+#include <algorithm>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "ticcutils/StringOps.h"
+
+using namespace std;
+using namespace TiCC;
+
+#define LOG *Log(_my_log)
+#define DBG *Dbg(_my_log)
+
+namespace TiCCServer {
+
+  const int max_headers = 100;
+  const size_t max_request_line = 8192;
+  const size_t max_header_line = 8192;
+
+  string HttpRequest::header( const string& name ) const {
+    /// get the value of a header
+    /*!
+      \param name the name of the header (case insensitive)
+      \return the value, or an empty string when not present
+    */
+    auto it = headers.find( lowercase( name ) );
+    if ( it != headers.end() ){
+      return it->second;
+    }
+    return "";
+  }
+
+  bool HttpRequest::keep_alive() const {
+    /// does the client want to keep the connection open?
+    /*!
+      \return true for HTTP/1.1, unless the client asked for 'close', and
+      for HTTP/1.0 when the client asked for 'keep-alive'
+    */
+    string conn = lowercase( header( "connection" ) );
+    if ( version == "HTTP/1.1" ){
+      return conn.find( "close" ) == string::npos;
+    }
+    return conn.find( "keep-alive" ) != string::npos;
+  }
+
+  static string reason_phrase( int status ){
+    /// the standard reason phrase for the most common status codes
+    switch ( status ){
+    case 200: return "OK";
+    case 201: return "Created";
+    case 204: return "No Content";
+    case 301: return "Moved Permanently";
+    case 302: return "Found";
+    case 304: return "Not Modified";
+    case 400: return "Bad Request";
+    case 403: return "Forbidden";
+    case 404: return "Not Found";
+    case 405: return "Method Not Allowed";
+    case 408: return "Request Timeout";
+    case 411: return "Length Required";
+    case 413: return "Payload Too Large";
+    case 414: return "URI Too Long";
+    case 431: return "Request Header Fields Too Large";
+    case 500: return "Internal Server Error";
+    case 501: return "Not Implemented";
+    case 503: return "Service Unavailable";
+    case 505: return "HTTP Version Not Supported";
+    default: return "Unknown";
+    }
+  }
+
+  static int parse_request_line( const string& line, HttpRequest& request ){
+    /// fill in method, target and version from the request line
+    /*!
+      \return 200, or the status code of the error
+    */
+    vector<string> parts = split( line );
+    if ( parts.size() != 3 ){
+      return 400;
+    }
+    request.method = parts[0];
+    request.target = parts[1];
+    request.version = parts[2];
+    if ( request.version != "HTTP/1.1" && request.version != "HTTP/1.0" ){
+      return 505;
+    }
+    return 200;
+  }
+
+  static int parse_header( const string& line, HttpRequest& request,
+			   int& count ){
+    /// add one header line (without the line end) to the request
+    /*!
+      \param count the number of header lines so far
+      \return 200, or the status code of the error
+    */
+    if ( ++count > max_headers ){
+      return 431;
+    }
+    string::size_type pos = line.find( ':' );
+    if ( pos == string::npos || pos == 0 ){
+      return 400;
+    }
+    string name = lowercase( line.substr( 0, pos ) );
+    string value = TiCC::trim( line.substr( pos+1 ) );
+    auto it = request.headers.find( name );
+    if ( it != request.headers.end() ){
+      it->second += ", " + value;
+    }
+    else {
+      request.headers[name] = value;
+    }
+    return 200;
+  }
+
+  HttpServerBase::HttpServerBase( const Configuration *config,
+				  void *callback_data ):
+    ServerBase( config, callback_data ),
+    _http_timeout( 5000 ),
+    _http_max_requests( 100 ),
+    _http_max_body( Sockets::default_max_frame )
+  {
+    /// create a HTTP Server
+    /*!
+      \param config the configuration informatio to use
+      \param callback_data a structure with data to use in every call
+
+      besides the ServerBase settings, these are used:
+      http_timeout: the seconds to wait for (the rest of) a request
+      http_max_requests: the number of requests on one connection
+      http_max_body: the largest request body accepted, in bytes
+    */
+    string value = config->lookUp( "http_timeout" );
+    if ( !value.empty() ){
+      int secs;
+      if ( !stringTo( value, secs ) || secs <= 0 ){
+	string mess = "HttpServerBase: invalid value '" + value
+	  + "' for http_timeout";
+	throw runtime_error( mess );
+      }
+      _http_timeout = chrono::seconds( secs );
+    }
+    value = config->lookUp( "http_max_requests" );
+    if ( !value.empty() ){
+      if ( !stringTo( value, _http_max_requests )
+	   || _http_max_requests <= 0 ){
+	string mess = "HttpServerBase: invalid value '" + value
+	  + "' for http_max_requests";
+	throw runtime_error( mess );
+      }
+    }
+    value = config->lookUp( "http_max_body" );
+    if ( !value.empty() ){
+      if ( !stringTo( value, _http_max_body ) ){
+	string mess = "HttpServerBase: invalid value '" + value
+	  + "' for http_max_body";
+	throw runtime_error( mess );
+      }
+    }
+  }
+
+  int HttpServerBase::body_length( const HttpRequest& request,
+				   size_t& len ) const {
+    /// find the size of the body of a request
+    /*!
+      \param request the request, with its headers
+      \param len the size of the body, 0 when there is none
+      \return 200, or the status code of the error
+    */
+    len = 0;
+    if ( !request.header( "transfer-encoding" ).empty() ){
+      // chunked request bodies are not supported. We can't find the end
+      // of the body, so the connection is closed
+      return 501;
+    }
+    string value = request.header( "content-length" );
+    if ( !value.empty() ){
+      if ( !stringTo( value, len ) ){
+	return 400;
+      }
+      if ( len > _http_max_body ){
+	// don't even try to read it
+	return 413;
+      }
+    }
+    return 200;
+  }
+
+  int HttpServerBase::parse_request( const string& in, size_t& used,
+				     HttpRequest& request ) const {
+    /// take a request from the start of a buffer (event mode)
+    /*!
+      \param in the received data, without empty lines in front
+      \param used the size of the request in the buffer. When only the
+      body is incomplete: the size the buffer needs
+      \param request the request to fill
+      \return 200 when a complete request is found, 0 when more data is
+      needed, and otherwise the status code of the error to send
+
+      The same limits apply as in read_request()
+    */
+    used = 0;
+    size_t pos = in.find( '\n' );
+    if ( pos == string::npos ){
+      return in.size() > max_request_line ? 414 : 0;
+    }
+    if ( pos > max_request_line ){
+      return 414;
+    }
+    int status = parse_request_line( TiCC::trim( in.substr( 0, pos ) ),
+				     request );
+    if ( status != 200 ){
+      return status;
+    }
+    size_t start = pos + 1;
+    int count = 0;
+    while ( true ){
+      pos = in.find( '\n', start );
+      if ( pos == string::npos ){
+	return in.size() - start > max_header_line ? 431 : 0;
+      }
+      if ( pos - start > max_header_line ){
+	return 431;
+      }
+      string line = in.substr( start, pos - start );
+      start = pos + 1;
+      if ( !line.empty() && line.back() == '\r' ){
+	line.pop_back();
+      }
+      if ( line.empty() ){
+	break;
+      }
+      status = parse_header( line, request, count );
+      if ( status != 200 ){
+	return status;
+      }
+    }
+    size_t len = 0;
+    status = body_length( request, len );
+    if ( status != 200 ){
+      return status;
+    }
+    used = start + len;
+    if ( in.size() < used ){
+      return 0;
+    }
+    request.body = in.substr( start, len );
+    return 200;
+  }
+
+  int HttpServerBase::read_request( childArgs *args,
+				    HttpRequest& request,
+				    chrono::milliseconds& timeout ){
+    /// read the next request from a connection
+    /*!
+      \param args the connection
+      \param request the request to fill
+      \param timeout the time to wait for the complete request
+      \return 200 when a request is read, 0 when the connection is closed
+      or idle for too long, and otherwise the status code of the error to
+      send to the client
+
+      The body is only read when it is not larger than http_max_body.
+    */
+    istream& is = args->is();
+    string line;
+    do {
+      // tolerate empty lines in front of a request
+      if ( !nb_getline( is, line, timeout, max_request_line ) ){
+	return line.size() > max_request_line ? 414 : 0;
+      }
+      line = TiCC::trim( line );
+    } while ( line.empty() );
+    int status = parse_request_line( line, request );
+    if ( status != 200 ){
+      return status;
+    }
+    int count = 0;
+    while ( true ){
+      if ( !nb_getline( is, line, timeout, max_header_line ) ){
+	return line.size() > max_header_line ? 431 : 400;
+      }
+      if ( !line.empty() && line.back() == '\r' ){
+	line.pop_back();
+      }
+      if ( line.empty() ){
+	break;
+      }
+      status = parse_header( line, request, count );
+      if ( status != 200 ){
+	return status;
+      }
+    }
+    size_t len = 0;
+    status = body_length( request, len );
+    if ( status != 200 ){
+      return status;
+    }
+    if ( len > 0 && !nb_read( is, request.body, len, timeout ) ){
+      return 400;
+    }
+    return 200;
+  }
+
+  string HttpServerBase::response_head( const HttpResponse& response,
+				       size_t length, bool keep ) const {
+    /// make the status line and the headers of a response
+    /*!
+      \param response the response
+      \param length the size of the body
+      \param keep when true, tell the client we keep the connection open
+      \return the head, up to and including the empty line
+    */
+    ostringstream out;
+    out << "HTTP/1.1 " << response.status << " "
+	<< ( response.reason.empty() ? reason_phrase( response.status )
+	     : response.reason ) << "\r\n";
+    for ( const auto& it : response.headers ){
+      string name = lowercase( it.first );
+      if ( name != "content-length" && name != "connection" ){
+	out << it.first << ": " << it.second << "\r\n";
+      }
+    }
+    out << "Content-Length: " << length << "\r\n";
+    out << "Connection: " << ( keep ? "keep-alive" : "close" ) << "\r\n";
+    out << "\r\n";
+    return out.str();
+  }
+
+  bool HttpServerBase::send_response( childArgs *args,
+				      const HttpRequest& request,
+				      const HttpResponse& response,
+				      bool keep ){
+    /// send a response to the client
+    /*!
+      \param args the connection
+      \param request the request we answer
+      \param response the response to send
+      \param keep when true, tell the client we keep the connection open
+      \return true when the complete response is sent
+    */
+    int fd = -1;
+    size_t length = response.body.size();
+    if ( !response.file.empty() ){
+      fd = ::open( response.file.c_str(), O_RDONLY );
+      struct stat st;
+      if ( fd < 0 || fstat( fd, &st ) != 0 ){
+	LOG << "HTTP: unable to send file '" << response.file << "'" << endl;
+	if ( fd >= 0 ){
+	  ::close( fd );
+	}
+	HttpResponse error;
+	error.status = 500;
+	error.body = reason_phrase( 500 ) + "\n";
+	send_response( args, request, error, false );
+	return false;
+      }
+      length = st.st_size;
+    }
+    string head = response_head( response, length, keep );
+    struct iovec iov[2];
+    iov[0].iov_base = const_cast<char*>( head.data() );
+    iov[0].iov_len = head.size();
+    int iovcnt = 1;
+    if ( request.method != "HEAD" && fd < 0 ){
+      // header and body go out together, without copying the body
+      iov[1].iov_base = const_cast<char*>( response.body.data() );
+      iov[1].iov_len = response.body.size();
+      ++iovcnt;
+    }
+    chrono::milliseconds timeout = _http_timeout;
+    bool result = args->sendBuffers( iov, iovcnt, timeout );
+    if ( fd >= 0 ){
+      if ( result && request.method != "HEAD" ){
+	// straight from the file to the socket. The file gets a full
+	// http_timeout of its own
+	timeout = _http_timeout;
+	result = args->sendFile( fd, 0, length, timeout );
+      }
+      ::close( fd );
+    }
+    return result;
+  }
+
+  void HttpServerBase::callback( childArgs *args ){
+    /// handle the requests on a connection
+    /*!
+      \param args the connection
+
+      Requests are read and answered one by one, until the client closes
+      the connection or asks us to close, the connection is idle for
+      http_timeout seconds, http_max_requests are served or the server
+      stops.
+      Requests that arrive together (pipelining) are kept in the input
+      buffer and answered in order.
+    */
+    for ( int served = 1; ; ++served ){
+      chrono::milliseconds timeout = _http_timeout;
+      HttpRequest request;
+      int status = read_request( args, request, timeout );
+      if ( status == 0 ){
+	break;
+      }
+      auto start = chrono::steady_clock::now();
+      HttpResponse response;
+      bool keep = request.keep_alive()
+	&& served < _http_max_requests
+	&& running();
+      if ( status != 200 ){
+	response.status = status;
+	response.body = reason_phrase( status ) + "\n";
+	keep = false;
+      }
+      else {
+	if ( doDebug() ){
+	  DBG << "HTTP request " << served << " on socket " << args->id()
+	      << ": " << request.method << " " << request.target << endl;
+	}
+	http_request( args, request, response );
+	for ( const auto& it : response.headers ){
+	  if ( lowercase( it.first ) == "connection"
+	       && lowercase( it.second ) == "close" ){
+	    keep = false;
+	  }
+	}
+      }
+      bool sent = send_response( args, request, response, keep );
+      metrics().record( ServerMetrics::REQUEST,
+			chrono::steady_clock::now() - start );
+      if ( !sent || !keep ){
+	break;
+      }
+    }
+  }
+
+  void HttpServerBase::event_input( eventArgs *args ){
+    /// handle the requests on a connection in event mode
+    /*!
+      \param args the connection
+
+      Every complete request in the input is passed to http_request(),
+      with 0 for its childArgs, and the response is queued. The limits
+      and the keep-alive rules of callback() apply. http_timeout is not
+      used: idle_timeout and request_timeout guard the connections in
+      event mode.
+    */
+    string& in = args->input();
+    while ( !args->closing() ){
+      // tolerate empty lines in front of a request
+      size_t skip = std::min( in.find_first_not_of( "\r\n" ), in.size() );
+      if ( skip > 0 ){
+	in.erase( 0, skip );
+	args->_scanned = 0;
+      }
+      if ( in.empty() || in.size() < args->_wanted ){
+	break;
+      }
+      HttpRequest request;
+      size_t used = 0;
+      int status;
+      if ( args->_wanted == 0
+	   && in.find( '\n', std::min( args->_scanned, in.size() ) )
+	   == string::npos ){
+	// no new line, so parsing again makes no difference. Only the
+	// unfinished line has grown
+	size_t pos = in.rfind( '\n' );
+	if ( pos == string::npos ){
+	  status = in.size() > max_request_line ? 414 : 0;
+	}
+	else {
+	  status = in.size() - pos - 1 > max_header_line ? 431 : 0;
+	}
+      }
+      else {
+	status = parse_request( in, used, request );
+      }
+      if ( status == 0 ){
+	// wait for the rest
+	args->_scanned = in.size();
+	args->_wanted = used;
+	break;
+      }
+      args->_scanned = 0;
+      args->_wanted = 0;
+      HttpResponse response;
+      bool keep = request.keep_alive()
+	&& ++args->_requests < _http_max_requests
+	&& running();
+      if ( status != 200 ){
+	response.status = status;
+	response.body = reason_phrase( status ) + "\n";
+	keep = false;
+      }
+      else {
+	if ( doDebug() ){
+	  DBG << "HTTP request " << args->_requests << " on socket "
+	      << args->id() << ": " << request.method << " "
+	      << request.target << endl;
+	}
+	http_request( 0, request, response );
+	for ( const auto& it : response.headers ){
+	  if ( lowercase( it.first ) == "connection"
+	       && lowercase( it.second ) == "close" ){
+	    keep = false;
+	  }
+	}
+	if ( !response.file.empty() ){
+	  // no sendfile() here. The file goes through the output buffer
+	  ifstream file( response.file, ios::binary );
+	  if ( !file ){
+	    LOG << "HTTP: unable to send file '" << response.file << "'"
+		<< endl;
+	    response = HttpResponse();
+	    response.status = 500;
+	    response.body = reason_phrase( 500 ) + "\n";
+	    keep = false;
+	  }
+	  else {
+	    response.body.assign( istreambuf_iterator<char>( file ),
+				  istreambuf_iterator<char>() );
+	  }
+	}
+      }
+      args->write( response_head( response, response.body.size(), keep ) );
+      if ( request.method != "HEAD" ){
+	args->write( response.body );
+      }
+      if ( keep ){
+	in.erase( 0, used );
+      }
+      else {
+	in.clear();
+	args->close();
+      }
+    }
+  }
+
+  void HttpServerBase::http_request( childArgs *,
+				     const HttpRequest&,
+				     HttpResponse& response ){
+    /// handle one HTTP request
+    /*!
+      \param response the response to fill
+
+      HTTP servers that don't override callback() should override this
+      function.
+    */
+    LOG << "http_request() is not implemented for this server" << endl;
+    response.status = 501;
+    response.body = "Not Implemented\n";
+  }
+
+}
@@ -0,0 +1,604 @@
+/*
+  Copyright (c) 2006 - 2024
+  CLST  - Radboud University
+  ILK   - Tilburg University
+
+  This file is part of ticcutils
+
+  ticcutils is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  ticcutils is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+  For questions and suggestions, see:
+      https://github.com/LanguageMachines/ticcutils/issues
+  or send mail to:
+      lamasoftware (at ) science.ru.nl
+*/
+
+#include "ticcutils/IoRing.h"
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <cstdint>
+#include <unistd.h>
+#include <fcntl.h>
+#include "config.h"
+#ifdef HAVE_LINUX_IO_URING_H
+#include <linux/io_uring.h>
+#include <linux/fs.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#ifndef IORING_ACCEPT_DONTWAIT
+#define IORING_ACCEPT_DONTWAIT (1U << 1) // Linux 6.10
+#endif
+#endif
+
+using namespace std;
+
+namespace TiCC {
+
+  static atomic<int> current_backend( IoRing::DEFAULT );
+
+#ifdef HAVE_LINUX_IO_URING_H
+
+  /// \brief a minimal io_uring, used by one thread only
+  ///
+  /// Operations are queued with next_sqe(), and run() submits them and
+  /// waits until all of them are complete.
+  class Ring {
+  public:
+    static const unsigned max_ops = 16;
+    Ring();
+    ~Ring();
+    bool valid() const { return _fd >= 0; };
+    struct io_uring_sqe *next_sqe();
+    void run( int * );
+  private:
+    int _fd;
+    unsigned _pending;
+    uint32_t _generation;
+    void *_sq_ptr;
+    size_t _sq_size;
+    void *_cq_ptr;
+    size_t _cq_size;
+    struct io_uring_sqe *_sqes;
+    size_t _sqes_size;
+    unsigned *_sq_head;
+    unsigned *_sq_tail;
+    unsigned *_sq_mask;
+    unsigned *_sq_array;
+    unsigned *_cq_head;
+    unsigned *_cq_tail;
+    unsigned *_cq_mask;
+    struct io_uring_cqe *_cqes;
+    unsigned _tail;
+    void reap( int *, unsigned&, unsigned );
+    Ring( const Ring& ) = delete;
+    Ring& operator=( const Ring& ) = delete;
+  };
+
+  static const uint64_t cancel_tag = ~uint64_t(0);
+
+  Ring::Ring():
+    _fd( -1 ),
+    _pending( 0 ),
+    _generation( 0 ),
+    _sq_ptr( MAP_FAILED ),
+    _sq_size( 0 ),
+    _cq_ptr( MAP_FAILED ),
+    _cq_size( 0 ),
+    _sqes( 0 ),
+    _sqes_size( 0 ),
+    _tail( 0 )
+  {
+    /// set up the ring. On failure (old kernel, not permitted) valid()
+    /// is false
+    struct io_uring_params p;
+    memset( &p, 0, sizeof(p) );
+    // room for the operations, and for cancelling them
+    int fd = syscall( __NR_io_uring_setup, 2*max_ops, &p );
+    if ( fd < 0 ){
+      return;
+    }
+    if ( !( p.features & IORING_FEAT_RW_CUR_POS ) ){
+      // older than Linux 5.6: no IORING_OP_READ and friends
+      ::close( fd );
+      return;
+    }
+    _sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    _cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    bool single = ( p.features & IORING_FEAT_SINGLE_MMAP );
+    if ( single ){
+      _sq_size = _cq_size = std::max( _sq_size, _cq_size );
+    }
+    _sq_ptr = mmap( 0, _sq_size, PROT_READ|PROT_WRITE,
+		    MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_SQ_RING );
+    if ( _sq_ptr == MAP_FAILED ){
+      ::close( fd );
+      return;
+    }
+    if ( single ){
+      _cq_ptr = _sq_ptr;
+    }
+    else {
+      _cq_ptr = mmap( 0, _cq_size, PROT_READ|PROT_WRITE,
+		      MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_CQ_RING );
+      if ( _cq_ptr == MAP_FAILED ){
+	munmap( _sq_ptr, _sq_size );
+	::close( fd );
+	return;
+      }
+    }
+    _sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    void *sqes = mmap( 0, _sqes_size, PROT_READ|PROT_WRITE,
+		       MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_SQES );
+    if ( sqes == MAP_FAILED ){
+      if ( !single ){
+	munmap( _cq_ptr, _cq_size );
+      }
+      munmap( _sq_ptr, _sq_size );
+      ::close( fd );
+      return;
+    }
+    _sqes = static_cast<struct io_uring_sqe*>( sqes );
+    char *sq = static_cast<char*>( _sq_ptr );
+    _sq_head = reinterpret_cast<unsigned*>( sq + p.sq_off.head );
+    _sq_tail = reinterpret_cast<unsigned*>( sq + p.sq_off.tail );
+    _sq_mask = reinterpret_cast<unsigned*>( sq + p.sq_off.ring_mask );
+    _sq_array = reinterpret_cast<unsigned*>( sq + p.sq_off.array );
+    char *cq = static_cast<char*>( _cq_ptr );
+    _cq_head = reinterpret_cast<unsigned*>( cq + p.cq_off.head );
+    _cq_tail = reinterpret_cast<unsigned*>( cq + p.cq_off.tail );
+    _cq_mask = reinterpret_cast<unsigned*>( cq + p.cq_off.ring_mask );
+    _cqes = reinterpret_cast<struct io_uring_cqe*>( cq + p.cq_off.cqes );
+    _tail = *_sq_tail;
+    _fd = fd;
+  }
+
+  Ring::~Ring(){
+    /// release the ring
+    if ( _fd < 0 ){
+      return;
+    }
+    munmap( _sqes, _sqes_size );
+    if ( _cq_ptr != _sq_ptr ){
+      munmap( _cq_ptr, _cq_size );
+    }
+    munmap( _sq_ptr, _sq_size );
+    ::close( _fd );
+  }
+
+  struct io_uring_sqe *Ring::next_sqe(){
+    /// get a cleared submission entry for the next operation
+    unsigned index = _tail & *_sq_mask;
+    struct io_uring_sqe *sqe = &_sqes[index];
+    memset( sqe, 0, sizeof(*sqe) );
+    _sq_array[index] = index;
+    sqe->user_data = ( uint64_t(_generation) << 32 ) | _pending;
+    ++_tail;
+    ++_pending;
+    return sqe;
+  }
+
+  void Ring::reap( int *results, unsigned& done, unsigned n ){
+    /// collect the completions that are available
+    unsigned head = *_cq_head;
+    unsigned tail = __atomic_load_n( _cq_tail, __ATOMIC_ACQUIRE );
+    while ( head != tail ){
+      const struct io_uring_cqe& cqe = _cqes[head & *_cq_mask];
+      // skip the results of cancellations, and of earlier runs
+      if ( cqe.user_data != cancel_tag
+	   && ( cqe.user_data >> 32 ) == _generation ){
+	unsigned i = cqe.user_data & 0xffffffff;
+	if ( i < n ){
+	  results[i] = cqe.res;
+	  ++done;
+	}
+      }
+      ++head;
+    }
+    __atomic_store_n( _cq_head, head, __ATOMIC_RELEASE );
+  }
+
+  void Ring::run( int *results ){
+    /// submit the queued operations, and wait until all are complete
+    /*!
+      \param results gets the result of every operation, in order. Like
+      the system calls, but -errno instead of -1
+
+      When a signal interrupts the wait, the operations still running
+      are cancelled and their result is -EINTR. So a blocking read
+      through the ring can be interrupted like a plain read().
+    */
+    unsigned n = _pending;
+    __atomic_store_n( _sq_tail, _tail, __ATOMIC_RELEASE );
+    unsigned to_submit = n;
+    unsigned done = 0;
+    bool cancelled = false;
+    while ( done < n ){
+      int res = syscall( __NR_io_uring_enter, _fd, to_submit, 1,
+			 IORING_ENTER_GETEVENTS, NULL, 0 );
+      bool interrupted = false;
+      if ( res >= 0 ){
+	to_submit -= std::min( to_submit, unsigned(res) );
+	// when a signal interrupts the wait after submitting, the kernel
+	// returns the number submitted. We notice by the missing results
+	unsigned before = done;
+	reap( results, done, n );
+	interrupted = ( done == before );
+      }
+      else if ( errno == EINTR ){
+	interrupted = true;
+	reap( results, done, n );
+      }
+      else {
+	// should not happen. Give up on what is left
+	int err = errno;
+	for ( unsigned i=0; i < n; ++i ){
+	  results[i] = -err;
+	}
+	break;
+      }
+      if ( interrupted && done < n ){
+	if ( !cancelled ){
+	  // cancel what is still running. (the cancels come after the
+	  // operations in the queue, so also works for unsubmitted ones)
+	  cancelled = true;
+	  for ( unsigned i=0; i < n; ++i ){
+	    unsigned index = _tail & *_sq_mask;
+	    struct io_uring_sqe *sqe = &_sqes[index];
+	    memset( sqe, 0, sizeof(*sqe) );
+	    _sq_array[index] = index;
+	    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	    sqe->fd = -1;
+	    sqe->addr = ( uint64_t(_generation) << 32 ) | i;
+	    sqe->user_data = cancel_tag;
+	    ++_tail;
+	  }
+	  to_submit += n;
+	  __atomic_store_n( _sq_tail, _tail, __ATOMIC_RELEASE );
+	}
+      }
+    }
+    if ( cancelled ){
+      for ( unsigned i=0; i < n; ++i ){
+	if ( results[i] == -ECANCELED ){
+	  results[i] = -EINTR;
+	}
+      }
+    }
+    _pending = 0;
+    ++_generation;
+  }
+
+  static Ring *local_ring(){
+    /// the ring of the calling thread, or 0 when there is none
+    static thread_local Ring ring;
+    return ring.valid() ? &ring : 0;
+  }
+
+  static bool nonblocking( int fd ){
+    /// check for O_NONBLOCK. The ring waits for sockets and pipes anyway,
+    /// so we have to ask for a single try explicitly
+    int flags = fcntl( fd, F_GETFL );
+    return flags >= 0 && ( flags & O_NONBLOCK );
+  }
+
+  // cleared when the kernel doesn't know IORING_ACCEPT_DONTWAIT. Then
+  // non-blocking sockets are accepted without the ring
+  static atomic<bool> accept_dontwait( true );
+
+  static ssize_t result( int res ){
+    /// translate a ring result to the system call convention
+    if ( res < 0 ){
+      errno = -res;
+      return -1;
+    }
+    return res;
+  }
+
+#endif // HAVE_LINUX_IO_URING_H
+
+  bool IoRing::available(){
+    /// check that the io_uring backend can be used
+    /*!
+      \return true when compiled with io_uring support, and the kernel
+      (5.6 or newer) allows us to set up a ring
+    */
+#ifdef HAVE_LINUX_IO_URING_H
+    return local_ring() != 0;
+#else
+    return false;
+#endif
+  }
+
+  bool IoRing::setBackend( Backend backend ){
+    /// select the backend for all threads
+    /*!
+      \param backend DEFAULT or IO_URING
+      \return false when io_uring is asked for, but not available. The
+      backend is not changed then
+    */
+    if ( backend == IO_URING && !available() ){
+      return false;
+    }
+    current_backend = backend;
+    return true;
+  }
+
+  bool IoRing::setBackend( const string& name ){
+    /// select the backend by name
+    /*!
+      \param name 'default' or 'io_uring'
+      \return false for an unknown or unavailable backend
+    */
+    if ( name == "default" ){
+      return setBackend( DEFAULT );
+    }
+    else if ( name == "io_uring" ){
+      return setBackend( IO_URING );
+    }
+    return false;
+  }
+
+  IoRing::Backend IoRing::backend(){
+    /*!
+      \return the backend in use
+    */
+    return Backend( current_backend.load( memory_order_relaxed ) );
+  }
+
+  ssize_t IoRing::read( int fd, void *buf, size_t count ){
+    /// read(2), through the selected backend
+#ifdef HAVE_LINUX_IO_URING_H
+    if ( active() ){
+      return read( fd, buf, count, nonblocking( fd ) );
+    }
+#endif
+    return ::read( fd, buf, count );
+  }
+
+  ssize_t IoRing::read( int fd, void *buf, size_t count, bool dontwait ){
+    /// read(2) from a file descriptor with a known O_NONBLOCK status
+    /*!
+      \param dontwait the O_NONBLOCK status of fd. This saves the io_uring
+      backend a fcntl() call
+    */
+#ifdef HAVE_LINUX_IO_URING_H
+    Ring *ring = active() ? local_ring() : 0;
+    if ( ring ){
+      struct io_uring_sqe *sqe = ring->next_sqe();
+      sqe->opcode = IORING_OP_READ;
+      sqe->fd = fd;
+      if ( dontwait ){
+	sqe->rw_flags = RWF_NOWAIT;
+      }
+      sqe->addr = reinterpret_cast<uint64_t>( buf );
+      sqe->len = count;
+      sqe->off = uint64_t(-1); // the current position, like read()
+      int res;
+      ring->run( &res );
+      return result( res );
+    }
+#endif
+    return ::read( fd, buf, count );
+  }
+
+  ssize_t IoRing::write( int fd, const void *buf, size_t count ){
+    /// write(2), through the selected backend
+#ifdef HAVE_LINUX_IO_URING_H
+    if ( active() ){
+      return write( fd, buf, count, nonblocking( fd ) );
+    }
+#endif
+    return ::write( fd, buf, count );
+  }
+
+  ssize_t IoRing::write( int fd, const void *buf, size_t count,
+			 bool dontwait ){
+    /// write(2) to a file descriptor with a known O_NONBLOCK status
+    /*!
+      \param dontwait the O_NONBLOCK status of fd. This saves the io_uring
+      backend a fcntl() call
+    */
+#ifdef HAVE_LINUX_IO_URING_H
+    Ring *ring = active() ? local_ring() : 0;
+    if ( ring ){
+      struct io_uring_sqe *sqe = ring->next_sqe();
+      sqe->opcode = IORING_OP_WRITE;
+      sqe->fd = fd;
+      if ( dontwait ){
+	sqe->rw_flags = RWF_NOWAIT;
+      }
+      sqe->addr = reinterpret_cast<uint64_t>( buf );
+      sqe->len = count;
+      sqe->off = uint64_t(-1);
+      int res;
+      ring->run( &res );
+      return result( res );
+    }
+#endif
+    return ::write( fd, buf, count );
+  }
+
+  ssize_t IoRing::writev( int fd, const struct iovec *iov, int iovcnt ){
+    /// writev(2), through the selected backend
+#ifdef HAVE_LINUX_IO_URING_H
+    if ( active() ){
+      return writev( fd, iov, iovcnt, nonblocking( fd ) );
+    }
+#endif
+    return ::writev( fd, iov, iovcnt );
+  }
+
+  ssize_t IoRing::writev( int fd, const struct iovec *iov, int iovcnt,
+			  bool dontwait ){
+    /// writev(2) to a file descriptor with a known O_NONBLOCK status
+    /*!
+      \param dontwait the O_NONBLOCK status of fd. This saves the io_uring
+      backend a fcntl() call
+    */
+#ifdef HAVE_LINUX_IO_URING_H
+    Ring *ring = active() ? local_ring() : 0;
+    if ( ring ){
+      struct io_uring_sqe *sqe = ring->next_sqe();
+      sqe->opcode = IORING_OP_WRITEV;
+      sqe->fd = fd;
+      if ( dontwait ){
+	sqe->rw_flags = RWF_NOWAIT;
+      }
+      sqe->addr = reinterpret_cast<uint64_t>( iov );
+      sqe->len = iovcnt;
+      sqe->off = uint64_t(-1);
+      int res;
+      ring->run( &res );
+      return result( res );
+    }
+#endif
+    return ::writev( fd, iov, iovcnt );
+  }
+
+  ssize_t IoRing::send( int fd, const void *buf, size_t count, int flags ){
+    /// send(2), through the selected backend
+    /*!
+      with MSG_DONTWAIT in flags, the O_NONBLOCK status of fd is not
+      looked up
+    */
+#ifdef HAVE_LINUX_IO_URING_H
+    Ring *ring = active() ? local_ring() : 0;
+    if ( ring ){
+      struct io_uring_sqe *sqe = ring->next_sqe();
+      sqe->opcode = IORING_OP_SEND;
+      sqe->fd = fd;
+      sqe->addr = reinterpret_cast<uint64_t>( buf );
+      sqe->len = count;
+      sqe->msg_flags = flags;
+      if ( !( flags & MSG_DONTWAIT ) && nonblocking( fd ) ){
+	sqe->msg_flags |= MSG_DONTWAIT;
+      }
+      int res;
+      ring->run( &res );
+      return result( res );
+    }
+#endif
+    return ::send( fd, buf, count, flags );
+  }
+
+  int IoRing::accept( int fd, struct sockaddr *addr, socklen_t *len,
+		      int flags ){
+    /// accept4(2), through the selected backend
+#ifdef HAVE_LINUX_IO_URING_H
+    Ring *ring = active() ? local_ring() : 0;
+    bool dontwait = ring && nonblocking( fd );
+    if ( ring && ( !dontwait || accept_dontwait ) ){
+      struct io_uring_sqe *sqe = ring->next_sqe();
+      sqe->opcode = IORING_OP_ACCEPT;
+      sqe->fd = fd;
+      sqe->addr = reinterpret_cast<uint64_t>( addr );
+      sqe->addr2 = reinterpret_cast<uint64_t>( len );
+      sqe->accept_flags = flags;
+      if ( dontwait ){
+	sqe->ioprio = IORING_ACCEPT_DONTWAIT;
+      }
+      int res;
+      ring->run( &res );
+      if ( res != -EINVAL || !dontwait ){
+	return result( res );
+      }
+      accept_dontwait = false;
+    }
+#endif
+#ifdef HAVE_ACCEPT4
+    return ::accept4( fd, addr, len, flags );
+#else
+    (void)flags;
+    return ::accept( fd, addr, len );
+#endif
+  }
+
+  int IoRing::accept_batch( int fd, int *fds,
+			    struct sockaddr_storage *addrs, socklen_t *lens,
+			    int max, int flags ){
+    /// accept several connections with one system call
+    /*!
+      \param fd a NON-BLOCKING listening socket
+      \param fds gets the new sockets
+      \param addrs gets the addresses of the clients
+      \param lens the sizes of addrs. Should be set on entry
+      \param max the size of fds, addrs and lens
+      \param flags like for accept4
+      \return the number of accepted connections. -1 when there are none,
+      errno tells why (EAGAIN when nobody is waiting)
+
+      With the default backend, this calls accept4() until nobody is
+      waiting or max connections are accepted.
+    */
+    int num = 0;
+#ifdef HAVE_LINUX_IO_URING_H
+    Ring *ring = ( active() && accept_dontwait ) ? local_ring() : 0;
+    if ( ring ){
+      if ( max > int(Ring::max_ops) ){
+	max = Ring::max_ops;
+      }
+      for ( int i=0; i < max; ++i ){
+	struct io_uring_sqe *sqe = ring->next_sqe();
+	sqe->opcode = IORING_OP_ACCEPT;
+	sqe->fd = fd;
+	sqe->addr = reinterpret_cast<uint64_t>( &addrs[i] );
+	sqe->addr2 = reinterpret_cast<uint64_t>( &lens[i] );
+	sqe->accept_flags = flags;
+	sqe->ioprio = IORING_ACCEPT_DONTWAIT;
+      }
+      int res[Ring::max_ops];
+      ring->run( res );
+      if ( res[0] == -EINVAL ){
+	accept_dontwait = false;
+	return accept_batch( fd, fds, addrs, lens, max, flags );
+      }
+      int error = 0;
+      for ( int i=0; i < max; ++i ){
+	if ( res[i] >= 0 ){
+	  // keep the accepted ones together, in front
+	  fds[num] = res[i];
+	  if ( num != i ){
+	    addrs[num] = addrs[i];
+	    lens[num] = lens[i];
+	  }
+	  ++num;
+	}
+	else if ( error == 0 || error == EAGAIN ){
+	  error = -res[i];
+	}
+      }
+      if ( num == 0 ){
+	errno = error;
+	return -1;
+      }
+      return num;
+    }
+#endif
+    while ( num < max ){
+      int res = accept( fd, reinterpret_cast<struct sockaddr*>(&addrs[num]),
+			&lens[num], flags );
+      if ( res < 0 ){
+	if ( errno == EINTR ){
+	  continue;
+	}
+	break;
+      }
+      fds[num++] = res;
+    }
+    return num > 0 ? num : -1;
+  }
+
+}
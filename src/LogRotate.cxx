@@ -0,0 +1,155 @@
+/*
+  Copyright (c) 2006 - 2024
+  CLST  - Radboud University
+  ILK   - Tilburg University
+
+  This file is part of ticcutils
+
+  ticcutils is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  ticcutils is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+  For questions and suggestions, see:
+      https://github.com/LanguageMachines/ticcutils/issues
+  or send mail to:
+      lamasoftware (at ) science.ru.nl
+
+*/
+
+#include "ticcutils/LogRotate.h"
+
+#include <cstdio>
+#include <string>
+#include <filesystem>
+#include "ticcutils/zipper.h"
+
+using namespace std;
+
+namespace TiCC {
+
+  rotating_filebuf::rotating_filebuf( const string& name,
+				      const LogRotation& rot,
+				      ios_base::openmode mode ):
+    _name( name ),
+    _settings( rot ),
+    _mode( mode | ios::out ),
+    _next_rotation( 0 ),
+    _stopping( false )
+  {
+    /// create a filebuf which rotates the file 'name'
+    /*!
+      \param name the name of the file
+      \param rot the rotation settings
+      \param mode the openmode to use
+    */
+    if ( _settings.interval > 0 ){
+      _next_rotation = time(0) + _settings.interval;
+    }
+    open( _name, _mode );
+  }
+
+  rotating_filebuf::~rotating_filebuf(){
+    /// close the file and wait until all pending compressions are done
+    close();
+    {
+      lock_guard<mutex> lock( _zip_mutex );
+      _stopping = true;
+    }
+    _zip_cond.notify_all();
+    if ( _zipper.joinable() ){
+      _zipper.join();
+    }
+  }
+
+  int rotating_filebuf::sync(){
+    /// flush the buffer, then check if it is time to rotate
+    int result = filebuf::sync();
+    if ( result == 0 && is_open() ){
+      bool due = ( _next_rotation > 0 && time(0) >= _next_rotation );
+      if ( !due && _settings.max_size > 0 ){
+	streamoff pos = seekoff( 0, ios::cur, ios::out );
+	due = ( pos >= _settings.max_size );
+      }
+      if ( due ){
+	rotate();
+      }
+    }
+    return result;
+  }
+
+  string rotating_filebuf::rotated_name() const {
+    /// construct a new, unused, name for a rotated file
+    char stamp[32];
+    time_t now = time(0);
+    struct tm tmp;
+    strftime( stamp, sizeof(stamp), "%Y%m%d-%H%M%S", localtime_r( &now, &tmp ) );
+    string base = _name + "." + stamp;
+    string result = base;
+    int seq = 0;
+    while ( filesystem::exists( result )
+	    || filesystem::exists( result + ".gz" ) ){
+      result = base + "-" + to_string( ++seq );
+    }
+    return result;
+  }
+
+  bool rotating_filebuf::rotate(){
+    /// rotate the file now
+    /*!
+      \return true when the current file is moved away and a new file is
+      opened.
+
+      When compression is requested, the moved file is handed to the
+      background thread.
+    */
+    if ( !is_open() ){
+      return false;
+    }
+    if ( _settings.interval > 0 ){
+      _next_rotation = time(0) + _settings.interval;
+    }
+    close();
+    string target = rotated_name();
+    bool moved = ( std::rename( _name.c_str(), target.c_str() ) == 0 );
+    // never truncate what we failed to move away
+    open( _name, moved ? _mode : ( ( _mode & ~ios::trunc ) | ios::app ) );
+    if ( moved && _settings.compress ){
+      lock_guard<mutex> lock( _zip_mutex );
+      _to_zip.push_back( target );
+      if ( !_zipper.joinable() ){
+	_zipper = thread( &rotating_filebuf::zip_loop, this );
+      }
+      _zip_cond.notify_one();
+    }
+    return moved && is_open();
+  }
+
+  void rotating_filebuf::zip_loop(){
+    /// the background thread which compresses the rotated files
+    unique_lock<mutex> lock( _zip_mutex );
+    while ( true ){
+      _zip_cond.wait( lock, [this]{ return _stopping || !_to_zip.empty(); } );
+      if ( _to_zip.empty() ){
+	// stopping, and nothing left to do
+	return;
+      }
+      string file = _to_zip.front();
+      _to_zip.pop_front();
+      lock.unlock();
+      if ( gzCompress( file, file + ".gz" ) ){
+	std::remove( file.c_str() );
+      }
+      lock.lock();
+    }
+  }
+
+}
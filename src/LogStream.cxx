@@ -32,6 +32,9 @@
 #include <string>
 #include <fstream>
 #include <typeinfo>
+#include <atomic>
+#include <thread>
+#include <random>
 #include <pthread.h>
 
 #if defined __GNUC__
@@ -83,7 +86,8 @@ namespace TiCC {
     buf( ls->buf.AssocStream(),
 	 ls->buf.Message(),
 	 ls->buf.StampFlag() ),
-    single_threaded_mode( ls->single_threaded_mode ){
+    single_threaded_mode( ls->single_threaded_mode ),
+    tracer( ls->tracer ){
     /// create a LogStream connected to a LogStream
     /*!
       \param ls a LogStream to connect to
@@ -91,12 +95,47 @@ namespace TiCC {
     */
     buf.Level( ls->buf.Level() );
     buf.Threshold( ls->buf.Threshold() );
+    buf.BlockSize( ls->buf.BlockSize() );
+  }
+
+  LogStream::~LogStream(){
+    /// destroy a LogStream. The last one using a LogTracer flushes it
+    if ( tracer && tracer.use_count() == 1 ){
+      flush_trace();
+    }
+  }
+
+  LogStream *LogStream::create( const string& filename,
+				std::ios_base::openmode mode ){
+    /// create a new LogStream connected to a file
+    /*!
+      \param filename the file to log to
+      \param mode the openmode to use
+      \return a new LogStream, which owns the file stream
+    */
+    ofstream *os = new ofstream( filename, mode );
+    LogStream *result = new LogStream( *os );
+    result->owned_stream.reset( os );
+    return result;
   }
 
   LogStream *LogStream::create( const string& filename,
+				const LogRotation& rot,
 				std::ios_base::openmode mode ){
-    ofstream os( filename, mode );
-    return new LogStream( os );
+    /// create a new LogStream connected to a rotating file
+    /*!
+      \param filename the file to log to
+      \param rot the rotation settings
+      \param mode the openmode to use
+      \return a new LogStream, which owns the file stream
+    */
+    if ( !rot.active() ){
+      return create( filename, mode );
+    }
+    rotating_ofstream *os = new rotating_ofstream( filename, rot, mode );
+    LogStream *result = new LogStream( *os );
+    result->owned_stream.reset( os );
+    return result;
   }
 
   void LogStream::add_message( const string& s ){
@@ -114,7 +153,7 @@ namespace TiCC {
     add_message( m );
   }
 
-  static bool static_init = false;
+  static std::atomic<bool> static_init( false );
 
   bool LogStream::set_single_threaded_mode( ){
     /// set the LogStream to single threaded mode
@@ -131,79 +170,48 @@ namespace TiCC {
   }
 
   pthread_mutex_t global_logging_mutex = PTHREAD_MUTEX_INITIALIZER;
-  pthread_mutex_t global_lock_mutex = PTHREAD_MUTEX_INITIALIZER;
 
   /// @cond HIDDEN
-  /// a structure to store locking information per thread
-  struct lock_s { pthread_t id; int cnt; time_t tim; };
-
-#define MAX_LOCKS 500
-
-  lock_s locks[MAX_LOCKS];
+  /// how many times the current thread holds the logging mutex. (it may be
+  /// acquired recursively, e.g. when a Log is nested in another one)
+  static thread_local int lock_count = 0;
+
+  /// the thread owning the logging mutex, and since when. Only used for
+  /// diagnostics. A lock_time of 0 means the mutex is free.
+  static std::atomic<std::thread::id> lock_owner;
+  static std::atomic<time_t> lock_time( 0 );
   /// @endcond
 
   bool LogStream::Problems(){
-    /// perform a sanity check on the mutex locks
+    /// perform a sanity check on the mutex lock
+    /*!
+      \return true when a thread holds the logging mutex for more than 30
+      seconds
+    */
 #ifdef LSDEBUG
     cerr << "test for problems" << endl;
 #endif
     bool result = false;
+    time_t since = lock_time.load();
     time_t lTime;
     time(&lTime);
-    pthread_mutex_lock( &global_lock_mutex );
-    for ( int i=0; i < MAX_LOCKS; i++ ){
-      if ( locks[i].id != 0 &&
-	   lTime - locks[i].tim > 30 ){
-	result = true;
-	cerr << "ALERT" << endl;
-	cerr << "ALERT" << endl;
-	cerr << "Thread " << locks[i].id
-	     << "is blocking our LogStreams since " << lTime - locks[i].tim
-	     << " seconds!" << endl;
-	cerr << "ALERT" << endl;
-	cerr << "ALERT" << endl;
-      }
+    if ( since != 0 &&
+	 lTime - since > 30 ){
+      result = true;
+      cerr << "ALERT" << endl;
+      cerr << "ALERT" << endl;
+      cerr << "Thread " << lock_owner.load()
+	   << " is blocking our LogStreams since " << lTime - since
+	   << " seconds!" << endl;
+      cerr << "ALERT" << endl;
+      cerr << "ALERT" << endl;
     }
-    pthread_mutex_unlock( &global_lock_mutex );
     return result;
   }
 
-  inline int get_lock( pthread_t ID ){
-    /// get a thread specific lock
-    /*!
-      \param ID the thread Id
-      \return the number of the lock. Will throw when no lock is available
-    */
-    time_t lTime;
-    time(&lTime);
-    pthread_mutex_lock( &global_lock_mutex );
-    int free_lock = -1;
-    for ( int i=0; i < MAX_LOCKS; i++ ){
-      if ( pthread_equal( locks[i].id, ID ) ){
-	pthread_mutex_unlock( &global_lock_mutex );
-	return i;
-      }
-      else if ( free_lock < 0 && locks[i].id == 0 ){
-        free_lock = i;
-      }
-    }
-    if ( free_lock < 0 ){
-      throw( "LogStreams FATAL error: get_lock() failed " );
-    }
-    locks[free_lock].id = ID;
-    locks[free_lock].cnt = 0;
-    locks[free_lock].tim = lTime;
-    pthread_mutex_unlock( &global_lock_mutex );
-    return free_lock;
-  }
-
   inline bool init_mutex(){
     /// acquire the logging mutex
     if ( !static_init ){
-      for (int i=0; i < MAX_LOCKS; i++ ) {
-	locks[i].id = 0;
-	locks[i].cnt = 0;
-      }
       static_init = true;
 #ifdef LSDEBUG
       cerr << "MUTEX system initialized!" << endl;
@@ -212,19 +220,19 @@ namespace TiCC {
 #ifdef LSDEBUG
     cerr << "voor Lock door thread " << pthread_self() << endl;
 #endif
-    int pos = get_lock( pthread_self() );
-    if ( locks[pos].cnt == 0 ){
+    if ( lock_count == 0 ){
       pthread_mutex_lock( &global_logging_mutex );
+      lock_owner.store( std::this_thread::get_id(), std::memory_order_relaxed );
+      lock_time.store( time(0), std::memory_order_relaxed );
 #ifdef LSDEBUG
-      cerr << "Thread " << pthread_self()  << " locked [" << pos
-	   << "]" << endl;
+      cerr << "Thread " << pthread_self()  << " locked" << endl;
 #endif
     }
-    ++locks[pos].cnt;
+    ++lock_count;
 #ifdef LSDEBUG
-    if ( locks[pos].cnt > 1 ){
-      cerr << "Thread " << pthread_self()  << " regained [" << pos
-	   << "] cnt = " << locks[pos].cnt << endl;
+    if ( lock_count > 1 ){
+      cerr << "Thread " << pthread_self()  << " regained, cnt = "
+	   << lock_count << endl;
     }
 #endif
     return static_init;
@@ -235,28 +243,57 @@ namespace TiCC {
 #ifdef LSDEBUG
     cerr << "voor UnLock door thread " << pthread_self() << endl;
 #endif
-    int pos = get_lock( pthread_self() );
-    locks[pos].cnt--;
-    if ( locks[pos].cnt < 0 ){
+    if ( --lock_count < 0 ){
+      lock_count = 0;
       throw( "LogStreams FATAL error: mutex_release() failed" );
     }
 #ifdef LSDEBUG
-    if ( locks[pos].cnt > 0 ){
-      cerr << "Thread " << pthread_self()  << " still owns [" << pos
-	   << "] cnt = "<< locks[pos].cnt << endl;
+    if ( lock_count > 0 ){
+      cerr << "Thread " << pthread_self()  << " still owns, cnt = "
+	   << lock_count << endl;
     }
 #endif
-    if ( locks[pos].cnt == 0 ){
-      pthread_mutex_lock( &global_lock_mutex );
-      locks[pos].id = 0;
-      pthread_mutex_unlock( &global_lock_mutex );
+    if ( lock_count == 0 ){
+      lock_time.store( 0, std::memory_order_relaxed );
 #ifdef LSDEBUG
-      cerr << "Thread " << pthread_self()  << " unlocked [" << pos << "]" << endl;
+      cerr << "Thread " << pthread_self()  << " unlocked" << endl;
 #endif
       pthread_mutex_unlock( &global_logging_mutex );
     }
   }
 
+  bool LogStream::set_trace_mode( size_t records ){
+    /// let every thread log into a ring buffer of its own
+    /*!
+      \param records the number of records in each ring. When a ring is
+      full, the oldest records are overwritten
+      \return true on succes, false when already tracing
+
+      Use this before any threads start logging. The output only reaches the
+      associated stream on flush_trace(), or when the LogStream is
+      destroyed. LogStreams derived from this one share the rings.
+    */
+    if ( tracer ){
+      return false;
+    }
+    tracer = std::make_shared<LogTracer>( records );
+    return true;
+  }
+
+  void LogStream::flush_trace(){
+    /// write the output of all threads in time order
+    if ( !tracer ){
+      return;
+    }
+    if ( !single_threaded() ){
+      init_mutex();
+    }
+    tracer->write( buf.AssocStream() );
+    if ( !single_threaded() ){
+      mutex_release();
+    }
+  }
+
   bool LogStream::IsBlocking(){
     /// is the current level below the threshold?
     if ( !bad() ){
@@ -282,161 +319,99 @@ namespace TiCC {
   }
 
 
-  Log::Log( LogStream *os ): my_stream(0), my_level(LogSilent){
-    /// create a Log object on the LogStream with Normal threshold
-    if ( !os ){
-      throw( "LogStreams FATAL error: No Stream supplied! " );
-    }
-    if ( os->single_threaded() || init_mutex() ){
-      my_level = os->get_threshold();
-      my_stream = os;
-      os->set_threshold( LogNormal );
-    }
-  }
-
-  Log::Log( LogStream& os ):  my_stream(0), my_level(LogSilent){
-    /// create a Log object on the LogStream with Normal threshold
-    if ( os.single_threaded() || init_mutex() ){
-      my_stream = &os;
-      my_level = os.get_threshold();
-      os.set_threshold( LogNormal );
-    }
-  }
-
-  Log::~Log(){
-    /// destroy the Log object
-    my_stream->flush();
-    my_stream->set_threshold( my_level );
-    if ( !my_stream->single_threaded() ){
-      mutex_release();
-    }
+  LogLimit::LogLimit( unsigned int per_second, double sample ):
+    _per_second( per_second ),
+    _sample( sample ),
+    _window( 0 ),
+    _count( 0 ),
+    _suppressed( 0 )
+  {
+    /// create a limit for a call site
+    /*!
+      \param per_second the maximum number of messages per second. 0 means
+      unlimited
+      \param sample the fraction (0.0 - 1.0) of the messages to pass
+    */
   }
 
-  LogStream& Log::operator *(){
-    /// return the LogStream from the Log object
-#ifdef DARE_TO_OPTIMIZE
-    if ( my_stream->get_level() >= my_stream->get_threshold() ){
-      return *my_stream;
+  bool LogLimit::allow( size_t& skipped ){
+    /// decide if the next message may pass
+    /*!
+      \param skipped returns the number of messages suppressed since the
+      last message that passed
+      \return true if the message may pass
+      this function doesn't lock anything. The counting is approximate when
+      many threads hit the same call site at the start of a new second.
+    */
+    skipped = 0;
+    if ( _sample < 1.0 ){
+      static thread_local std::minstd_rand generator( std::random_device{}() );
+      if ( generator() - generator.min()
+	   >= _sample * ( generator.max() - generator.min() ) ){
+	++_suppressed;
+	return false;
+      }
     }
-    else {
-      return null_stream;
+    if ( _per_second > 0 ){
+      time_t now = time(0);
+      time_t window = _window.load( std::memory_order_relaxed );
+      if ( now != window
+	   && _window.compare_exchange_strong( window, now ) ){
+	_count = 0;
+      }
+      if ( ++_count > _per_second ){
+	++_suppressed;
+	return false;
+      }
     }
-#else
-    return *my_stream;
-#endif
+    skipped = _suppressed.exchange( 0 );
+    return true;
   }
 
-  Dbg::Dbg( LogStream *os ): my_stream(0), my_level(LogSilent){
-    /// create a Dbg object on the LogStream with Debug threshold
+  LogGuard::LogGuard( LogStream *os, LogLevel level, LogLimit *limit ):
+    my_stream(0), trace_stream(0), my_level(LogSilent), suppressed(false){
+    /// lock the LogStream and set its threshold to level
+    /*!
+      \param os the LogStream to use
+      \param level the threshold level to use
+      \param limit an optional LogLimit for this call site
+    */
     if ( !os ){
       throw( "LogStreams FATAL error: No Stream supplied! " );
     }
-    if ( os->single_threaded() || init_mutex() ){
-      my_stream = os;
-      my_level = os->get_threshold();
-      os->set_threshold( LogDebug );
-    }
-  }
-
-  Dbg::Dbg( LogStream& os ):  my_stream(0), my_level(LogSilent){
-    /// create a Dbg object on the LogStream with Debug threshold
-    if ( os.single_threaded() || init_mutex() ){
-      my_stream = &os;
-      my_level = os.get_threshold();
-      os.set_threshold( LogDebug );
-    }
-  }
-
-  Dbg::~Dbg(){
-    /// destroy the Dbg object
-    my_stream->flush();
-    my_stream->set_threshold( my_level );
-    if ( !my_stream->single_threaded() ){
-      mutex_release();
-    }
-  }
-
-  LogStream& Dbg::operator *() {
-    /// return the LogStream from the Dbg object
-#ifdef DARE_TO_OPTIMIZE
-    if ( my_stream->get_level() >= my_stream->get_threshold() ){
-      return *my_stream;
-    }
-    else {
-      return null_stream;
+    my_stream = os;
+    size_t skipped = 0;
+    if ( limit && !limit->allow( skipped ) ){
+      suppressed = true;
+      return;
     }
-#else
-    return *my_stream;
-#endif
-  }
-
-  xDbg::xDbg( LogStream *os ): my_stream(0), my_level(LogSilent){
-    /// create a xDbg object on the LogStream with Heavy threshold
-    if ( !os ){
-      throw( "LogStreams FATAL error: No Stream supplied! " );
+    if ( os->tracer ){
+      if ( os->get_level() < level ){
+	suppressed = true;
+	return;
+      }
+      // when there are too many threads, we fall back to locking
+      trace_stream = os->tracer->thread_stream();
     }
-    if ( os->single_threaded() || init_mutex() ){
-      my_stream = os;
+    if ( !trace_stream
+	 && ( os->single_threaded() || init_mutex() ) ){
       my_level = os->get_threshold();
-      os->set_threshold( LogHeavy );
-    }
-  }
-
-  xDbg::xDbg( LogStream& os ):  my_stream(0), my_level(LogSilent){
-    /// create a xDbg object on the LogStream with Heavy threshold
-    if ( os.single_threaded() || init_mutex() ){
-      my_stream = &os;
-      my_level = os.get_threshold();
-      os.set_threshold( LogHeavy );
+      os->set_threshold( level );
     }
-  }
-
-  xDbg::~xDbg(){
-    /// destroy the xDbg object
-    my_stream->flush();
-    my_stream->set_threshold( my_level );
-    if ( !my_stream->single_threaded() ){
-      mutex_release();
+    if ( skipped > 0 ){
+      **this << "(suppressed " << skipped << " messages)" << endl;
     }
   }
 
-  LogStream& xDbg::operator *(){
-    /// return the LogStream from the xDbg object
-#ifdef DARE_TO_OPTIMIZE
-    if ( my_stream->get_level() >= my_stream->get_threshold() ){
-      return *my_stream;
+  LogGuard::~LogGuard(){
+    /// release the LogStream and restore the threshold
+    if ( suppressed ){
+      return;
     }
-    else {
-      return null_stream;
+    if ( trace_stream ){
+      my_stream->tracer->commit( *my_stream );
+      return;
     }
-#else
-    return *my_stream;
-#endif
-  }
-
-  xxDbg::xxDbg( LogStream *os ): my_stream(0), my_level(LogSilent){
-    /// create a xxDbg object on the LogStream with Extreme threshold
-    if ( !os ){
-      throw( "LogStreams FATAL error: No Stream supplied! " );
-    }
-    if ( os->single_threaded() || init_mutex() ){
-      my_stream = os;
-      my_level = os->get_threshold();
-      os->set_threshold( LogExtreme );
-    }
-  }
-
-  xxDbg::xxDbg( LogStream& os ):  my_stream(0), my_level(LogSilent){
-    /// create a xxDbg object on the LogStream with Extreme threshold
-    if ( os.single_threaded() || init_mutex() ){
-      my_stream = &os;
-      my_level = os.get_threshold();
-      os.set_threshold( LogExtreme );
-    }
-  }
-
-  xxDbg::~xxDbg(){
-    /// destroy the xxDbg object
     my_stream->flush();
     my_stream->set_threshold( my_level );
     if ( !my_stream->single_threaded() ){
@@ -444,17 +419,21 @@ namespace TiCC {
     }
   }
 
-  LogStream& xxDbg::operator *(){
-    /// return the LogStream from the xxDbg object
+  LogStream& LogGuard::operator *(){
+    /// return the LogStream, or a dummy when there is nothing to output
+    if ( trace_stream ){
+      return *trace_stream;
+    }
 #ifdef DARE_TO_OPTIMIZE
-    if ( my_stream->get_level() >= my_stream->get_threshold() ){
+    if ( !suppressed
+	 && my_stream->get_level() >= my_stream->get_threshold() ){
       return *my_stream;
     }
     else {
       return null_stream;
     }
 #else
-    return *my_stream;
+    return suppressed ? null_stream : *my_stream;
 #endif
   }
 
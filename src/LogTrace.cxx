@@ -0,0 +1,388 @@
+/*
+  Copyright (c) 2006 - 2024
+  CLST  - Radboud University
+  ILK   - Tilburg University
+
+  This file is part of ticcutils
+
+  ticcutils is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  ticcutils is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+  For questions and suggestions, see:
+      https://github.com/LanguageMachines/ticcutils/issues
+  or send mail to:
+      lamasoftware (at ) science.ru.nl
+
+*/
+
+#include "ticcutils/LogTrace.h"
+
+#include <ctime>
+#include <csignal>
+#include <cstring>
+#include <set>
+#include <sstream>
+#include <algorithm>
+#include <unistd.h>
+#include "ticcutils/LogStream.h"
+
+using namespace std;
+
+namespace TiCC {
+
+  TraceRing::TraceRing( size_t capacity, uint32_t number ):
+    _records( new TraceRecord[capacity] ),
+    _capacity( capacity ),
+    _number( number ),
+    _head( 0 ),
+    _claimed( 0 ),
+    _tail( 0 )
+  {
+    /// create a ring for one thread
+    /*!
+      \param capacity the number of records in the ring
+      \param number the number of this ring in its LogTracer
+    */
+  }
+
+  void TraceRing::add( uint64_t stamp, bool stamp_time, const string& text ){
+    /// add a message to the ring. Only the owning thread may do this
+    /*!
+      \param stamp the time of the message in microseconds
+      \param stamp_time should the message get a time stamp on output?
+      \param text the message
+    */
+    uint64_t h = _head.load( memory_order_relaxed );
+    size_t pos = 0;
+    do {
+      // claim the slot before overwriting it, so readers can tell
+      _claimed.store( h + 1, memory_order_relaxed );
+      atomic_thread_fence( memory_order_release );
+      TraceRecord& rec = _records[h % _capacity];
+      size_t len = min( text.size() - pos, TraceRecord::text_size );
+      rec.stamp = stamp;
+      rec.seq = h;
+      rec.ring = _number;
+      rec.len = len;
+      rec.stamp_time = stamp_time;
+      rec.continued = ( pos > 0 );
+      memcpy( rec.text, text.data() + pos, len );
+      pos += len;
+      // publish the record
+      _head.store( ++h, memory_order_release );
+    } while ( pos < text.size() );
+  }
+
+  void TraceRing::collect( vector<TraceRecord>& result ){
+    /// append all records not collected before to result
+    /*!
+      \param result the vector to append to
+      only one thread at a time may call this.
+    */
+    uint64_t h = head();
+    uint64_t start = max( _tail, h > _capacity ? h - _capacity : 0 );
+    size_t first = result.size();
+    for ( uint64_t i = start; i < h; ++i ){
+      result.push_back( at( i ) );
+    }
+    // the writer might have overwritten the oldest records while we were
+    // copying them. Throw those away
+    atomic_thread_fence( memory_order_acquire );
+    uint64_t claimed = _claimed.load( memory_order_relaxed );
+    if ( claimed > _capacity && claimed - _capacity > start ){
+      uint64_t lost = min( claimed - _capacity - start, h - start );
+      result.erase( result.begin() + first, result.begin() + first + lost );
+    }
+    _tail = h;
+  }
+
+  /// @cond HIDDEN
+  /// the private LogStream of one thread for one LogTracer
+  struct ThreadTrace {
+    ThreadTrace( uint64_t id, TraceRing *r ):
+      tracer_id( id ),
+      ring( r ),
+      stream( sink, NoStamp )
+    {
+      stream.set_level( LogExtreme ); // filtering is done by the LogGuard
+    };
+    uint64_t tracer_id;
+    TraceRing *ring;
+    ostringstream sink;
+    LogStream stream;
+  };
+  /// @endcond
+
+  static thread_local vector<unique_ptr<ThreadTrace>> thread_traces;
+
+  static mutex registry_mutex;
+  static uint64_t last_id = 0;
+  static set<uint64_t> live_ids;
+  static const int max_tracers = 64;
+  static atomic<LogTracer*> crash_tracers[max_tracers];
+  static int crash_fd = 2;
+
+  static ThreadTrace *find_thread_trace( uint64_t id ){
+    for ( const auto& tt : thread_traces ){
+      if ( tt->tracer_id == id ){
+	return tt.get();
+      }
+    }
+    return 0;
+  }
+
+  LogTracer::LogTracer( size_t capacity ):
+    _ring_count( 0 ),
+    _capacity( capacity > 0 ? capacity : 1 )
+  {
+    /// create a LogTracer
+    /*!
+      \param capacity the number of records kept per thread
+    */
+    for ( auto& r : _rings ){
+      r.store( 0 );
+    }
+    lock_guard<mutex> lock( registry_mutex );
+    _id = ++last_id;
+    live_ids.insert( _id );
+    for ( auto& t : crash_tracers ){
+      if ( t.load() == 0 ){
+	t.store( this );
+	break;
+      }
+    }
+  }
+
+  LogTracer::~LogTracer(){
+    /// destroy a LogTracer and all its rings
+    {
+      lock_guard<mutex> lock( registry_mutex );
+      live_ids.erase( _id );
+      for ( auto& t : crash_tracers ){
+	if ( t.load() == this ){
+	  t.store( 0 );
+	}
+      }
+    }
+    int count = min( _ring_count.load(), max_rings );
+    for ( int i=0; i < count; ++i ){
+      delete _rings[i].load();
+    }
+  }
+
+  LogStream *LogTracer::thread_stream(){
+    /// give the LogStream of the calling thread, create it when needed
+    /*!
+      \return the LogStream, or 0 when there are too many threads.
+    */
+    ThreadTrace *tt = find_thread_trace( _id );
+    if ( !tt ){
+      int n = _ring_count.fetch_add( 1 );
+      if ( n >= max_rings ){
+	return 0;
+      }
+      TraceRing *ring = new TraceRing( _capacity, n );
+      _rings[n].store( ring, memory_order_release );
+      {
+	// forget about LogTracers which are gone
+	lock_guard<mutex> lock( registry_mutex );
+	thread_traces.erase( remove_if( thread_traces.begin(),
+					thread_traces.end(),
+					[]( const unique_ptr<ThreadTrace>& t ){
+					  return live_ids.count( t->tracer_id ) == 0; } ),
+			     thread_traces.end() );
+      }
+      thread_traces.emplace_back( new ThreadTrace( _id, ring ) );
+      tt = thread_traces.back().get();
+    }
+    return &tt->stream;
+  }
+
+  void LogTracer::commit( const LogStream& origin ){
+    /// move the output of the calling thread into its ring
+    /*!
+      \param origin the tracing LogStream the output was meant for. We use
+      its message and stamp settings.
+    */
+    ThreadTrace *tt = find_thread_trace( _id );
+    if ( !tt ){
+      return;
+    }
+    tt->stream.flush();
+    string text = tt->sink.str();
+    if ( text.empty() ){
+      return;
+    }
+    tt->sink.str( "" );
+    if ( ( origin.get_stamp() & StampMessage )
+	 && !origin.get_message().empty() ){
+      text = origin.get_message() + ":" + text;
+    }
+    struct timespec now;
+    clock_gettime( CLOCK_REALTIME, &now );
+    tt->ring->add( uint64_t(now.tv_sec) * 1000000 + now.tv_nsec / 1000,
+		   origin.get_stamp() & StampTime,
+		   text );
+  }
+
+  static string format_stamp( uint64_t stamp ){
+    /// format a stamp in microseconds just like time_stamp() does
+    char time_line[50];
+    time_t secs = stamp / 1000000;
+    struct tm tmp;
+    strftime( time_line, 45, "%Y%m%d:%H%M%S", localtime_r( &secs, &tmp ) );
+    string milli_line = to_string( ( stamp % 1000000 ) / 1000 );
+    milli_line = pad( milli_line, 3, '0' );
+    return string( time_line ) + ":" + milli_line + ":";
+  }
+
+  void LogTracer::write( ostream& os ){
+    /// write all collected output in time order
+    /*!
+      \param os the stream to write to
+
+      every record is written only once. The threads may keep on logging
+      while we are busy
+    */
+    lock_guard<mutex> lock( _reader_mutex );
+    vector<TraceRecord> records;
+    int count = min( _ring_count.load(), max_rings );
+    for ( int i=0; i < count; ++i ){
+      TraceRing *ring = _rings[i].load( memory_order_acquire );
+      if ( ring ){
+	ring->collect( records );
+      }
+    }
+    vector<const TraceRecord*> order;
+    order.reserve( records.size() );
+    for ( const auto& rec : records ){
+      order.push_back( &rec );
+    }
+    sort( order.begin(), order.end(),
+	  []( const TraceRecord *a, const TraceRecord *b ){
+	    if ( a->stamp != b->stamp ) return a->stamp < b->stamp;
+	    if ( a->ring != b->ring ) return a->ring < b->ring;
+	    return a->seq < b->seq; } );
+    for ( const auto rec : order ){
+      if ( rec->stamp_time && !rec->continued ){
+	os << format_stamp( rec->stamp );
+      }
+      os.write( rec->text, rec->len );
+    }
+    os.flush();
+  }
+
+  static void put( int fd, const char *s, size_t len ){
+    /// an async-signal-safe write of len bytes
+    while ( len > 0 ){
+      ssize_t n = ::write( fd, s, len );
+      if ( n <= 0 ){
+	return;
+      }
+      s += n;
+      len -= n;
+    }
+  }
+
+  static void put_number( int fd, uint64_t val, int width ){
+    /// an async-signal-safe output of a number, padded with zeroes
+    char buf[24];
+    int i = sizeof(buf);
+    do {
+      buf[--i] = '0' + val % 10;
+      val /= 10;
+      --width;
+    } while ( i > 0 && ( val > 0 || width > 0 ) );
+    put( fd, buf + i, sizeof(buf) - i );
+  }
+
+  void LogTracer::dump( int fd ){
+    /// write all records in time order in an async-signal-safe way
+    /*!
+      \param fd the file descriptor to write to
+
+      No memory is allocated, and no locks are taken. The rings aren't
+      marked as collected, so this can be used on top of write()
+    */
+    // static, to keep the stack small. We don't return here anyway
+    static uint64_t cursor[max_rings];
+    static uint64_t end[max_rings];
+    int count = min( _ring_count.load(), max_rings );
+    for ( int i=0; i < count; ++i ){
+      TraceRing *ring = _rings[i].load( memory_order_acquire );
+      end[i] = 0;
+      cursor[i] = 0;
+      if ( ring ){
+	end[i] = ring->head();
+	if ( end[i] > ring->capacity() ){
+	  cursor[i] = end[i] - ring->capacity();
+	}
+      }
+    }
+    while ( true ){
+      int best = -1;
+      uint64_t best_stamp = 0;
+      for ( int i=0; i < count; ++i ){
+	if ( cursor[i] < end[i] ){
+	  const TraceRecord& rec = _rings[i].load()->at( cursor[i] );
+	  if ( best < 0 || rec.stamp < best_stamp ){
+	    best = i;
+	    best_stamp = rec.stamp;
+	  }
+	}
+      }
+      if ( best < 0 ){
+	break;
+      }
+      const TraceRecord& rec = _rings[best].load()->at( cursor[best]++ );
+      if ( !rec.continued ){
+	put( fd, "[", 1 );
+	put_number( fd, rec.stamp / 1000000, 1 );
+	put( fd, ".", 1 );
+	put_number( fd, rec.stamp % 1000000, 6 );
+	put( fd, "] ", 2 );
+      }
+      put( fd, rec.text, min( size_t(rec.len), TraceRecord::text_size ) );
+    }
+  }
+
+  static void crash_handler( int sig ){
+    /// dump all traces, and die the normal way
+    const char *mess = "\n*** dumping LogStream traces ***\n";
+    put( crash_fd, mess, strlen(mess) );
+    for ( auto& t : crash_tracers ){
+      LogTracer *tracer = t.load();
+      if ( tracer ){
+	tracer->dump( crash_fd );
+      }
+    }
+    raise( sig ); // the handler is reset (SA_RESETHAND)
+  }
+
+  void LogTracer::dump_on_crash( int fd ){
+    /// install signal handlers to dump all traces when we crash
+    /*!
+      \param fd the file descriptor to dump the traces to
+    */
+    crash_fd = fd;
+    struct sigaction act;
+    memset( &act, 0, sizeof(act) );
+    act.sa_handler = crash_handler;
+    sigemptyset( &act.sa_mask );
+    act.sa_flags = SA_RESETHAND;
+    for ( int sig : { SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT } ){
+      sigaction( sig, &act, 0 );
+    }
+  }
+
+}
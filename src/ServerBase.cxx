@@ -29,8 +29,12 @@
 #ifndef HAVE_DAEMON
 #include <fcntl.h> // for implementing daemon
 #endif
+#include <fcntl.h>
+#include <sys/stat.h>
 #include <pthread.h>
 #include <unistd.h>
+#include <sys/socket.h>
+#include <poll.h>
 #include <stdint.h>
 #include <cstdlib>
 #include <cerrno>
@@ -39,6 +43,10 @@
 #include <string>
 #include <iostream>
 #include <fstream>
+#include <sstream>
+#include <thread>
+#include <memory>
+#include <algorithm>
 #include <stdexcept>
 #include "ticcutils/Configuration.h"
 #include "ticcutils/CommandLine.h"
@@ -46,6 +54,8 @@
 #include "ticcutils/StringOps.h"
 #include "config.h"
 #include "ticcutils/FdStream.h"
+#include "ticcutils/IoRing.h"
+#include "ticcutils/TimerWheel.h"
 
 using namespace std;
 using namespace TiCC;
@@ -62,7 +72,7 @@ namespace TiCCServer {
   string VersionName() { return PACKAGE_STRING; }
 
   childArgs::childArgs( ServerBase *server, Sockets::ClientSocket *sock ):
-    _mother(server),_socket(sock){
+    _mother(server),_socket(sock),_sent(0){
     /// create a childArgs structure
     /*!
       \param server our Server object
@@ -73,14 +83,147 @@ namespace TiCCServer {
     _id = _socket->getSockId();
     _is.open(_id);
     _os.open(_id);
+    // the output is buffered. Make sure it is sent before we wait for
+    // the next request
+    _is.tie( &_os );
   }
 
   childArgs::~childArgs( ){
     /// destroy the childArgs object
     _os.flush();
+    _mother->metrics().add_bytes( _is.count(), _os.count() );
     delete _socket;
   }
 
+  bool childArgs::sendFile( int fd, off_t offset, size_t count ){
+    /// send a region of a file to the client
+    /*!
+      \param fd the file descriptor of the file
+      \param offset the start of the region
+      \param count the number of bytes to send
+      \return true on succes
+
+      the output stream is flushed first. The data itself goes directly
+      to the socket, without copying when possible.
+    */
+    _os.flush();
+    if ( !_socket->sendFile( fd, offset, count ) ){
+      return false;
+    }
+    _sent += count;
+    _mother->metrics().add_bytes( 0, count );
+    return true;
+  }
+
+  bool childArgs::sendFile( int fd, off_t offset, size_t count,
+			    chrono::milliseconds& timeout ){
+    /// send a region of a file to the client, within a time limit
+    /*!
+      \param fd the file descriptor of the file
+      \param offset the start of the region
+      \param count the number of bytes to send
+      \param timeout the maximum time to wait until all is sent. On return
+      it holds the time that was left
+      \return true on succes. false on error or when the time is up
+
+      Use this on non-blocking connections, so a client that stops
+      reading can not keep us waiting.
+    */
+    _os.flush();
+    if ( !_socket->sendFile( fd, offset, count, timeout ) ){
+      return false;
+    }
+    _sent += count;
+    _mother->metrics().add_bytes( 0, count );
+    return true;
+  }
+
+  bool childArgs::sendBuffers( const struct iovec *iov, int iovcnt,
+			       chrono::milliseconds& timeout ){
+    /// send several blocks of memory to the client with one writev()
+    /*!
+      \param iov the buffers, like for writev(2)
+      \param iovcnt the number of buffers
+      \param timeout the maximum time to wait until all is sent. On return
+      it holds the time that was left
+      \return true on succes
+
+      the output stream is flushed first. The buffers are not copied.
+    */
+    _os.flush();
+    if ( !_socket->writeBuffers( iov, iovcnt, timeout ) ){
+      return false;
+    }
+    size_t count = 0;
+    for ( int i=0; i < iovcnt; ++i ){
+      count += iov[i].iov_len;
+    }
+    _sent += count;
+    _mother->metrics().add_bytes( 0, count );
+    return true;
+  }
+
+  bool childArgs::readFrame( string& frame ){
+    /// read one length-prefixed frame from the client
+    /*!
+      \param frame gets the data of the frame. Its memory is reused, so
+      pass the same string for every frame to avoid reallocations
+      \return true on succes. false on EOF, an error or a frame larger
+      than max_frame. The connection is useless then
+
+      The data is not scanned. Large frames are read directly into frame.
+    */
+    char head[Sockets::frame_header_size];
+    if ( !_is.read( head, Sockets::frame_header_size ) ){
+      return false;
+    }
+    size_t len = Sockets::decodeFrameLength( head );
+    if ( len > _mother->maxFrame() ){
+      *Log(logstream()) << "Socket " << _id << ": a frame of " << len
+			<< " bytes is larger than max_frame" << endl;
+      return false;
+    }
+    frame.resize( len );
+    return len == 0 || _is.read( &frame[0], len );
+  }
+
+  bool childArgs::writeFrame( const char *data, size_t len ){
+    /// send one length-prefixed frame to the client
+    /*!
+      \param data the data of the frame
+      \param len the size of data
+      \return true on succes
+
+      the output stream is flushed first. The data is not copied.
+    */
+    _os.flush();
+    if ( !_socket->writeFrame( data, len ) ){
+      return false;
+    }
+    _sent += Sockets::frame_header_size + len;
+    _mother->metrics().add_bytes( 0, Sockets::frame_header_size + len );
+    return true;
+  }
+
+  bool childArgs::sendFile( const string& name ){
+    /// send the contents of a file to the client
+    /*!
+      \param name the name of the file
+      \return true on succes
+    */
+    int fd = ::open( name.c_str(), O_RDONLY );
+    if ( fd < 0 ){
+      return false;
+    }
+    bool result = false;
+    struct stat st;
+    if ( fstat( fd, &st ) == 0 ){
+      result = sendFile( fd, 0, st.st_size );
+    }
+    ::close( fd );
+    return result;
+  }
+
   string ServerBase::VersionInfo( bool full ){
     string result;
     ostringstream oss;
@@ -99,38 +242,251 @@ namespace TiCCServer {
     _debug( false ),
     _max_conn( 25 ),
     _server_port( 7000 ),
+    _backlog( 128 ),
+    _reuse_port( false ),
+    _acceptors( 1 ),
+    _accept_nonblocking( false ),
     _callback_data( callback_data ),
     _protocol( "tcp" ),
-    _config(config)
+    _iomode( "threads" ),
+    _io_backend( "default" ),
+    _framed( false ),
+    _max_frame( Sockets::default_max_frame ),
+    _max_line( Sockets::default_max_frame ),
+    _workers( 0 ),
+    _pool( 0 ),
+    _worker_pinning( "none" ),
+    _active( 0 ),
+    _drain_timeout( 10 ),
+    _idle_timeout( 0 ),
+    _request_timeout( 0 ),
+    _queue_size( 0 ),
+    _queue_timeout( 1000 ),
+    _metrics_interval( 0 ),
+    _config(config),
+    _admitted( 0 ),
+    _queue_seq( 0 ),
+    _queue_stop( false ),
+    _drain_expired( false ),
+    _timers( 0 )
   {
     /// create a Basic Server
     /*!
       \param config the configuration informatio to use
       \param callback_data a structure with data to use in every call
     */
-    string value = _config->lookUp( "port" );
+    _unix_socket = config->lookUp( "unix_socket" );
+    string value = config->lookUp( "port" );
     if ( !value.empty() ){
       if ( !stringTo( value, _server_port ) ){
 	string mess = "ServerBase: invalid value '" + value + "' for port";
 	throw runtime_error( mess );
       }
     }
-    else {
+    else if ( _unix_socket.empty() ){
       string mess = "ServerBase:missing 'port' in config ";
       throw runtime_error( mess );
     }
-    value = _config->lookUp( "maxconn" );
+    value = config->lookUp( "maxconn" );
     if ( !value.empty() ){
-      if ( !stringTo( value, _max_conn ) ){
+      int tmp = 0;
+      if ( !stringTo( value, tmp ) ){
 	string mess = "ServerBase: invalid value '" + value + "' for maxconn";
 	throw runtime_error( mess );
       }
+      _max_conn = tmp;
+    }
+    value = config->lookUp( "backlog" );
+    if ( !value.empty() ){
+      if ( !stringTo( value, _backlog ) || _backlog == 0 ){
+	string mess = "ServerBase: invalid value '" + value + "' for backlog";
+	throw runtime_error( mess );
+      }
     }
-    value = _config->lookUp( "protocol" );
+    value = config->lookUp( "reuseport" );
+    if ( !value.empty() ){
+      if ( value == "no" ){
+	_reuse_port = false;
+      }
+      else if ( value == "yes" ){
+	_reuse_port = true;
+      }
+      else {
+	string mess = "ServerBase: invalid value '" + value
+	  + "' for reuseport; use 'yes' or 'no'";
+	throw runtime_error( mess );
+      }
+    }
+    value = config->lookUp( "acceptors" );
+    if ( !value.empty() ){
+      if ( !stringTo( value, _acceptors ) || _acceptors <= 0 ){
+	string mess = "ServerBase: invalid value '" + value
+	  + "' for acceptors";
+	throw runtime_error( mess );
+      }
+    }
+    value = config->lookUp( "accept_nonblocking" );
+    if ( !value.empty() ){
+      if ( value == "no" ){
+	_accept_nonblocking = false;
+      }
+      else if ( value == "yes" ){
+	_accept_nonblocking = true;
+      }
+      else {
+	string mess = "ServerBase: invalid value '" + value
+	  + "' for accept_nonblocking; use 'yes' or 'no'";
+	throw runtime_error( mess );
+      }
+    }
+    value = config->lookUp( "protocol" );
     if ( !value.empty() ){
       _protocol = value;
     }
-    value = _config->lookUp( "daemonize" );
+    value = config->lookUp( "iomode" );
+    if ( !value.empty() ){
+      if ( value != "threads" && value != "epoll" ){
+	string mess = "ServerBase: invalid value '" + value
+	  + "' for iomode; use 'threads' or 'epoll'";
+	throw runtime_error( mess );
+      }
+      _iomode = value;
+    }
+    value = config->lookUp( "io_backend" );
+    if ( !value.empty() ){
+      if ( value != "default" && value != "io_uring" ){
+	string mess = "ServerBase: invalid value '" + value
+	  + "' for io_backend; use 'default' or 'io_uring'";
+	throw runtime_error( mess );
+      }
+      _io_backend = value;
+    }
+    value = config->lookUp( "framing" );
+    if ( !value.empty() ){
+      if ( value != "lines" && value != "length" ){
+	string mess = "ServerBase: invalid value '" + value
+	  + "' for framing; use 'lines' or 'length'";
+	throw runtime_error( mess );
+      }
+      _framed = ( value == "length" );
+    }
+    value = config->lookUp( "max_frame" );
+    if ( !value.empty() ){
+      if ( !stringTo( value, _max_frame ) || _max_frame == 0 ){
+	string mess = "ServerBase: invalid value '" + value
+	  + "' for max_frame";
+	throw runtime_error( mess );
+      }
+    }
+    value = config->lookUp( "max_line" );
+    if ( !value.empty() ){
+      if ( !stringTo( value, _max_line ) || _max_line == 0 ){
+	string mess = "ServerBase: invalid value '" + value
+	  + "' for max_line";
+	throw runtime_error( mess );
+      }
+    }
+    value = config->lookUp( "workers" );
+    if ( !value.empty() ){
+      if ( !stringTo( value, _workers ) || _workers == 0 ){
+	string mess = "ServerBase: invalid value '" + value + "' for workers";
+	throw runtime_error( mess );
+      }
+    }
+    value = config->lookUp( "accept_cpus" );
+    if ( !value.empty() ){
+      if ( !parseCpuList( value, _accept_cpus ) ){
+	string mess = "ServerBase: invalid value '" + value
+	  + "' for accept_cpus";
+	throw runtime_error( mess );
+      }
+    }
+    value = config->lookUp( "worker_cpus" );
+    if ( !value.empty() ){
+      if ( !parseCpuList( value, _worker_cpus ) ){
+	string mess = "ServerBase: invalid value '" + value
+	  + "' for worker_cpus";
+	throw runtime_error( mess );
+      }
+    }
+    value = config->lookUp( "worker_pinning" );
+    if ( !value.empty() ){
+      if ( value != "none" && value != "cpu" && value != "node" ){
+	string mess = "ServerBase: invalid value '" + value
+	  + "' for worker_pinning; use 'none', 'cpu' or 'node'";
+	throw runtime_error( mess );
+      }
+      _worker_pinning = value;
+    }
+    value = config->lookUp( "drain_timeout" );
+    if ( !value.empty() ){
+      int tmp = 0;
+      if ( !stringTo( value, tmp ) || tmp < 0 ){
+	string mess = "ServerBase: invalid value '" + value
+	  + "' for drain_timeout";
+	throw runtime_error( mess );
+      }
+      _drain_timeout = tmp;
+    }
+    _queue_size = _max_conn;
+    value = config->lookUp( "queue_size" );
+    if ( !value.empty() ){
+      if ( !stringTo( value, _queue_size ) ){
+	string mess = "ServerBase: invalid value '" + value
+	  + "' for queue_size";
+	throw runtime_error( mess );
+      }
+    }
+    value = config->lookUp( "queue_timeout" );
+    if ( !value.empty() ){
+      int ms = 0;
+      if ( !stringTo( value, ms ) || ms < 0 ){
+	string mess = "ServerBase: invalid value '" + value
+	  + "' for queue_timeout";
+	throw runtime_error( mess );
+      }
+      _queue_timeout = chrono::milliseconds( ms );
+    }
+    value = config->lookUp( "idle_timeout" );
+    if ( !value.empty() ){
+      int tmp = 0;
+      if ( !stringTo( value, tmp ) || tmp < 0 ){
+	string mess = "ServerBase: invalid value '" + value
+	  + "' for idle_timeout";
+	throw runtime_error( mess );
+      }
+      _idle_timeout = tmp;
+    }
+    value = config->lookUp( "request_timeout" );
+    if ( !value.empty() ){
+      int tmp = 0;
+      if ( !stringTo( value, tmp ) || tmp < 0 ){
+	string mess = "ServerBase: invalid value '" + value
+	  + "' for request_timeout";
+	throw runtime_error( mess );
+      }
+      _request_timeout = tmp;
+    }
+    value = config->lookUp( "metrics_port" );
+    if ( !value.empty() ){
+      int port = 0;
+      if ( !stringTo( value, port ) || port <= 0 ){
+	string mess = "ServerBase: invalid value '" + value
+	  + "' for metrics_port";
+	throw runtime_error( mess );
+      }
+      _metrics_port = value;
+    }
+    value = config->lookUp( "metrics_interval" );
+    if ( !value.empty() ){
+      if ( !stringTo( value, _metrics_interval ) || _metrics_interval < 0 ){
+	string mess = "ServerBase: invalid value '" + value
+	  + "' for metrics_interval";
+	throw runtime_error( mess );
+      }
+    }
+    _config_file = config->lookUp( "configFile" );
+    value = config->lookUp( "daemonize" );
     if ( !value. empty() ){
       if ( value == "no" ){
 	_do_daemon = false;
@@ -144,15 +500,47 @@ namespace TiCCServer {
 	throw runtime_error( mess );
       }
     }
-    value = _config->lookUp( "logfile" );
+    value = config->lookUp( "logfile" );
     if ( !value.empty() ){
       _log_file = value;
     }
-    value = _config->lookUp( "pidfile" );
+    value = config->lookUp( "logrotate_size" );
+    if ( !value.empty() ){
+      if ( !stringTo( value, _log_rotation.max_size )
+	   || _log_rotation.max_size < 0 ){
+	string mess = "ServerBase: invalid value '" + value
+	  + "' for logrotate_size";
+	throw runtime_error( mess );
+      }
+    }
+    value = config->lookUp( "logrotate_interval" );
+    if ( !value.empty() ){
+      if ( !stringTo( value, _log_rotation.interval )
+	   || _log_rotation.interval < 0 ){
+	string mess = "ServerBase: invalid value '" + value
+	  + "' for logrotate_interval";
+	throw runtime_error( mess );
+      }
+    }
+    value = config->lookUp( "logrotate_compress" );
+    if ( !value.empty() ){
+      if ( value == "no" ){
+	_log_rotation.compress = false;
+      }
+      else if ( value == "yes" ){
+	_log_rotation.compress = true;
+      }
+      else {
+	string mess = "ServerBase: invalid value '" + value
+	  + "' for logrotate_compress; use 'yes' or 'no'";
+	throw runtime_error( mess );
+      }
+    }
+    value = config->lookUp( "pidfile" );
     if ( !value.empty() ){
       _pid_file = value;
     }
-    value = _config->lookUp( "name" );
+    value = config->lookUp( "name" );
     if ( !value.empty() ){
       _name = value;
     }
@@ -160,7 +548,7 @@ namespace TiCCServer {
       _name = _protocol + "-server";
     }
     _my_log.set_message( _name );
-    value = _config->lookUp( "debug" );
+    value = config->lookUp( "debug" );
     if ( !value.empty() ){
       if ( value == "no" ){
 	_debug = false;
@@ -177,6 +565,17 @@ namespace TiCCServer {
     _socket = 0;
   }
 
+  ServerBase::~ServerBase(){
+    /// destroy a Server
+    delete _pool;
+    delete _timers;
+    delete _socket;
+    delete _config.load();
+    for ( auto config : _old_configs ){
+      delete config;
+    }
+  }
+
   void ServerBase::server_usage(void) {
     /// display helpful information
     cerr << "Server options" << endl;
@@ -184,7 +583,60 @@ namespace TiCCServer {
     cerr << "--pidfile=<f> : store pid in file <f>" << endl;
     cerr << "--logfile=<f> : log server activity in file <f>" << endl;
     cerr << "--daemonize=[yes|no] (default yes)" << endl;
-    cerr << "--protocol=[tcp|http|json] (default tcp)" << endl << endl;
+    cerr << "in the config file, the logfile can be rotated using:" << endl;
+    cerr << "  logrotate_size=<bytes>, logrotate_interval=<seconds>" << endl;
+    cerr << "  and logrotate_compress=[yes|no] (default no)" << endl;
+    cerr << "--protocol=[tcp|http|json] (default tcp)" << endl;
+    cerr << "for http, the config file may set http_timeout=<seconds> "
+	 << "(default 5)" << endl;
+    cerr << "  http_max_requests=<num> requests per connection "
+	 << "(default 100)" << endl;
+    cerr << "  and http_max_body=<bytes> the largest request body "
+	 << "(default 16MB)" << endl;
+    cerr << "in the config file, iomode=[threads|epoll] (default threads)"
+	 << " selects a thread per connection or an event loop," << endl;
+    cerr << "  and workers=<num> the number of worker threads. (default: the"
+	 << " number of cores for epoll, maxconn for threads)" << endl;
+    cerr << "  accept_cpus=<cpus> and worker_cpus=<cpus> bind the accepting"
+	 << " and the worker threads to CPUs," << endl;
+    cerr << "  given like 0-3,8. worker_pinning=[none|cpu|node] (default none)"
+	 << " gives every worker" << endl;
+    cerr << "  a CPU of its own, or spreads them in groups over the NUMA"
+	 << " nodes" << endl;
+    cerr << "  framing=[lines|length] (default lines) makes the event loop"
+	 << " pass length-prefixed frames" << endl;
+    cerr << "  to frame_callback(), and max_frame=<bytes> (default 16MB)"
+	 << " limits their size" << endl;
+    cerr << "  max_line=<bytes> (default 16MB) limits the lines passed to"
+	 << " line_callback()" << endl;
+    cerr << "  io_backend=[default|io_uring] (default default) selects the"
+	 << " system calls for socket I/O." << endl;
+    cerr << "  io_uring is slower than the default for reads and writes;"
+	 << " it only batches accepts" << endl << endl;
+    cerr << "connections are accepted with: backlog=<num> (default 128),"
+	 << " acceptors=<num> threads (default 1)," << endl;
+    cerr << "  reuseport=[yes|no] (default no) to give every acceptor its own"
+	 << " listening socket," << endl;
+    cerr << "  and accept_nonblocking=[yes|no] (default no) for non-blocking"
+	 << " client sockets" << endl;
+    cerr << "for clients on the same host, unix_socket=<file> listens on a"
+	 << " Unix domain socket instead of the port" << endl << endl;
+    cerr << "when maxconn connections are busy, new ones wait in a queue of"
+	 << " queue_size=<num> (default maxconn)" << endl;
+    cerr << "  for at most queue_timeout=<milliseconds> (default 1000)."
+	 << " Then they are rejected" << endl;
+    cerr << "connections are closed after idle_timeout=<seconds> without"
+	 << " traffic, and request_timeout=<seconds>" << endl;
+    cerr << "  after they started. (default 0: never)" << endl << endl;
+    cerr << "on SIGTERM, the server stops accepting and waits for running"
+	 << " requests" << endl;
+    cerr << "  at most drain_timeout=<seconds> (default 10)." << endl;
+    cerr << "on SIGHUP, the config file is read again and the server may"
+	 << " reload its data" << endl << endl;
+    cerr << "metrics: metrics_port=<port> serves the counters and latencies"
+	 << " on 127.0.0.1:<port>," << endl;
+    cerr << "  and metrics_interval=<seconds> writes them to the log"
+	 << " periodically (default 0: never)" << endl << endl;
     cerr << "OR, without config file:" << endl;
     cerr << "-S <port> : run as a server on <port>" << endl;
     cerr << "-C <num>  : accept a maximum of 'num' parallel connections (default 10)" << endl;
@@ -214,28 +666,44 @@ namespace TiCCServer {
 	return 0;
       }
     }
-    else if ( !config->fill( value ) ){
-      cerr << "unable to read a configuration from " << value << endl;
-      delete config;
-      return 0;
+    else {
+      // a dæmon runs in /, so remember the full path, for reloading
+      string path = TiCC::realpath( value );
+      if ( path.empty() || !config->fill( path ) ){
+	cerr << "unable to read a configuration from " << value << endl;
+	delete config;
+	return 0;
+      }
+      config->setatt( "configFile", path );
     }
+    // the settings from the command line overrule the file, also when it
+    // is read again. Their names are kept in 'overrides'
+    string overrides;
     if ( opts.extract( "pidfile", value ) ){
       config->setatt( "pidfile", value );
+      overrides += " pidfile";
     }
     if ( opts.extract( "logfile", value ) ){
       config->setatt( "logfile", value );
+      overrides += " logfile";
     }
     if ( opts.extract( "daemonize", value ) ){
       if ( value.empty() ){
 	value = "true";
       }
       config->setatt( "daemonize", value );
+      overrides += " daemonize";
     }
     if ( opts.extract( "debug", value ) ){
       config->setatt( "debug", value );
+      overrides += " debug";
     }
     if ( opts.extract( "protocol", value ) ){
       config->setatt( "protocol", value );
+      overrides += " protocol";
+    }
+    if ( !overrides.empty() ){
+      config->setatt( "overrides", TiCC::trim( overrides ) );
     }
     if ( old ){
       string rest = opts.toString();
@@ -252,15 +720,27 @@ namespace TiCCServer {
     return 0;
   }
 
-  volatile static bool keepGoing = true;
+  static atomic<bool> keepGoing( true );
+  static atomic<bool> reloadRequested( false );
+
+  bool ServerBase::running(){
+    /// are we still accepting connections?
+    return keepGoing;
+  }
 
   void KillServerFun( int Signal ){
     /// function to handle SIGTERM signals
     if ( Signal == SIGTERM ){
       cerr << "KillServerFun caught a signal SIGTERM" << endl;
       keepGoing = false; // so stop accepting new connections
-      // need a better plan here.
-      sleep(10); // give children some spare time...
+      // the running requests are drained in Run()
+    }
+  }
+
+  void ReloadServerFun( int Signal ){
+    /// function to handle SIGHUP signals
+    if ( Signal == SIGHUP ){
+      reloadRequested = true; // handled by the accepting thread
     }
   }
 
@@ -354,24 +834,33 @@ namespace TiCCServer {
     LOG << "Thread " << (uintptr_t)pthread_self() << " on socket "
 	<< args->id() << ", started at: "
 	<< Timer::now() << endl;
-    static int service_count=0;
-    static pthread_mutex_t my_lock = PTHREAD_MUTEX_INITIALIZER;
-    pthread_mutex_lock(&my_lock);
-    // use a mutex to update the global service counter
-    if ( service_count >= maxConn() ){
+    if ( _drain_expired ){
       sendReject( args->os() );
-      pthread_mutex_unlock( &my_lock );
+      _metrics.rejected();
       LOG << "Thread " << (uintptr_t)pthread_self()
-	  << " refused " << endl;
+	  << " refused, the server is stopping" << endl;
     }
     else {
-      ++service_count;
-      pthread_mutex_unlock( &my_lock );
+      // Admit() makes sure that at most maxConn() get here
+      {
+	lock_guard<mutex> lock( _conn_mutex );
+	++_active;
+	_connections.insert( args );
+      }
+      _metrics.opened();
+      Watch( args->_timers, args->id(), [args]{ return args->traffic(); } );
+      auto start = chrono::steady_clock::now();
       callback( args );
-      pthread_mutex_lock(&my_lock);
-      // use a mutex to update and display the global service counter
-      LOG << "Socket total = " << --service_count << endl;
-      pthread_mutex_unlock(&my_lock);
+      Unwatch( args->_timers );
+      _metrics.record( ServerMetrics::CONNECTION,
+		       chrono::steady_clock::now() - start );
+      _metrics.closed();
+      {
+	lock_guard<mutex> lock( _conn_mutex );
+	_connections.erase( args );
+	LOG << "Socket total = " << --_active << endl;
+      }
+      _conn_done.notify_all();
     }
     // close the socket and exit this thread
     LOG << "Thread " << (uintptr_t)pthread_self()
@@ -379,6 +868,244 @@ namespace TiCCServer {
     delete args;
   }
 
+  void ServerBase::Watch( ConnectionTimers& timers, int fd,
+			  const function<uint64_t()>& traffic ){
+    /// start the idle_timeout and request_timeout timers of a connection
+    /*!
+      \param timers gets the ids of the timers
+      \param fd the socket of the connection
+      \param traffic returns the number of bytes received and sent so far
+
+      When a timer expires, the socket is shut down. The blocked callback,
+      or the event loop, then sees the end of the connection and cleans up
+      as usual. So the slot of a stalled client is freed. Unwatch() must be
+      called before the socket is closed.
+    */
+    if ( !_timers ){
+      return;
+    }
+    auto cut = [this,fd]( const char *why ){
+      LOG << "Socket " << fd << ": " << why << " reached, closing" << endl;
+      _metrics.timed_out();
+      ::shutdown( fd, SHUT_RDWR );
+      return chrono::milliseconds( 0 );
+    };
+    if ( _idle_timeout > 0 ){
+      chrono::milliseconds idle = chrono::seconds( _idle_timeout );
+      // traffic is only noticed when we look. Look 4 times per period, so
+      // a connection is cut off at most 25% late, but never too early
+      chrono::milliseconds step = std::max( idle / 4, _timers->tick() );
+      uint64_t last = traffic();
+      auto last_seen = chrono::steady_clock::now();
+      auto check = [=]() mutable {
+	auto now = chrono::steady_clock::now();
+	uint64_t current = traffic();
+	if ( current != last ){
+	  last = current;
+	  last_seen = now;
+	}
+	auto quiet
+	  = chrono::duration_cast<chrono::milliseconds>( now - last_seen );
+	if ( quiet >= idle ){
+	  return cut( "idle_timeout" );
+	}
+	return std::min( step, idle - quiet );
+      };
+      timers.idle = _timers->add( step, check );
+    }
+    if ( _request_timeout > 0 ){
+      timers.total = _timers->add( chrono::seconds( _request_timeout ),
+				   [=]{ return cut( "request_timeout" ); } );
+    }
+  }
+
+  void ServerBase::Unwatch( ConnectionTimers& timers ){
+    /// stop the timers of a connection
+    /*!
+      \param timers the timers, as started by Watch()
+
+      After this, the socket is never shut down by a timer anymore.
+    */
+    if ( _timers ){
+      if ( timers.idle ){
+	_timers->cancel( timers.idle );
+      }
+      if ( timers.total ){
+	_timers->cancel( timers.total );
+      }
+    }
+    timers.idle = 0;
+    timers.total = 0;
+  }
+
+  void ServerBase::PlaceThreads(){
+    /// bind the calling thread to accept_cpus and plan the worker CPUs
+    /*!
+      Run() calls this before it starts other threads. The threads it
+      starts later (acceptors, admission, timers and metrics) inherit
+      the accept_cpus. The workers bind themselves, in PinWorker().
+    */
+    _worker_places.clear();
+    // ask before binding this thread, the workers may use all CPUs
+    CpuList cpus = _worker_cpus.empty() ? onlineCpus() : _worker_cpus;
+    if ( _worker_pinning == "node" ){
+      for ( const auto& node : numaNodes() ){
+	CpuList place;
+	set_intersection( node.begin(), node.end(),
+			  cpus.begin(), cpus.end(),
+			  back_inserter( place ) );
+	if ( !place.empty() ){
+	  _worker_places.push_back( place );
+	}
+      }
+      if ( _worker_places.empty() ){
+	LOG << "worker_cpus " << formatCpuList( cpus )
+	    << " are not on any NUMA node. Using them as one group" << endl;
+	_worker_places.push_back( cpus );
+      }
+    }
+    else if ( _worker_pinning == "cpu" ){
+      for ( auto cpu : cpus ){
+	_worker_places.push_back( CpuList( 1, cpu ) );
+      }
+    }
+    else if ( !_worker_cpus.empty() || !_accept_cpus.empty() ){
+      // also when only accept_cpus is set: don't inherit those
+      _worker_places.push_back( cpus );
+    }
+    if ( !_accept_cpus.empty() ){
+      if ( pinThread( _accept_cpus ) ){
+	LOG << "accepting on CPUs " << formatCpuList( _accept_cpus ) << endl;
+      }
+      else {
+	LOG << "unable to bind to CPUs " << formatCpuList( _accept_cpus )
+	    << ": " << strerror(errno) << endl;
+      }
+    }
+    if ( !_worker_places.empty() ){
+      string places;
+      for ( const auto& place : _worker_places ){
+	if ( !places.empty() ){
+	  places += " ";
+	}
+	places += "[" + formatCpuList( place ) + "]";
+      }
+      LOG << "workers run on CPUs " << places << endl;
+    }
+  }
+
+  void ServerBase::PinWorker( size_t index ){
+    /// bind a worker thread to its CPUs
+    /*!
+      \param index the number of the worker
+
+      Workers are dealt round robin over the places made by PlaceThreads().
+      With worker_pinning=node, worker i runs on node i modulo the number
+      of nodes, so every node gets its own group of workers.
+    */
+    const CpuList& place = _worker_places[index % _worker_places.size()];
+    if ( !pinThread( place ) ){
+      LOG << "worker " << index << " unable to bind to CPUs "
+	  << formatCpuList( place ) << ": " << strerror(errno) << endl;
+    }
+  }
+
+  void ServerBase::event_input( eventArgs *args ){
+    /// handle new input on a connection in event mode
+    /*!
+      \param args the connection
+
+      The default splits the input in lines (without the \\n or \\r\\n)
+      and calls line_callback() for every complete line. An incomplete line
+      stays in the input until more data arrives, or the client closes the
+      connection. A line longer than max_line closes the connection.
+      With framing=length, frame_callback() is called for every complete
+      frame instead.
+    */
+    string& in = args->input();
+    size_t start = 0;
+    if ( _framed ){
+      // hand out the complete frames, right from the input buffer
+      while ( !args->closing()
+	      && in.size() - start >= Sockets::frame_header_size ){
+	size_t len = Sockets::decodeFrameLength( in.data() + start );
+	if ( len > _max_frame ){
+	  LOG << "Socket " << args->id() << ": a frame of " << len
+	      << " bytes is larger than max_frame" << endl;
+	  args->close();
+	  break;
+	}
+	if ( in.size() - start - Sockets::frame_header_size < len ){
+	  break;
+	}
+	frame_callback( args, in.data() + start + Sockets::frame_header_size,
+			len );
+	start += Sockets::frame_header_size + len;
+      }
+      in.erase( 0, start );
+      if ( args->eof() && !in.empty() && !args->closing() ){
+	LOG << "Socket " << args->id() << ": incomplete frame at the end"
+	    << endl;
+	in.clear();
+      }
+      return;
+    }
+    // don't search the part that was searched before again
+    size_t scanned = std::min( args->_scanned, in.size() );
+    while ( !args->closing() ){
+      size_t pos = in.find( '\n', std::max( start, scanned ) );
+      if ( pos == string::npos ){
+	break;
+      }
+      size_t end = pos;
+      if ( end > start && in[end-1] == '\r' ){
+	--end;
+      }
+      if ( end - start > _max_line ){
+	break;
+      }
+      line_callback( args, in.substr( start, end - start ) );
+      start = pos + 1;
+    }
+    in.erase( 0, start );
+    args->_scanned = in.size();
+    if ( !args->closing() && in.size() > _max_line ){
+      // a line that is too long, complete or not
+      LOG << "Socket " << args->id() << ": a line is longer than max_line"
+	  << endl;
+      args->close();
+      in.clear();
+    }
+    if ( args->eof() && !in.empty() && !args->closing() ){
+      line_callback( args, in );
+      in.clear();
+    }
+  }
+
+  void ServerBase::line_callback( eventArgs *args, const string& ){
+    /// handle one line of input in event mode
+    /*!
+      \param args the connection
+
+      servers which use iomode=epoll should override this function, or
+      event_input()
+    */
+    LOG << "line_callback() is not implemented for this server" << endl;
+    args->close();
+  }
+
+  void ServerBase::frame_callback( eventArgs *args, const char *, size_t ){
+    /// handle one frame of input in event mode, with framing=length
+    /*!
+      \param args the connection
+
+      servers which use iomode=epoll and framing=length should override
+      this function. The data is only valid during the call
+    */
+    LOG << "frame_callback() is not implemented for this server" << endl;
+    args->close();
+  }
+
   void HttpServerBase::sendReject( ostream& os ) const {
     /// send HTTP message that we are too busy
     os << "Status:503 Maximum number of connections exceeded.\n" << endl;
@@ -399,8 +1126,26 @@ namespace TiCCServer {
 
   int ServerBase::Run(){
     /// run a Server. Must be configured before.
-    LOG << "Starting a " << _protocol
-	<< " server on port " << _server_port << endl;
+    string where;
+    if ( _unix_socket.empty() ){
+      where = "on port " + toString( _server_port );
+    }
+    else {
+      if ( _do_daemon && _unix_socket[0] != '/' ) {
+	// make sure the path is absolute
+	_unix_socket = '/' + _unix_socket;
+      }
+      where = "on Unix domain socket " + _unix_socket;
+    }
+    LOG << "Starting a " << _protocol << " server " << where << endl;
+    if ( !TiCC::IoRing::setBackend( _io_backend ) ){
+      LOG << "io_uring is not available here, using the default I/O backend"
+	  << endl;
+      TiCC::IoRing::setBackend( TiCC::IoRing::DEFAULT );
+    }
+    else if ( _io_backend != "default" ){
+      LOG << "using the " << _io_backend << " I/O backend" << endl;
+    }
     if ( !_pid_file.empty() ){
       // check validity of pidfile
       if ( _do_daemon && _pid_file[0] != '/' ) {
@@ -421,7 +1166,12 @@ namespace TiCCServer {
 	// make sure the path is absolute
 	_log_file = '/' + _log_file;
       }
-      logS = new ofstream( _log_file );
+      if ( _log_rotation.active() ){
+	logS = new rotating_ofstream( _log_file, _log_rotation );
+      }
+      else {
+	logS = new ofstream( _log_file );
+      }
       if ( logS && logS->good() ){
 	LOG << "switching logging to file " << _log_file << endl;
 	_my_log.associate( *logS );
@@ -461,43 +1211,242 @@ namespace TiCCServer {
 	LOG << "wrote PID=" << pid << " to " << _pid_file << endl;
       }
     }
-    // set the attributes
-    pthread_attr_t attr;
-    if ( pthread_attr_init(&attr) ||
-	 pthread_attr_setdetachstate( &attr, PTHREAD_CREATE_DETACHED ) ){
-      LOG << "Threads: couldn't set attributes" << endl;
-      return EXIT_FAILURE;
-    }
-    LOG << "Now running a " << _protocol
-	<< " server on port " << _server_port << endl;
-
-    pthread_t chld_thr;
+    LOG << "Now running a " << _protocol << " server " << where << endl;
 
-    Sockets::ServerSocket server;
+    vector<unique_ptr<Sockets::ServerSocket>> listeners;
     string portString = toString<int>(_server_port);
-    if ( !server.connect( portString ) ){
-      LOG << "failed to start Server: " << server.getMessage() << endl;
-      return EXIT_FAILURE;
+    if ( _reuse_port && !_unix_socket.empty() ){
+      LOG << "reuseport is not possible on a Unix domain socket. "
+	  << "ignored" << endl;
+      _reuse_port = false;
     }
-
-    if ( !server.listen( 5 ) ) {
-      // maximum of 5 pending requests
-      LOG << server.getMessage() << endl;
-      return EXIT_FAILURE;
+    int sockets = _reuse_port ? _acceptors : 1;
+    for ( int i=0; i < sockets; ++i ){
+      listeners.emplace_back( new Sockets::ServerSocket() );
+      Sockets::ServerSocket& server = *listeners.back();
+      bool ok = _unix_socket.empty()
+	? server.connect( portString, _reuse_port )
+	: server.connectUnix( _unix_socket );
+      if ( !ok ){
+	LOG << "failed to start Server: " << server.getMessage() << endl;
+	return EXIT_FAILURE;
+      }
+      if ( !server.listen( _backlog ) ) {
+	LOG << server.getMessage() << endl;
+	return EXIT_FAILURE;
+      }
+    }
+    LOG << "listening with a backlog of " << _backlog << " on "
+	<< sockets << " socket" << (sockets>1?"s":"") << endl;
+    if ( _iomode != "epoll" ){
+      // accept() keeps its state in the ServerSocket, so acceptors on
+      // the same socket each get their own copy
+      for ( int i=sockets; i < _acceptors; ++i ){
+	listeners.emplace_back( new Sockets::ServerSocket() );
+	if ( !listeners.back()->share( *listeners[0] ) ){
+	  LOG << "failed to start Server: "
+	      << listeners.back()->getMessage() << endl;
+	  return EXIT_FAILURE;
+	}
+      }
+    }
+    unique_ptr<Sockets::ServerSocket> admin;
+    if ( !_metrics_port.empty() ){
+      // only reachable from this host
+      admin.reset( new Sockets::ServerSocket() );
+      if ( !admin->connect( _metrics_port, false, "127.0.0.1" )
+	   || !admin->listen( 5 ) ){
+	LOG << "failed to start the metrics listener: "
+	    << admin->getMessage() << endl;
+	return EXIT_FAILURE;
+      }
+      LOG << "metrics available on 127.0.0.1:" << _metrics_port << endl;
     }
 
-    int failcount = 0;
     struct sigaction act;
     sigaction( SIGTERM, NULL, &act ); // get current action
     act.sa_handler = KillServerFun;
     act.sa_flags &= ~SA_RESTART;      // do not continue after SIGTERM
     sigaction( SIGTERM, &act, NULL );
+    sigaction( SIGHUP, NULL, &act );
+    act.sa_handler = ReloadServerFun;
+    act.sa_flags &= ~SA_RESTART;      // interrupt accept() on SIGHUP
+    sigaction( SIGHUP, &act, NULL );
+    if ( _workers == 0 ){
+      // in thread mode, every connection occupies a worker
+      // the event loop only needs a thread per core
+      if ( _iomode == "epoll" ){
+	_workers = std::max( 1u, std::thread::hardware_concurrency() );
+      }
+      else {
+	_workers = maxConn();
+      }
+    }
+    // the threads we start should leave SIGTERM and SIGHUP to this
+    // thread, so they interrupt the accept() call
+    sigset_t term_set;
+    sigemptyset( &term_set );
+    sigaddset( &term_set, SIGTERM );
+    sigaddset( &term_set, SIGHUP );
+    pthread_sigmask( SIG_BLOCK, &term_set, NULL );
+    PlaceThreads();
+    if ( _worker_places.empty() ){
+      _pool = new WorkerPool( _workers );
+    }
+    else {
+      _pool = new WorkerPool( _workers,
+			      [this]( size_t index ){ PinWorker( index ); } );
+    }
+    LOG << "started a pool of " << _workers << " worker threads" << endl;
+    _timers = new TimerWheel();
+    thread admission_thread( [this]{ AdmissionLoop(); } );
+    thread metrics_thread;
+    if ( admin || _metrics_interval > 0 ){
+      Sockets::ServerSocket *admin_socket = admin.get();
+      metrics_thread = thread( [this,admin_socket]{
+	  MetricsLoop( admin_socket );
+	} );
+    }
+    int result;
+    if ( _iomode == "epoll" ){
+      pthread_sigmask( SIG_UNBLOCK, &term_set, NULL );
+      signal( SIGPIPE, SIG_IGN );
+      vector<Sockets::ServerSocket*> servers;
+      for ( const auto& l : listeners ){
+	servers.push_back( l.get() );
+      }
+      result = RunEvents( servers );
+    }
+    else {
+      vector<thread> acceptors;
+      for ( int i=1; i < _acceptors; ++i ){
+	Sockets::ServerSocket *server = listeners[i].get();
+	acceptors.emplace_back( [this,server]{ AcceptLoop( *server ); } );
+      }
+      pthread_sigmask( SIG_UNBLOCK, &term_set, NULL );
+      result = AcceptLoop( *listeners[0] );
+      keepGoing = false;
+      for ( const auto& l : listeners ){
+	// wake up the other acceptors
+	::shutdown( l->getSockId(), SHUT_RDWR );
+      }
+      for ( auto& t : acceptors ){
+	t.join();
+      }
+      Drain();
+      FlushAdmission();
+      _pool->stop();
+    }
+    {
+      lock_guard<mutex> lock( _queue_mutex );
+      _queue_stop = true;
+    }
+    _queue_cv.notify_all();
+    admission_thread.join();
+    if ( metrics_thread.joinable() ){
+      metrics_thread.join();
+    }
+    delete _timers;
+    _timers = 0;
+    if ( _metrics_interval > 0 ){
+      LogMetrics();
+    }
+    if ( logS ){
+      // the LogStream outlives logS, and flushes on destruction
+      _my_log.associate( cerr );
+      delete logS;
+    }
+    return result;
+  }
+
+  void ServerBase::LogMetrics(){
+    /// write the current metrics to the log
+    ostringstream oss;
+    _metrics.report( oss );
+    istringstream iss( oss.str() );
+    string line;
+    while ( getline( iss, line ) ){
+      LOG << "metrics: " << line << endl;
+    }
+  }
+
+  void ServerBase::MetricsLoop( Sockets::ServerSocket *admin ){
+    /// serve the metrics on the admin socket, and log them periodically
+    /*!
+      \param admin a listening socket on the loopback address, or 0
+
+      Every client on the admin socket gets the report() as plain text.
+      A HTTP GET request is answered with a HTTP response, so a browser
+      or curl can be used too.
+      Every metrics_interval seconds the report is written to the log.
+      The loop ends when the server stops.
+    */
+    using clock = chrono::steady_clock;
+    const chrono::seconds interval( _metrics_interval );
+    clock::time_point next_dump = clock::now() + interval;
+    while ( running() ){
+      long wait = 1000; // look at running() every second
+      if ( _metrics_interval > 0 ){
+	long left = chrono::duration_cast<chrono::milliseconds>
+	  ( next_dump - clock::now() ).count();
+	wait = std::max( 0L, std::min( wait, left ) );
+      }
+      struct pollfd pfd;
+      pfd.fd = admin ? admin->getSockId() : -1; // -1 is ignored by poll()
+      pfd.events = POLLIN;
+      pfd.revents = 0;
+      if ( poll( &pfd, 1, wait ) > 0 && ( pfd.revents & POLLIN ) ){
+	Sockets::ClientSocket client;
+	if ( admin->accept( client, false, true ) ){
+	  string line;
+	  client.read( line, 1 );
+	  bool http = line.compare( 0, 4, "GET " ) == 0;
+	  while ( http && client.read( line, 1 ) && !line.empty() ){
+	    // skip the headers
+	  }
+	  ostringstream oss;
+	  _metrics.report( oss );
+	  string answer = oss.str();
+	  if ( http ){
+	    answer = "HTTP/1.0 200 OK\r\nContent-Type: text/plain\r\n"
+	      "Content-Length: " + toString( answer.size() )
+	      + "\r\nConnection: close\r\n\r\n" + answer;
+	  }
+	  client.writeBuffer( answer.data(), answer.size() );
+	}
+      }
+      if ( _metrics_interval > 0 && clock::now() >= next_dump ){
+	LogMetrics();
+	next_dump += interval;
+      }
+    }
+  }
+
+  int ServerBase::AcceptLoop( Sockets::ServerSocket& server ){
+    /// accept connections and hand them to the worker pool
+    /*!
+      \param server the listening socket
+      \return EXIT_SUCCESS when stopped normally. EXIT_FAILURE after too
+      many failures
+
+      Several threads may run this loop, each on its own ServerSocket,
+      which may share the listening socket with the others
+    */
+    int failcount = 0;
     while( keepGoing ){ // waiting for connections loop
+      CheckReload();
       signal( SIGPIPE, SIG_IGN );
       Sockets::ClientSocket *newSocket = new Sockets::ClientSocket();
-      if ( !server.accept( *newSocket ) ){
-	cerr << "accept failed: " + server.getMessage() << endl;
+      if ( !server.accept( *newSocket, true, _accept_nonblocking ) ){
 	delete newSocket;
+	if ( !keepGoing ){
+	  break;
+	}
+	if ( errno == EINTR ){
+	  // a signal. probably SIGHUP
+	  continue;
+	}
+	cerr << "accept failed: " + server.getMessage() << endl;
 	LOG << server.getMessage() << endl;
 	if ( ++failcount > 20 ){
 	  LOG << "accept failcount > 20 " << endl;
@@ -509,25 +1458,403 @@ namespace TiCCServer {
 	}
       }
       else {
-	if ( !keepGoing ) break;
+	if ( !keepGoing ){
+	  delete newSocket;
+	  break;
+	}
 	failcount = 0;
+	_metrics.accepted();
 	LOG << "Accepting Connection #"
 	    << newSocket->getSockId()
 	    << " from remote host: "
 	    << newSocket->getClientName() << endl;
-	// create a new thread to process the incoming request
-	// (The thread will terminate itself when done processing
-	// and release its socket handle)
-	//
 	childArgs *args = new childArgs( this, newSocket );
-	pthread_create( &chld_thr, &attr, callChild, static_cast<void *>(args) );
+	// hand the request to the pool, now or when a slot comes free
+	// (the worker releases the socket handle when done)
+	Admit( newSocket,
+	       [this,args]{
+		 _pool->submit( [this,args]{
+		     socketChild( args );
+		     Release();
+		   } );
+	       },
+	       [this,args]{
+		 sendReject( args->os() );
+		 _metrics.rejected();
+		 LOG << "Connection #" << args->id() << " refused" << endl;
+		 delete args;
+	       } );
+	if ( doDebug() ){
+	  LOG << "workers busy: " << _pool->busy() << ", queued: "
+	      << _pool->queued() << ", average wait: "
+	      << _pool->average_wait() << " ms, waiting for a slot: "
+	      << waiting() << endl;
+	}
       }
       // the server is now free to accept another socket request
     }
-    // some cleanup
-    pthread_attr_destroy(&attr);
-    delete logS;
     return EXIT_SUCCESS;
   }
 
+  void ServerBase::Drain(){
+    /// wait for the running requests to finish, at most drain_timeout
+    /*!
+      Requests still waiting in the pool are served too. When the time is
+      up, the remaining connections are shut down, so their callbacks see
+      an EOF, and the waiting requests are rejected.
+    */
+    auto deadline = chrono::steady_clock::now()
+      + chrono::seconds( _drain_timeout );
+    unique_lock<mutex> lock( _conn_mutex );
+    LOG << "stopping. waiting for " << _active << " running and "
+	<< _pool->queued() + waiting() << " waiting requests" << endl;
+    while ( _active > 0 || _pool->queued() > 0 || waiting() > 0 ){
+      // the queue is not signalled. so look again now and then
+      if ( _conn_done.wait_until( lock,
+				  std::min( deadline,
+					    chrono::steady_clock::now()
+					    + chrono::milliseconds(100) ) )
+	   == cv_status::timeout
+	   && chrono::steady_clock::now() >= deadline ){
+	break;
+      }
+    }
+    if ( _active > 0 || _pool->queued() > 0 || waiting() > 0 ){
+      LOG << "drain_timeout reached. closing " << _connections.size()
+	  << " connections" << endl;
+      _drain_expired = true;
+      for ( auto args : _connections ){
+	::shutdown( args->id(), SHUT_RDWR );
+      }
+    }
+  }
+  size_t ServerBase::waiting() const {
+    /*!
+      \return the number of connections in the admission queue
+    */
+    lock_guard<mutex> lock( _queue_mutex );
+    return _waiting.size();
+  }
+
+  void ServerBase::Admit( const Sockets::ClientSocket *socket,
+			  const function<void()>& start,
+			  const function<void()>& refuse ){
+    /// start a new connection, let it wait, or refuse it
+    /*!
+      \param socket the new connection
+      \param start the function that starts serving it
+      \param refuse the function that rejects it
+
+      When less than maxConn() connections are served, the connection is
+      started. Otherwise it waits for a free slot in the admission queue,
+      for at most queue_timeout. Only when the queue is full too, or the
+      time is up, the connection is refused.
+    */
+    int prio = priority( socket );
+    unique_lock<mutex> lock( _queue_mutex );
+    if ( _admitted < maxConn() ){
+      ++_admitted;
+      lock.unlock();
+      start();
+      return;
+    }
+    if ( _waiting.size() < _queue_size && _queue_timeout.count() > 0 ){
+      Waiting w;
+      w.priority = prio;
+      w.seq = _queue_seq++;
+      w.since = chrono::steady_clock::now();
+      w.deadline = w.since + _queue_timeout;
+      w.start = start;
+      w.refuse = refuse;
+      _waiting.push_back( w );
+      _metrics.enqueued();
+      if ( doDebug() ){
+	LOG << "Connection #" << socket->getSockId()
+	    << " waits for a slot. queue length: " << _waiting.size() << endl;
+      }
+      lock.unlock();
+      _queue_cv.notify_all();
+      return;
+    }
+    lock.unlock();
+    refuse();
+  }
+
+  void ServerBase::Release(){
+    /// a connection is done. Start the best waiting one in its place
+    /*!
+      The waiting connection with the highest priority() goes first.
+      Within the same priority, the one that waited longest.
+    */
+    unique_lock<mutex> lock( _queue_mutex );
+    auto now = chrono::steady_clock::now();
+    auto best = BestWaiting( now );
+    if ( best == _waiting.end() || _admitted > maxConn() ){
+      // nobody waits (in time), or maxconn was lowered
+      --_admitted;
+      return;
+    }
+    Waiting w = *best;
+    _waiting.erase( best );
+    _metrics.dequeued();
+    lock.unlock();
+    _metrics.record( ServerMetrics::QUEUE, now - w.since );
+    w.start();
+  }
+
+  vector<ServerBase::Waiting>::iterator
+  ServerBase::BestWaiting( chrono::steady_clock::time_point now ){
+    /// find the waiting connection to start first
+    /*!
+      \param now the current time
+      \return the connection with the highest priority() that waited
+      longest, and is still in time. Or _waiting.end() when there is none
+
+      The caller holds _queue_mutex.
+    */
+    auto best = _waiting.end();
+    for ( auto it = _waiting.begin(); it != _waiting.end(); ++it ){
+      if ( it->deadline > now
+	   && ( best == _waiting.end()
+		|| it->priority > best->priority
+		|| ( it->priority == best->priority && it->seq < best->seq ) ) ){
+	best = it;
+      }
+    }
+    return best;
+  }
+
+  void ServerBase::SetMaxConn( int max_conn ){
+    /// change maxconn. New slots go to the waiting connections first
+    /*!
+      \param max_conn the new maximum number of connections
+
+      The slots are filled under the queue lock, so a new connection
+      cannot take one before the connections that wait for it.
+    */
+    auto now = chrono::steady_clock::now();
+    vector<Waiting> started;
+    {
+      lock_guard<mutex> lock( _queue_mutex );
+      _max_conn = max_conn;
+      while ( _admitted < max_conn ){
+	auto best = BestWaiting( now );
+	if ( best == _waiting.end() ){
+	  break;
+	}
+	++_admitted;
+	started.push_back( *best );
+	_waiting.erase( best );
+      }
+    }
+    for ( const auto& w : started ){
+      _metrics.dequeued();
+      _metrics.record( ServerMetrics::QUEUE, now - w.since );
+      w.start();
+    }
+  }
+
+  void ServerBase::AdmissionLoop(){
+    /// refuse the connections that waited too long for a slot
+    unique_lock<mutex> lock( _queue_mutex );
+    while ( !_queue_stop ){
+      auto now = chrono::steady_clock::now();
+      auto wake = now + chrono::seconds(1);
+      vector<Waiting> expired;
+      for ( auto it = _waiting.begin(); it != _waiting.end(); ){
+	if ( it->deadline <= now ){
+	  expired.push_back( *it );
+	  it = _waiting.erase( it );
+	}
+	else {
+	  wake = std::min( wake, it->deadline );
+	  ++it;
+	}
+      }
+      if ( expired.empty() ){
+	_queue_cv.wait_until( lock, wake );
+	continue;
+      }
+      lock.unlock();
+      for ( const auto& w : expired ){
+	_metrics.dequeued();
+	_metrics.record( ServerMetrics::QUEUE, now - w.since );
+	w.refuse();
+      }
+      lock.lock();
+    }
+  }
+
+  void ServerBase::FlushAdmission(){
+    /// refuse all waiting connections. Used when the server stops
+    vector<Waiting> left;
+    {
+      lock_guard<mutex> lock( _queue_mutex );
+      left.swap( _waiting );
+    }
+    for ( const auto& w : left ){
+      _metrics.dequeued();
+      w.refuse();
+    }
+  }
+
+
+  void ServerBase::CheckReload(){
+    /// run Reload() when a SIGHUP arrived
+    if ( reloadRequested.exchange( false ) ){
+      Reload();
+    }
+  }
+
+  void ServerBase::Reload(){
+    /// read the configuration again, on request of a SIGHUP
+    /*!
+      The listening sockets stay open, so no connections are lost.
+      Settings that need a restart, like the port, keep their old value.
+      So does maxconn in threads mode, when it exceeds the number of
+      workers. Settings from the command line, like --debug, keep
+      overruling the file. When maxconn grows, the new slots go to the
+      waiting connections first.
+      The new configuration is passed to reload(), so the server can load
+      new data. Then maxconn, debug, drain_timeout, queue_size,
+      queue_timeout, idle_timeout and request_timeout are applied. The
+      timeouts only for new connections.
+      Running connections read these settings and config() without a lock,
+      so they are atomic.
+    */
+    LOG << "SIGHUP: reloading the configuration" << endl;
+    Configuration *config = new Configuration();
+    if ( _config_file.empty() ){
+      LOG << "reload: no configuration file. keeping the settings" << endl;
+      *config = *_config.load();
+    }
+    else if ( !config->fill( _config_file ) ){
+      LOG << "reload: unable to read " << _config_file
+	  << ". nothing changed" << endl;
+      delete config;
+      return;
+    }
+    else {
+      static const vector<string> fixed = { "port", "unix_socket",
+					    "protocol", "iomode", "io_backend",
+					    "framing", "max_frame", "max_line",
+					    "workers", "accept_cpus",
+					    "worker_cpus", "worker_pinning",
+					    "backlog", "reuseport",
+					    "acceptors", "accept_nonblocking",
+					    "daemonize", "pidfile", "logfile",
+					    "logrotate_size",
+					    "logrotate_interval",
+					    "logrotate_compress",
+					    "name", "configFile" };
+      for ( const auto& key : fixed ){
+	string old_value = _config.load()->lookUp( key );
+	string new_value = config->lookUp( key );
+	if ( new_value != old_value ){
+	  if ( !new_value.empty() && key != "configFile" ){
+	    LOG << "reload: changing '" << key << "' needs a restart" << endl;
+	  }
+	  if ( old_value.empty() ){
+	    config->clearatt( key );
+	  }
+	  else {
+	    config->setatt( key, old_value );
+	  }
+	}
+      }
+      // the command line still overrules the file
+      string overrides = _config.load()->lookUp( "overrides" );
+      if ( !overrides.empty() ){
+	for ( const auto& key : split( overrides ) ){
+	  config->setatt( key, _config.load()->lookUp( key ) );
+	}
+	config->setatt( "overrides", overrides );
+      }
+    }
+    int max_conn = _max_conn;
+    string value = config->lookUp( "maxconn" );
+    if ( !value.empty()
+	 && ( !stringTo( value, max_conn ) || max_conn <= 0 ) ){
+      LOG << "reload: invalid value '" << value << "' for maxconn" << endl;
+      delete config;
+      return;
+    }
+    if ( _iomode == "threads" && _workers > 0
+	 && max_conn > static_cast<int>(_workers) ){
+      // every connection occupies a worker, and the pool has a fixed size
+      LOG << "reload: raising 'maxconn' above the " << _workers
+	  << " workers needs a restart" << endl;
+      max_conn = _max_conn;
+    }
+    int drain_timeout = _drain_timeout;
+    value = config->lookUp( "drain_timeout" );
+    if ( !value.empty()
+	 && ( !stringTo( value, drain_timeout ) || drain_timeout < 0 ) ){
+      LOG << "reload: invalid value '" << value << "' for drain_timeout"
+	  << endl;
+      delete config;
+      return;
+    }
+    size_t queue_size = _queue_size;
+    value = config->lookUp( "queue_size" );
+    if ( !value.empty() && !stringTo( value, queue_size ) ){
+      LOG << "reload: invalid value '" << value << "' for queue_size" << endl;
+      delete config;
+      return;
+    }
+    int queue_timeout = _queue_timeout.count();
+    value = config->lookUp( "queue_timeout" );
+    if ( !value.empty()
+	 && ( !stringTo( value, queue_timeout ) || queue_timeout < 0 ) ){
+      LOG << "reload: invalid value '" << value << "' for queue_timeout"
+	  << endl;
+      delete config;
+      return;
+    }
+    int idle_timeout = _idle_timeout;
+    value = config->lookUp( "idle_timeout" );
+    if ( !value.empty()
+	 && ( !stringTo( value, idle_timeout ) || idle_timeout < 0 ) ){
+      LOG << "reload: invalid value '" << value << "' for idle_timeout"
+	  << endl;
+      delete config;
+      return;
+    }
+    int request_timeout = _request_timeout;
+    value = config->lookUp( "request_timeout" );
+    if ( !value.empty()
+	 && ( !stringTo( value, request_timeout ) || request_timeout < 0 ) ){
+      LOG << "reload: invalid value '" << value << "' for request_timeout"
+	  << endl;
+      delete config;
+      return;
+    }
+    value = config->lookUp( "debug" );
+    if ( !value.empty() && value != "yes" && value != "no" ){
+      LOG << "reload: invalid value '" << value << "' for debug" << endl;
+      delete config;
+      return;
+    }
+    if ( !reload( config ) ){
+      LOG << "reload: the new configuration is refused" << endl;
+      delete config;
+      return;
+    }
+    SetMaxConn( max_conn );
+    _drain_timeout = drain_timeout;
+    _idle_timeout = idle_timeout;
+    _request_timeout = request_timeout;
+    {
+      lock_guard<mutex> lock( _queue_mutex );
+      _queue_size = queue_size;
+      _queue_timeout = chrono::milliseconds( queue_timeout );
+    }
+    if ( !value.empty() ){
+      _debug = ( value == "yes" );
+    }
+    // running requests may still use the old one
+    _old_configs.push_back( _config.exchange( config ) );
+    LOG << "reload done" << endl;
+  }
+
 }
@@ -0,0 +1,405 @@
+/*
+  Copyright (c) 2006 - 2024
+  CLST  - Radboud University
+  ILK   - Tilburg University
+
+  This file is part of ticcutils
+
+  ticcutils is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  ticcutils is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+  For questions and suggestions, see:
+      https://github.com/LanguageMachines/ticcutils/issues
+  or send mail to:
+      lamasoftware (at ) science.ru.nl
+*/
+
+
+#include "ticcutils/ServerBase.h"
+#include "ticcutils/IoRing.h"
+
+#include <cerrno>
+#include <cstring>
+#include <cstdlib>
+#include <set>
+#include <mutex>
+#include <chrono>
+#include <sstream>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "config.h"
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif
+
+using namespace std;
+using namespace TiCC;
+
+#define LOG *Log(_my_log)
+
+namespace TiCCServer {
+
+  eventArgs::eventArgs( ServerBase *server, Sockets::ClientSocket *sock ):
+    data(0),
+    _mother(server),
+    _socket(sock),
+    _written(0),
+    _start(chrono::steady_clock::now()),
+    _closing(false),
+    _eof(false),
+    _scanned(0),
+    _wanted(0),
+    _requests(0),
+    _traffic(0)
+  {
+    /// create an eventArgs structure
+    /*!
+      \param server our Server object
+      \param sock the Socket object. Should be non-blocking
+    */
+    _id = _socket->getSockId();
+  }
+
+  eventArgs::~eventArgs(){
+    /// destroy the eventArgs object, and close the socket
+    delete _socket;
+  }
+
+  bool eventArgs::fill(){
+    /// read all data that is available now
+    /*!
+      \return false on a read error
+    */
+    char buf[65536];
+    while ( true ){
+      // the event loop only has non-blocking sockets
+      ssize_t n = TiCC::IoRing::read( _id, buf, sizeof(buf), true );
+      if ( n > 0 ){
+	_input.append( buf, n );
+	_traffic += n;
+	_mother->metrics().add_bytes( n, 0 );
+	if ( size_t(n) < sizeof(buf) ){
+	  return true;
+	}
+      }
+      else if ( n == 0 ){
+	_eof = true;
+	return true;
+      }
+      else if ( errno == EINTR ){
+	continue;
+      }
+      else {
+	return ( errno == EAGAIN || errno == EWOULDBLOCK );
+      }
+    }
+  }
+
+  void eventArgs::writeFrame( const char *data, size_t len ){
+    /// queue one length-prefixed frame for output
+    /*!
+      \param data the data of the frame
+      \param len the size of data
+    */
+    char head[Sockets::frame_header_size];
+    Sockets::encodeFrameLength( head, len );
+    _output.append( head, Sockets::frame_header_size );
+    _output.append( data, len );
+  }
+
+  bool eventArgs::flush(){
+    /// send as much of the queued output as the socket accepts now
+    /*!
+      \return false on a write error
+    */
+    while ( _written < _output.size() ){
+      ssize_t n = TiCC::IoRing::send( _id,
+				      _output.data() + _written,
+				      _output.size() - _written,
+				      MSG_NOSIGNAL | MSG_DONTWAIT );
+      if ( n > 0 ){
+	_written += n;
+	_traffic += n;
+	_mother->metrics().add_bytes( 0, n );
+      }
+      else if ( n < 0 && errno == EINTR ){
+	continue;
+      }
+      else if ( n < 0 && ( errno == EAGAIN || errno == EWOULDBLOCK ) ){
+	break;
+      }
+      else {
+	return false;
+      }
+    }
+    if ( _written == _output.size() ){
+      _output.clear();
+      _written = 0;
+    }
+    return true;
+  }
+
+#ifdef HAVE_SYS_EPOLL_H
+
+  int ServerBase::RunEvents( const vector<Sockets::ServerSocket*>& servers ){
+    /// run the server with an epoll event loop and a pool of workers
+    /*!
+      \param servers the listening ServerSockets (more than one when
+      SO_REUSEPORT is used)
+      \return EXIT_SUCCESS or EXIT_FAILURE
+
+      The calling thread only accepts connections and waits for events.
+      All callbacks run on the workers. Every connection is registered
+      EPOLLONESHOT, so only one worker at a time handles it. The worker
+      re-arms it when done.
+    */
+    int epfd = epoll_create1( EPOLL_CLOEXEC );
+    if ( epfd < 0 ){
+      LOG << "epoll_create failed: " << strerror(errno) << endl;
+      return EXIT_FAILURE;
+    }
+    for ( auto server : servers ){
+      if ( !server->setNonBlocking() ){
+	LOG << server->getMessage() << endl;
+	::close( epfd );
+	return EXIT_FAILURE;
+      }
+      struct epoll_event ev;
+      memset( &ev, 0, sizeof(ev) );
+      ev.events = EPOLLIN;
+      ev.data.ptr = server;
+      if ( epoll_ctl( epfd, EPOLL_CTL_ADD, server->getSockId(), &ev ) < 0 ){
+	LOG << "epoll_ctl failed: " << strerror(errno) << endl;
+	::close( epfd );
+	return EXIT_FAILURE;
+      }
+    }
+    auto listener = [&servers]( void *ptr ) -> Sockets::ServerSocket* {
+      // is this event for one of the listening sockets?
+      for ( auto server : servers ){
+	if ( ptr == server ){
+	  return server;
+	}
+      }
+      return 0;
+    };
+    mutex conn_lock;
+    set<eventArgs*> connections;
+
+    auto finish = [&]( eventArgs *args ){
+      // close a connection for good
+      Unwatch( args->_timers );
+      epoll_ctl( epfd, EPOLL_CTL_DEL, args->id(), 0 );
+      size_t left;
+      {
+	lock_guard<mutex> lock( conn_lock );
+	connections.erase( args );
+	left = connections.size();
+      }
+      _metrics.closed();
+      _metrics.record( ServerMetrics::CONNECTION,
+		       chrono::steady_clock::now() - args->_start );
+      LOG << "Socket " << args->id() << " closed, total = " << left << endl;
+      delete args;
+      // maybe someone is waiting for this slot
+      Release();
+    };
+
+    auto rearm = [&]( eventArgs *args, int op ){
+      // wait for the next event on a connection
+      struct epoll_event cev;
+      memset( &cev, 0, sizeof(cev) );
+      cev.events = EPOLLONESHOT | EPOLLRDHUP;
+      if ( !args->closing() ){
+	cev.events |= EPOLLIN;
+      }
+      if ( args->pending() ){
+	cev.events |= EPOLLOUT;
+      }
+      cev.data.ptr = args;
+      if ( epoll_ctl( epfd, op, args->id(), &cev ) < 0 ){
+	LOG << "epoll_ctl failed on socket " << args->id() << ": "
+	    << strerror(errno) << endl;
+	finish( args );
+      }
+    };
+
+    auto handle = [&]( eventArgs *args, uint32_t events ){
+      // runs on a worker
+      bool ok = true;
+      try {
+	if ( !args->closing()
+	     && ( events & (EPOLLIN|EPOLLRDHUP|EPOLLHUP|EPOLLERR) ) ){
+	  ok = args->fill();
+	  if ( ok && ( !args->input().empty() || args->eof() ) ){
+	    auto start = chrono::steady_clock::now();
+	    event_input( args );
+	    _metrics.record( ServerMetrics::REQUEST,
+			     chrono::steady_clock::now() - start );
+	  }
+	  if ( args->eof() ){
+	    args->close();
+	  }
+	}
+	if ( ok ){
+	  ok = args->flush();
+	}
+      }
+      catch ( const exception& e ){
+	LOG << "Socket " << args->id() << ": " << e.what() << endl;
+	ok = false;
+      }
+      if ( !ok || ( args->closing() && !args->pending() ) ){
+	finish( args );
+      }
+      else {
+	rearm( args, EPOLL_CTL_MOD );
+      }
+    };
+
+    auto open = [&]( eventArgs *args ){
+      // runs on a worker, before the connection is registered
+      bool ok = true;
+      try {
+	event_open( args );
+	ok = args->flush();
+      }
+      catch ( const exception& e ){
+	LOG << "Socket " << args->id() << ": " << e.what() << endl;
+	ok = false;
+      }
+      if ( !ok || ( args->closing() && !args->pending() ) ){
+	finish( args );
+      }
+      else {
+	rearm( args, EPOLL_CTL_ADD );
+      }
+    };
+
+    int result = EXIT_SUCCESS;
+    {
+      WorkerPool& pool = *_pool;
+      const int max_events = 64;
+      struct epoll_event events[max_events];
+      bool draining = false;
+      chrono::steady_clock::time_point deadline;
+      while ( true ){
+	if ( !running() ){
+	  size_t left;
+	  {
+	    lock_guard<mutex> lock( conn_lock );
+	    left = connections.size();
+	  }
+	  if ( !draining ){
+	    // stop accepting, wait for the open connections
+	    draining = true;
+	    deadline = chrono::steady_clock::now()
+	      + chrono::seconds( _drain_timeout );
+	    for ( auto server : servers ){
+	      epoll_ctl( epfd, EPOLL_CTL_DEL, server->getSockId(), 0 );
+	    }
+	    // the waiting connections would not be started in time
+	    FlushAdmission();
+	    LOG << "stopping. waiting for " << left << " connections" << endl;
+	  }
+	  if ( left == 0 ){
+	    break;
+	  }
+	  if ( chrono::steady_clock::now() >= deadline ){
+	    LOG << "drain_timeout reached. closing " << left
+		<< " connections" << endl;
+	    break;
+	  }
+	}
+	else {
+	  CheckReload();
+	}
+	int num = epoll_wait( epfd, events, max_events, draining ? 100 : 1000 );
+	if ( num < 0 ){
+	  if ( errno == EINTR ){
+	    continue;
+	  }
+	  LOG << "epoll_wait failed: " << strerror(errno) << endl;
+	  result = EXIT_FAILURE;
+	  break;
+	}
+	for ( int i=0; i < num; ++i ){
+	  Sockets::ServerSocket *server = listener( events[i].data.ptr );
+	  if ( !server ){
+	    eventArgs *args = static_cast<eventArgs*>( events[i].data.ptr );
+	    uint32_t what = events[i].events;
+	    pool.submit( [&handle,args,what]{ handle( args, what ); } );
+	    continue;
+	  }
+	  // new connections. accept them all
+	  while ( true ){
+	    Sockets::ClientSocket *sock = new Sockets::ClientSocket();
+	    if ( !server->accept( *sock, false, true ) ){
+	      if ( errno != EAGAIN && errno != EWOULDBLOCK ){
+		LOG << server->getMessage() << endl;
+	      }
+	      delete sock;
+	      break;
+	    }
+	    _metrics.accepted();
+	    eventArgs *args = new eventArgs( this, sock );
+	    Admit( sock,
+		   [&,args]{
+		     {
+		       lock_guard<mutex> lock( conn_lock );
+		       connections.insert( args );
+		     }
+		     _metrics.opened();
+		     Watch( args->_timers, args->id(),
+			    [args]{ return args->traffic(); } );
+		     LOG << "Accepting Connection #" << args->id()
+			 << " from remote host: "
+			 << args->socket()->getClientName() << endl;
+		     pool.submit( [&open,args]{ open( args ); } );
+		   },
+		   [this,args]{
+		     ostringstream os;
+		     sendReject( os );
+		     args->write( os.str() );
+		     args->flush();
+		     _metrics.rejected();
+		     LOG << "Socket " << args->id() << " refused " << endl;
+		     delete args;
+		   } );
+	  }
+	}
+      }
+      // the connections waiting for a slot refer to the locals of this
+      // function, so refuse them now. Also when epoll_wait() failed
+      FlushAdmission();
+      // let the pool finish its queued work
+      pool.stop();
+    }
+    for ( auto args : connections ){
+      Unwatch( args->_timers );
+      delete args;
+    }
+    ::close( epfd );
+    return result;
+  }
+
+#else
+
+  int ServerBase::RunEvents( const vector<Sockets::ServerSocket*>& ){
+    LOG << "iomode=epoll is not supported on this platform" << endl;
+    return EXIT_FAILURE;
+  }
+
+#endif // HAVE_SYS_EPOLL_H
+
+}
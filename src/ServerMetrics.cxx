@@ -0,0 +1,218 @@
+/*
+  Copyright (c) 2006 - 2024
+  CLST  - Radboud University
+  ILK   - Tilburg University
+
+  This file is part of ticcutils
+
+  ticcutils is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  ticcutils is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+  For questions and suggestions, see:
+      https://github.com/LanguageMachines/ticcutils/issues
+  or send mail to:
+      lamasoftware (at ) science.ru.nl
+*/
+
+#include "ticcutils/ServerMetrics.h"
+
+#include <iostream>
+#include <algorithm>
+
+using namespace std;
+
+namespace TiCCServer {
+
+  LatencyHistogram::LatencyHistogram(){
+    /// create an empty histogram
+    for ( auto& c : _counts ){
+      c.store( 0, memory_order_relaxed );
+    }
+  }
+
+  size_t LatencyHistogram::index( uint64_t value ){
+    /// the bucket for a value
+    /*!
+      \param value the value
+      \return the bucket index. Values below 16 get a bucket of their own.
+      Above that, every power of 2 is split in 16 equal parts.
+    */
+    const uint64_t sub = 1 << sub_bits;
+    if ( value < sub ){
+      return value;
+    }
+    int exp = 63 - __builtin_clzll( value );
+    size_t part = ( value >> ( exp - sub_bits ) ) & ( sub - 1 );
+    return ( ( exp - sub_bits + 1 ) << sub_bits ) + part;
+  }
+
+  uint64_t LatencyHistogram::highest_value( size_t index ){
+    /// the largest value that ends up in bucket index
+    const uint64_t sub = 1 << sub_bits;
+    if ( index < sub ){
+      return index;
+    }
+    int exp = ( index >> sub_bits ) + sub_bits - 1;
+    uint64_t part = index & ( sub - 1 );
+    uint64_t low = ( sub + part ) << ( exp - sub_bits );
+    return low + ( uint64_t(1) << ( exp - sub_bits ) ) - 1;
+  }
+
+  void LatencyHistogram::record( uint64_t value ){
+    /// count value. Must only be called by the owning thread
+    auto& c = _counts[index( value )];
+    c.store( c.load( memory_order_relaxed ) + 1, memory_order_relaxed );
+  }
+
+  void LatencyHistogram::add_to( vector<uint64_t>& totals ) const {
+    /// add our counts to totals
+    totals.resize( bucket_count, 0 );
+    for ( size_t i=0; i < bucket_count; ++i ){
+      totals[i] += _counts[i].load( memory_order_relaxed );
+    }
+  }
+
+  static atomic<uint64_t> metrics_ids( 0 );
+
+  ServerMetrics::ServerMetrics():
+    _id( ++metrics_ids ),
+    _start( clock::now() ),
+    _accepted( 0 ),
+    _rejected( 0 ),
+    _timed_out( 0 ),
+    _active( 0 ),
+    _queued( 0 ),
+    _bytes_in( 0 ),
+    _bytes_out( 0 )
+  {
+    /// create a set of metrics
+  }
+
+  struct LocalHistograms {
+    uint64_t id;
+    LatencyHistogram *histogram[ServerMetrics::kinds];
+  };
+
+  LatencyHistogram& ServerMetrics::local( Kind kind ){
+    /// the histogram of the calling thread
+    /*!
+      The histograms are owned by this object. A thread keeps pointers to
+      them, keyed on our unique id, so the lookup is lock free after the
+      first time.
+    */
+    static thread_local vector<LocalHistograms> cache;
+    for ( const auto& entry : cache ){
+      if ( entry.id == _id ){
+	return *entry.histogram[kind];
+      }
+    }
+    LocalHistograms entry;
+    entry.id = _id;
+    {
+      lock_guard<mutex> lock( _mutex );
+      for ( int k=REQUEST; k < kinds; ++k ){
+	_histograms[k].emplace_back( new LatencyHistogram() );
+	entry.histogram[k] = _histograms[k].back().get();
+      }
+    }
+    cache.push_back( entry );
+    return *entry.histogram[kind];
+  }
+
+  void ServerMetrics::record( Kind kind, clock::duration duration ){
+    /// record the duration of a request, a connection or a wait in the queue
+    /*!
+      \param kind REQUEST, CONNECTION or QUEUE
+      \param duration the time it took. Stored in microseconds
+    */
+    auto usec = chrono::duration_cast<chrono::microseconds>( duration );
+    local( kind ).record( usec.count() < 0 ? 0 : usec.count() );
+  }
+
+  vector<uint64_t> ServerMetrics::merged( Kind kind ) const {
+    /// the sum of the histograms of all threads
+    vector<uint64_t> totals( LatencyHistogram::bucket_count, 0 );
+    lock_guard<mutex> lock( _mutex );
+    for ( const auto& h : _histograms[kind] ){
+      h->add_to( totals );
+    }
+    return totals;
+  }
+
+  static uint64_t percentile_of( const vector<uint64_t>& totals,
+				 double percentage ){
+    /// find the value below which percentage of the counts fall
+    uint64_t count = 0;
+    for ( auto c : totals ){
+      count += c;
+    }
+    if ( count == 0 ){
+      return 0;
+    }
+    uint64_t wanted = max( uint64_t(1),
+			   uint64_t( count * percentage / 100.0 + 0.5 ) );
+    uint64_t seen = 0;
+    for ( size_t i=0; i < totals.size(); ++i ){
+      seen += totals[i];
+      if ( seen >= wanted ){
+	return LatencyHistogram::highest_value( i );
+      }
+    }
+    return LatencyHistogram::highest_value( totals.size()-1 );
+  }
+
+  uint64_t ServerMetrics::percentile( Kind kind, double percentage ) const {
+    /// get a percentile of the recorded durations
+    /*!
+      \param kind REQUEST, CONNECTION or QUEUE
+      \param percentage e.g. 99.9
+      \return the duration in microseconds (within ~6%)
+    */
+    return percentile_of( merged( kind ), percentage );
+  }
+
+  void ServerMetrics::report( ostream& os ) const {
+    /// write all metrics to os, one 'name value' pair per line
+    auto uptime = chrono::duration_cast<chrono::seconds>( clock::now()
+							   - _start );
+    os << "uptime_seconds " << uptime.count() << "\n"
+       << "connections_accepted " << _accepted << "\n"
+       << "connections_rejected " << _rejected << "\n"
+       << "connections_timed_out " << _timed_out << "\n"
+       << "connections_active " << _active << "\n"
+       << "connections_queued " << _queued << "\n"
+       << "bytes_in " << _bytes_in << "\n"
+       << "bytes_out " << _bytes_out << "\n";
+    const char *names[] = { "request", "connection", "queue_wait" };
+    for ( int k=REQUEST; k < kinds; ++k ){
+      vector<uint64_t> totals = merged( Kind(k) );
+      uint64_t count = 0;
+      size_t highest = 0;
+      for ( size_t i=0; i < totals.size(); ++i ){
+	count += totals[i];
+	if ( totals[i] ){
+	  highest = i;
+	}
+      }
+      os << names[k] << "_count " << count << "\n";
+      for ( double p : { 50.0, 90.0, 99.0, 99.9 } ){
+	os << names[k] << "_usec{p=" << p << "} "
+	   << percentile_of( totals, p ) << "\n";
+      }
+      os << names[k] << "_usec{max} "
+	 << ( count ? LatencyHistogram::highest_value( highest ) : 0 )
+	 << "\n";
+    }
+  }
+
+}
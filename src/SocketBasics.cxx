@@ -31,16 +31,26 @@
 
 #include <cstring>
 #include <cerrno>
+#include <climits>
+#include <mutex>
+#include <algorithm>
 #include <fcntl.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
 #include <netdb.h>
 #include <sys/socket.h>
+#include <poll.h>
 #include <unistd.h>
 
 #include "config.h"
+#ifdef HAVE_SYS_SENDFILE_H
+#include <sys/sendfile.h>
+#endif
 #include "ticcutils/StringOps.h"
-#include "ticcutils/Timer.h"
+#include "ticcutils/IoRing.h"
 
 using namespace std;
 
@@ -56,13 +66,66 @@ namespace Sockets {
   // #define KEEP // experiment with keep-alive
   // #define DEBUG
 
+  const size_t read_chunk = 4096;
+
+  ssize_t Socket::fill_buffer(){
+    /// read the next chunk of data from the socket into the buffer
+    /*!
+      \return the number of bytes read. 0 on EOF, -1 on error (errno is set)
+
+      Only called when the buffer is completely consumed
+    */
+    if ( in_buf.empty() ){
+      in_buf.resize( read_chunk );
+    }
+    ssize_t res;
+    do {
+      res = TiCC::IoRing::read( sock, in_buf.data(), in_buf.size(),
+				nonBlocking );
+#ifdef DEBUG
+      cerr << "read res = " << res << endl;
+#endif
+    } while ( res < 0 && errno == EINTR );
+    in_start = 0;
+    in_end = ( res > 0 ) ? res : 0;
+    return res;
+  }
+
+  bool Socket::take_line( string& line ){
+    /// move buffered bytes to line, upto and including the next newline
+    /*!
+      \param line the line to extend
+      \return true when a newline was found, false when the buffer ran out
+
+      returns (\\r) and the newline itself are not copied
+    */
+    const char *start = in_buf.data() + in_start;
+    size_t len = in_end - in_start;
+    const char *nl = static_cast<const char*>( memchr( start, '\n', len ) );
+    size_t take = nl ? nl - start : len;
+    const char *end = start + take;
+    while ( start < end ){
+      const char *cr = static_cast<const char*>( memchr( start, '\r',
+							   end - start ) );
+      const char *stop = cr ? cr : end;
+      line.append( start, stop - start );
+      start = cr ? cr + 1 : end;
+    }
+    if ( nl ){
+      in_start += take + 1;
+      return true;
+    }
+    in_start = in_end;
+    return false;
+  }
+
   bool Socket::read( string& line ) {
     /// read a string from the Socket
     /*!
       \param line the result
-      \return true when at least one byte is read. false otherwise
+      \return true when a complete line is read. false otherwise
 
-      a line is terminated by a newline (\\n) or a return (\\r)
+      a line is terminated by a newline (\\n). returns (\\r) are skipped
     */
     if ( !isValid() ){
       mess = "read: socket invalid";
@@ -72,8 +135,6 @@ namespace Sockets {
       return false;
     }
     line = "";
-    char last_read = 0;
-    long int bytes_read = -1;
 #ifdef KEEP
     val = 1;
     setsockopt( sock, SOL_SOCKET, SO_KEEPALIVE,
@@ -82,88 +143,110 @@ namespace Sockets {
     setsockopt( sock, SOL_TCP, TCP_KEEPIDLE,
 		static_cast<void *>(&val), sizeof(val) );
 #endif
-    while ( last_read != 10 ) { // read 1 character at a time upto \n
-      bytes_read = ::read( sock, &last_read, 1 );
+    while ( !take_line( line ) ){
+      ssize_t bytes_read = fill_buffer();
       if ( bytes_read <= 0 ){
+	if ( bytes_read < 0 ){
+	  mess = string("connection closed ") + strerror( errno );
 #ifdef DEBUG
-	cerr << "read res = " << bytes_read  << " ( " << strerror(bytes_read) << ")" << endl;
+	  cerr << mess << endl;
 #endif
+	}
 	// The other side may have closed unexpectedly
 	::close(sock);
 	sock = -1;
-	break;
-      }
-      if ( ( last_read != 10 ) && ( last_read != 13 ) ) {
-	line += last_read;
+	return false;
       }
     }
-    if ( bytes_read < 0 ) {
-      mess = string("connection closed ") + strerror( bytes_read );
-#ifdef DEBUG
-      cerr << mess << endl;
-#endif
+    return true;
+  }
 
-      return false;
-    }
-    else if ( bytes_read == 0 ) {
-      return false;
-    }
-    else {
-      return true;
+  static bool wait_ready( int sock, short events,
+			  const chrono::steady_clock::time_point *deadline ){
+    /// wait until a (non-blocking) socket is ready
+    /*!
+      \param sock the socket
+      \param events POLLIN to wait for data, POLLOUT to wait for room
+      \param deadline the moment to give up. 0 means wait forever
+      \return true when the socket is ready (or has an error to
+      report). false on timeout (errno is ETIMEDOUT) or a poll() error
+    */
+    struct pollfd pfd;
+    pfd.fd = sock;
+    pfd.events = events;
+    while ( true ){
+      int wait = -1;
+      if ( deadline ){
+	auto left = chrono::duration_cast<chrono::milliseconds>
+	  ( *deadline - chrono::steady_clock::now() ).count();
+	if ( left < 0 ){
+	  errno = ETIMEDOUT;
+	  return false;
+	}
+	wait = int(left) + 1; // poll() rounds down, so round up here
+      }
+      pfd.revents = 0;
+      int res = poll( &pfd, 1, wait );
+      if ( res > 0 ){
+	return true;
+      }
+      if ( res < 0 && errno != EINTR ){
+	return false;
+      }
     }
   }
 
+  static bool wait_writable( int sock,
+			     const chrono::steady_clock::time_point *deadline ){
+    /// wait until a (non-blocking) socket can take more data
+    return wait_ready( sock, POLLOUT, deadline );
+  }
+
   bool Socket::read( string& result, unsigned int timeout ) {
     /// read a line from a nonblocking Socket
     /*!
       \param result the read line
       \param timeout seconds to use for retry
-      \return true is at least one byte is read, false on error
+      \return true when a complete line is read, false on error or timeout
 
-      a line is terminated by a newline (\\n) or a return (\\r)
+      a line is terminated by a newline (\\n). returns (\\r) are skipped
     */
     result = "";
     if ( !nonBlocking ){
       mess = "attempted a read with timeout on a blocking socket";
       return false;
     }
-    else {
-      char buf[5];
-      int count = 0;
-      while ( timeout > 0 ){
-	ssize_t res = ::read( sock, buf, 1 );
-#ifdef DEBUG
-	cerr << "read res = " << res  << " ( " << strerror(res) << ")" << endl;
-#endif
-	if ( res == 1 ){
-	  char c = buf[0];
-#ifdef DEBUG
-	  cerr << "-'" << c << "'-" << endl;
-#endif
-	  if ( c == '\n' ){
-	    return true;
-	  }
-	  if ( c == '\r' ){
+    else if ( timeout > 0 ){
+      // wait in poll(), so data is taken as soon as it arrives
+      const auto deadline = chrono::steady_clock::now()
+	+ chrono::seconds( timeout );
+      while ( true ){
+	if ( take_line( result ) ){
+	  return true;
+	}
+	ssize_t res = fill_buffer();
+	if ( res > 0 ){
+	  continue;
+	}
+	else if ( res < 0 && ( errno == EAGAIN || errno == EWOULDBLOCK ) ){
+	  if ( wait_ready( sock, POLLIN, &deadline ) ){
 	    continue;
 	  }
-	  result += c;
-	}
-	else if ( res == -1 || res == EAGAIN || res == EWOULDBLOCK ){
-	  TiCC::Timer::milli_wait(100);
-	  if ( ++count == 10 ){
-	    --timeout;
-	    count = 0;
+	  if ( errno == ETIMEDOUT ){
+	    break;
 	  }
+	  mess = strerror( errno );
+	  return false;
 	}
 	else {
-	  mess = strerror( res );
+	  mess = ( res == 0 ) ? "connection closed" : strerror( errno );
 	  ::close(sock);
 	  sock = -1;
 	  return false;
 	}
       }
-      mess = "timed out";
     }
+    mess = "timed out";
     return false;
   }
 
@@ -173,32 +256,87 @@ namespace Sockets {
     /*!
       \param line the line to write
       \return true on succes, false on error
+
+      On a non-blocking socket we wait until all is written
+    */
+    return writeBuffer( line.data(), line.size() );
+  }
+
+  bool Socket::write( const string& line, unsigned int timeout ){
+    /// write a line to a non-blocking socket
+    /*!
+      \param line the line to write
+      \param timeout the number of seconds to use for retrying
+      \return true on succes, false on error or when the time is up
+    */
+    chrono::milliseconds ms = chrono::seconds( timeout );
+    struct iovec iov;
+    iov.iov_base = const_cast<char*>( line.data() );
+    iov.iov_len = line.size();
+    return writeBuffers( &iov, 1, ms );
+  }
+
+#ifdef IOV_MAX
+  static const int max_iov = IOV_MAX;
+#else
+  static const int max_iov = 16; // the POSIX minimum
+#endif
+
+  bool Socket::write_all( struct iovec *iov, int iovcnt,
+			  const chrono::steady_clock::time_point *deadline ){
+    /// write a series of buffers, with as few system calls as possible
+    /*!
+      \param iov the buffers. They are modified to keep track of progress
+      \param iovcnt the number of buffers
+      \param deadline the moment to give up. 0 means wait forever
+      \return true on succes, false on error
+
+      Every writev() call sends as much as the kernel accepts. On a
+      non-blocking socket we poll() until it is writable again.
     */
     if ( !isValid() ){
       mess = "write: socket invalid";
       return false;
     }
-    if ( !line.empty() ){
-      size_t bytes_sent = 0;
-      long int this_write;
-      size_t count = line.length();
-      const char *str = line.c_str();
-      while ( bytes_sent < count ){
-	do {
-	  this_write = ::write(sock, str, count - bytes_sent);
-#ifdef DEBUG
-	  cerr << "write res = " << this_write  << " ( " << strerror(this_write) << ")" << endl;
-#endif
-	} while ( (this_write < 0) && (errno == EINTR) );
-	if (this_write <= 0){
-	  break;
+    size_t count = 0;
+    for ( int i=0; i < iovcnt; ++i ){
+      count += iov[i].iov_len;
+    }
+    size_t bytes_sent = 0;
+    while ( bytes_sent < count ){
+      while ( iov->iov_len == 0 ){
+	// skip the buffers which are done
+	++iov;
+	--iovcnt;
+      }
+      ssize_t res = TiCC::IoRing::writev( sock, iov,
+					  iovcnt < max_iov ? iovcnt : max_iov,
+					  nonBlocking );
+      if ( res > 0 ){
+	bytes_sent += res;
+	size_t done = res;
+	while ( done > 0 ){
+	  size_t part = done < iov->iov_len ? done : iov->iov_len;
+	  iov->iov_base = static_cast<char*>(iov->iov_base) + part;
+	  iov->iov_len -= part;
+	  done -= part;
+	  if ( iov->iov_len == 0 && done > 0 ){
+	    ++iov;
+	    --iovcnt;
+	  }
 	}
-	bytes_sent += this_write;
-	str += this_write;
       }
-      if ( bytes_sent < count ) {
+      else if ( res < 0 && errno == EINTR ){
+	continue;
+      }
+      else if ( res < 0
+		&& ( errno == EAGAIN || errno == EWOULDBLOCK )
+		&& wait_writable( sock, deadline ) ){
+	continue;
+      }
+      else {
 	mess = "write: failed to sent " + TiCC::toString(count - bytes_sent) +
-	  " bytes out of " + TiCC::toString(count);
+	  " bytes out of " + TiCC::toString(count) + ": " + strerror( errno );
 	::close(sock);
 	sock = -1;
 	return false;
@@ -207,49 +345,288 @@ namespace Sockets {
     return true;
   }
 
-  bool Socket::write( const string& line, unsigned int timeout ){
-    /// write a line to a non-blocking socket
+  bool Socket::writeBuffer( const char *buf, size_t count ){
+    /// write a block of memory to a socket
     /*!
-      \param line the line to write
-      \param timeout the number of seconds to use for retrying
+      \param buf the start of the data. (e.g. a memory mapped file)
+      \param count the number of bytes to write
+      \return true on succes, false on error
+
+      The data is written directly from buf, without copying. On a
+      non-blocking socket we wait until all is written
+    */
+    struct iovec iov;
+    iov.iov_base = const_cast<char*>( buf );
+    iov.iov_len = count;
+    return write_all( &iov, 1, 0 );
+  }
+
+  bool Socket::writeBuffers( const struct iovec *iov, int iovcnt ){
+    /// write several blocks of memory to a socket at once (writev)
+    /*!
+      \param iov the buffers, like for writev(2)
+      \param iovcnt the number of buffers
       \return true on succes, false on error
+
+      Use this to send e.g. a header and a body together, without
+      copying them into one string. On a non-blocking socket we wait
+      until all is written
+    */
+    vector<struct iovec> todo( iov, iov + iovcnt );
+    return write_all( todo.data(), iovcnt, 0 );
+  }
+
+  bool Socket::writeBuffers( const struct iovec *iov, int iovcnt,
+			     chrono::milliseconds& timeout ){
+    /// write several blocks of memory to a non-blocking socket at once
+    /*!
+      \param iov the buffers, like for writev(2)
+      \param iovcnt the number of buffers
+      \param timeout the maximum time to wait until all is sent. On return
+      it holds the time that was left
+      \return true on succes, false on error or when the time is up
+    */
+    auto deadline = chrono::steady_clock::now() + timeout;
+    vector<struct iovec> todo( iov, iov + iovcnt );
+    bool result = write_all( todo.data(), iovcnt, &deadline );
+    auto left = chrono::duration_cast<chrono::milliseconds>
+      ( deadline - chrono::steady_clock::now() );
+    timeout = ( left.count() > 0 ) ? left : chrono::milliseconds(0);
+    return result;
+  }
+
+  void encodeFrameLength( char *head, uint32_t len ){
+    /// fill a frame header
+    /*!
+      \param head a buffer of frame_header_size bytes
+      \param len the length of the data in the frame
+    */
+    uint32_t net = htonl( len );
+    memcpy( head, &net, frame_header_size );
+  }
+
+  uint32_t decodeFrameLength( const char *head ){
+    /// decode a frame header
+    /*!
+      \param head a buffer of frame_header_size bytes
+      \return the length of the data in the frame
+    */
+    uint32_t net;
+    memcpy( &net, head, frame_header_size );
+    return ntohl( net );
+  }
+
+  bool Socket::read_exact( char *dst, size_t num ){
+    /// read exactly num bytes, the buffered ones first
+    /*!
+      \param dst the place to store them
+      \param num the number of bytes wanted
+      \return false on EOF or error
+
+      large blocks are read directly into dst, not through our buffer
+    */
+    size_t done = 0;
+    while ( done < num ){
+      size_t avail = in_end - in_start;
+      if ( avail > 0 ){
+	size_t chunk = std::min( avail, num - done );
+	memcpy( dst + done, in_buf.data() + in_start, chunk );
+	in_start += chunk;
+	done += chunk;
+	continue;
+      }
+      ssize_t res;
+      if ( num - done >= read_chunk ){
+	do {
+	  res = TiCC::IoRing::read( sock, dst + done, num - done,
+				    nonBlocking );
+	} while ( res < 0 && errno == EINTR );
+	if ( res > 0 ){
+	  done += res;
+	  continue;
+	}
+      }
+      else {
+	res = fill_buffer();
+	if ( res > 0 ){
+	  continue;
+	}
+      }
+      mess = ( res == 0 ) ? "connection closed"
+	: string("connection closed ") + strerror( errno );
+      return false;
+    }
+    return true;
+  }
+
+  bool Socket::readFrame( string& frame, size_t max_size ){
+    /// read one frame from a blocking Socket
+    /*!
+      \param frame gets the data of the frame. Its memory is reused, so
+      pass the same string for every frame to avoid reallocations
+      \param max_size the largest frame we accept
+      \return true on success. false on EOF, an error or a frame that is
+      too large. The socket is closed then, as the rest of the stream is
+      useless
+
+      See encodeFrameLength() for the format
     */
     if ( !isValid() ){
-      mess = "write: socket invalid";
+      mess = "readFrame: socket invalid";
       return false;
     }
-    if ( !line.empty() ){
-      size_t bytes_sent = 0;
-      size_t count = line.length();
-      const char *str = line.c_str();
-      while ( timeout > 0 && bytes_sent < count ){
-	int res = ::write(sock, str, 1 );
-	if ( res == 1 ){
-	  ++bytes_sent;
-	  ++str;
-	}
-	else if ( res == EAGAIN || res == EWOULDBLOCK ){
-	  TiCC::Timer::milli_wait(100);
-	  if ( ++count == 10 ){
-	    --timeout;
-	    count = 0;
-	  }
-	}
-	else {
-	  mess = strerror( res );
-	  ::close(sock);
-	  sock = -1;
-	  return false;
+    char head[frame_header_size];
+    if ( read_exact( head, frame_header_size ) ){
+      size_t len = decodeFrameLength( head );
+      if ( len > max_size ){
+	mess = "readFrame: a frame of " + TiCC::toString( len )
+	  + " bytes is too large";
+      }
+      else {
+	frame.resize( len );
+	if ( len == 0 || read_exact( &frame[0], len ) ){
+	  return true;
 	}
       }
-      if ( bytes_sent < count ) {
-	mess = "write: failed to sent " + TiCC::toString(count - bytes_sent) +
-	  " bytes out of " + TiCC::toString(count);
+    }
+    ::close(sock);
+    sock = -1;
+    return false;
+  }
+
+  bool Socket::writeFrame( const char *data, size_t len ){
+    /// write one frame to a Socket
+    /*!
+      \param data the data of the frame
+      \param len the size of data. At most 4GB - 1
+      \return true on succes, false on error
+
+      The header and the data are written together, without copying the
+      data. On a non-blocking socket we wait until all is written
+    */
+    if ( len > UINT32_MAX ){
+      mess = "writeFrame: the frame is too large";
+      return false;
+    }
+    char head[frame_header_size];
+    encodeFrameLength( head, len );
+    struct iovec iov[2];
+    iov[0].iov_base = head;
+    iov[0].iov_len = frame_header_size;
+    iov[1].iov_base = const_cast<char*>( data );
+    iov[1].iov_len = len;
+    return write_all( iov, 2, 0 );
+  }
+
+  bool Socket::writeFrame( const string& data ){
+    /// write one frame to a Socket
+    /*!
+      \param data the data of the frame
+      \return true on succes, false on error
+    */
+    return writeFrame( data.data(), data.size() );
+  }
+
+  bool Socket::sendFile( int fd, off_t offset, size_t count ){
+    /// send a region of an open file to the socket
+    /*!
+      \param fd the file descriptor of the file
+      \param offset the start of the region
+      \param count the number of bytes to send
+      \return true on succes, false on error
+
+      When possible, sendfile(2) is used, so the data is not copied
+      through user space. Otherwise the file is copied in chunks.
+      On a non-blocking socket we wait until all is sent
+    */
+    return send_file( fd, offset, count, 0 );
+  }
+
+  bool Socket::sendFile( int fd, off_t offset, size_t count,
+			 chrono::milliseconds& timeout ){
+    /// send a region of an open file to a non-blocking socket
+    /*!
+      \param fd the file descriptor of the file
+      \param offset the start of the region
+      \param count the number of bytes to send
+      \param timeout the maximum time to wait until all is sent. On return
+      it holds the time that was left
+      \return true on succes, false on error or when the time is up
+    */
+    auto deadline = chrono::steady_clock::now() + timeout;
+    bool result = send_file( fd, offset, count, &deadline );
+    auto left = chrono::duration_cast<chrono::milliseconds>
+      ( deadline - chrono::steady_clock::now() );
+    timeout = ( left.count() > 0 ) ? left : chrono::milliseconds(0);
+    return result;
+  }
+
+  bool Socket::send_file( int fd, off_t offset, size_t count,
+			  const chrono::steady_clock::time_point *deadline ){
+    /// send a region of an open file, with sendfile(2) when possible
+    /*!
+      \param fd the file descriptor of the file
+      \param offset the start of the region
+      \param count the number of bytes to send
+      \param deadline the moment to give up. 0 means wait forever
+      \return true on succes, false on error
+    */
+    if ( !isValid() ){
+      mess = "sendFile: socket invalid";
+      return false;
+    }
+#ifdef HAVE_SYS_SENDFILE_H
+    while ( count > 0 ){
+      ssize_t res = ::sendfile( sock, fd, &offset, count );
+      if ( res > 0 ){
+	count -= res;
+      }
+      else if ( res == 0 ){
+	mess = "sendFile: unexpected end of file";
+	return false;
+      }
+      else if ( errno == EINTR ){
+	continue;
+      }
+      else if ( ( errno == EAGAIN || errno == EWOULDBLOCK )
+		&& wait_writable( sock, deadline ) ){
+	continue;
+      }
+      else if ( errno == EINVAL || errno == ENOSYS ){
+	// not supported for this kind of file. Copy it
+	break;
+      }
+      else {
+	mess = string("sendFile: ") + strerror( errno );
 	::close(sock);
 	sock = -1;
 	return false;
       }
     }
+#endif
+    const size_t chunk = 64*1024;
+    vector<char> buf( count < chunk ? count : chunk );
+    while ( count > 0 ){
+      ssize_t res = ::pread( fd, buf.data(),
+			     count < buf.size() ? count : buf.size(),
+			     offset );
+      if ( res < 0 && errno == EINTR ){
+	continue;
+      }
+      if ( res <= 0 ){
+	mess = ( res == 0 ) ? "sendFile: unexpected end of file"
+	  : string("sendFile: ") + strerror( errno );
+	return false;
+      }
+      struct iovec iov;
+      iov.iov_base = buf.data();
+      iov.iov_len = res;
+      if ( !write_all( &iov, 1, deadline ) ){
+	return false;
+      }
+      offset += res;
+      count -= res;
+    }
     return true;
   }
 
@@ -341,6 +718,254 @@ namespace Sockets {
     return true;
   }
 
+  static bool set_reuse_port( int sock, bool reuse_port, string& mess ){
+    /// set SO_REUSEPORT on a socket, when asked for
+    if ( !reuse_port ){
+      return true;
+    }
+#ifdef SO_REUSEPORT
+    int val = 1;
+    if ( setsockopt( sock, SOL_SOCKET, SO_REUSEPORT,
+		     static_cast<void *>(&val), sizeof(val) ) == 0 ){
+      return true;
+    }
+    mess = strerror( errno );
+#else
+    mess = "SO_REUSEPORT is not supported on this platform";
+#endif
+    return false;
+  }
+
+  static int accept_socket( int sock, struct sockaddr *addr, socklen_t *len,
+			    bool nonblocking ){
+    /// accept a connection. The new socket is closed on exec
+    /*!
+      \param nonblocking when true, the new socket is non-blocking
+      \return the new socket, or -1 on error
+    */
+#ifdef HAVE_ACCEPT4
+    int flags = SOCK_CLOEXEC;
+    if ( nonblocking ){
+      flags |= SOCK_NONBLOCK;
+    }
+    return TiCC::IoRing::accept( sock, addr, len, flags );
+#else
+    int newsock = ::accept( sock, addr, len );
+    if ( newsock >= 0 ){
+      fcntl( newsock, F_SETFD, FD_CLOEXEC );
+      if ( nonblocking ){
+	fcntl( newsock, F_SETFL, fcntl( newsock, F_GETFL, 0 ) | O_NONBLOCK );
+      }
+    }
+    return newsock;
+#endif
+  }
+
+  static int client_socket( int family ){
+    /// create a socket to connect with. TCP sockets get TCP_NODELAY
+    int fd = socket( family, SOCK_STREAM, 0 );
+    if ( fd >= 0 ){
+      int val = 1;
+      setsockopt( fd, SOL_SOCKET, SO_REUSEADDR,
+		  static_cast<void *>(&val), sizeof(val) );
+      if ( family != AF_UNIX ){
+	val = 1;
+	setsockopt( fd, IPPROTO_TCP, TCP_NODELAY,
+		    static_cast<void *>(&val), sizeof(val) );
+      }
+    }
+    return fd;
+  }
+
+  bool ClientSocket::connect( const struct sockaddr *addr, socklen_t len ){
+    /// connect a Client to an already resolved address
+    /*!
+      \param addr the address of the server
+      \param len the size of addr
+      \return true on success, false otherwise
+
+      Clients that connect to the same server often (like ClientPool)
+      can look up the address once, and use this.
+    */
+    if ( sock >= 0 ){
+      ::close( sock );
+    }
+    sock = client_socket( addr->sa_family );
+    if ( sock < 0 ){
+      mess = string( "ClientSocket: Socket could not be created: (" )
+	+ strerror(errno) + ")";
+      return false;
+    }
+    int res;
+    do {
+      res = ::connect( sock, addr, len );
+    } while ( res < 0 && errno == EINTR );
+    if ( res < 0 ){
+      mess = string( "ClientSocket: Connection failed (" )
+	+ strerror(errno) + ")";
+      ::close( sock );
+      sock = -1;
+      return false;
+    }
+    return true;
+  }
+
+  static bool unix_address( const string& path, struct sockaddr_un& addr,
+			   string& mess ){
+    /// fill addr for a Unix domain socket on path
+    memset( &addr, 0, sizeof(addr) );
+    addr.sun_family = AF_UNIX;
+    if ( path.empty() || path.size() >= sizeof(addr.sun_path) ){
+      mess = "invalid path for a Unix domain socket: '" + path + "'";
+      return false;
+    }
+    memcpy( addr.sun_path, path.c_str(), path.size() );
+    return true;
+  }
+
+  bool ClientSocket::connectUnix( const string& path ){
+    /// connect a Client to a server on a Unix domain socket
+    /*!
+      \param path the file name of the socket
+      \return true on success, false otherwise
+
+      For a server on the same host, this avoids the TCP/IP stack
+    */
+    struct sockaddr_un addr;
+    if ( !unix_address( path, addr, mess ) ){
+      return false;
+    }
+    if ( !connect( reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr) ) ){
+      mess = "ClientSocket: Connection on " + path + " failed ("
+	+ strerror(errno) + ")";
+      return false;
+    }
+    clientName = path;
+    return true;
+  }
+
+  ServerSocket::~ServerSocket(){
+    /// destroy a ServerSocket. The file of a Unix domain socket is removed
+    for ( const auto& p : pending ){
+      ::close( p.fd );
+    }
+    if ( !unixPath.empty() && !shared ){
+      ::unlink( unixPath.c_str() );
+    }
+  }
+
+  bool ServerSocket::connectUnix( const string& path ){
+    /// connect the Server to a Unix domain socket
+    /*!
+      \param path the file name for the socket
+      \return true on success, false otherwise
+
+      A socket file left behind by a previous server is removed, but
+      not when a server is still listening on it.
+      The file is removed again when this ServerSocket is destroyed.
+    */
+    struct sockaddr_un addr;
+    if ( !unix_address( path, addr, mess ) ){
+      return false;
+    }
+    struct stat st;
+    if ( ::lstat( path.c_str(), &st ) == 0 ){
+      if ( !S_ISSOCK( st.st_mode ) ){
+	mess = "ServerSocket: " + path + " exists, and is not a socket";
+	return false;
+      }
+      ClientSocket probe;
+      if ( probe.connectUnix( path ) ){
+	mess = "ServerSocket: " + path + " is in use by another server";
+	return false;
+      }
+      ::unlink( path.c_str() );
+    }
+    sock = socket( AF_UNIX, SOCK_STREAM, 0 );
+    if ( sock < 0 ){
+      mess = string("ServerSocket connect: socket failed (" )
+	+ strerror( errno ) + ")";
+      return false;
+    }
+    fcntl( sock, F_SETFD, FD_CLOEXEC );
+    if ( ::bind( sock, reinterpret_cast<struct sockaddr*>(&addr),
+		 sizeof(addr) ) < 0 ){
+      mess = string("ServerSocket: bind on ") + path + " failed ("
+	+ strerror( errno ) + ")";
+      ::close( sock );
+      sock = -1;
+      return false;
+    }
+    unixPath = path;
+    return true;
+  }
+
+  bool ServerSocket::share( const ServerSocket& server ){
+    /// accept the connections of another, listening, ServerSocket too
+    /*!
+      \param server the socket to share
+      eturn true on success, false otherwise
+
+      Both sockets accept from the same queue, but each keeps its own
+      state, so they can be used by different threads.
+    */
+    sock = fcntl( server.sock, F_DUPFD_CLOEXEC, 0 );
+    if ( sock < 0 ){
+      mess = string("ServerSocket share: dup failed (" )
+	+ strerror( errno ) + ")";
+      return false;
+    }
+    nonBlocking = server.nonBlocking;
+    unixPath = server.unixPath;
+    shared = true;
+    return true;
+  }
+
+  int ServerSocket::accept_pending( struct sockaddr_storage& addr,
+				    socklen_t& len,
+				    bool nonblocking ){
+    /// accept the next connection on a non-blocking socket, in batches
+    /*!
+      \param addr gets the address of the client
+      \param len gets the size of addr
+      \param nonblocking when true, the new socket is non-blocking
+      \return the new socket, or -1 on error (EAGAIN when none is waiting)
+
+      The io_uring backend accepts all waiting connections (up to 16) in
+      one system call. The others are handed out by the next calls.
+    */
+    if ( pending.empty() ){
+      const int batch = 16;
+      int fds[batch];
+      struct sockaddr_storage addrs[batch];
+      socklen_t lens[batch];
+      for ( int i=0; i < batch; ++i ){
+	lens[i] = sizeof(addrs[i]);
+      }
+      int flags = SOCK_CLOEXEC;
+      if ( nonblocking ){
+	flags |= SOCK_NONBLOCK;
+      }
+      int num = TiCC::IoRing::accept_batch( sock, fds, addrs, lens,
+					    batch, flags );
+      for ( int i=0; i < num; ++i ){
+	Pending p;
+	p.fd = fds[i];
+	p.addr = addrs[i];
+	p.len = lens[i];
+	pending.push_back( p );
+      }
+      if ( pending.empty() ){
+	return -1;
+      }
+    }
+    Pending p = pending.front();
+    pending.pop_front();
+    addr = p.addr;
+    len = p.len;
+    return p.fd;
+  }
+
 #ifdef HAVE_GETADDRINFO
 
   bool ClientSocket::connect( const string& hostString,
@@ -351,10 +976,10 @@ namespace Sockets {
       \param portString the number of the port of the server
       \return true on success, false otherwise
     */
-    struct addrinfo *res, *aip;
+    struct addrinfo *res;
     struct addrinfo hints;
     memset( &hints, 0, sizeof(hints) );
-    hints.ai_flags = AF_UNSPEC;
+    hints.ai_family = AF_UNSPEC;
     hints.ai_socktype = SOCK_STREAM;
     int eno;
     sock = -1;
@@ -364,43 +989,31 @@ namespace Sockets {
 	hostString + "' (" + gai_strerror(eno) + ")";
     }
     else {
-      aip = res;
-      while ( aip ){
-	sock = socket( aip->ai_family, aip->ai_socktype, aip->ai_protocol);
-	if ( sock > 0 ){
+      // try all addresses, until one works
+      for ( struct addrinfo *aip = res; aip; aip = aip->ai_next ){
+	if ( connect( aip->ai_addr, aip->ai_addrlen ) ){
 	  break;
 	}
-	sock = -1;
-	aip = aip->ai_next;
       }
-      if ( sock < 0 || aip == 0 ){
-	mess = string( "ClientSocket: Socket could not be created: (" )
-	  + strerror(errno) + ")";
-      }
-      else {
-	// connect the socket
-	int val = 1;
-	setsockopt( sock, SOL_SOCKET, SO_REUSEADDR,
-		    static_cast<void *>(&val), sizeof(val) );
-	val = 1;
-	setsockopt( sock, IPPROTO_TCP, TCP_NODELAY,
-		    static_cast<void *>(&val), sizeof(val) );
-	if ( ::connect( sock, aip->ai_addr, aip->ai_addrlen ) < 0 ){
-	  mess = string( "ClientSocket: Connection on ") + hostString + ":"
-	    + TiCC::toString(sock) + " failed (" + strerror(errno) + ")";
-	  close( sock );
-	  sock = -1;
-	}
+      if ( !isValid() ){
+	mess = string( "ClientSocket: Connection on ") + hostString + ":"
+	  + portString + " failed (" + strerror(errno) + ")";
       }
       freeaddrinfo( res ); // and delete all addr_info stuff
     }
     return isValid();
   }
 
-  bool ServerSocket::connect( const string& port ){
+  bool ServerSocket::connect( const string& port, bool reuse_port,
+			      const string& host ){
     /// connect the Server to an port
     /*!
       \param port the number of the port of the server
+      \param reuse_port when true, set SO_REUSEPORT. So several sockets
+      can listen on the same port, and the kernel spreads the
+      connections over them
+      \param host the address to listen on. Default all addresses. Use
+      e.g. 127.0.0.1 to only accept local connections
       \return true on success, false otherwise
     */
     sock = -1;
@@ -411,7 +1024,8 @@ namespace Sockets {
     hints.ai_socktype = SOCK_STREAM;
 
     struct addrinfo *res;
-    int status = getaddrinfo( 0, port.c_str(), &hints, &res);
+    int status = getaddrinfo( host.empty() ? 0 : host.c_str(),
+			      port.c_str(), &hints, &res);
     if ( status != 0) {
       mess = string("getaddrinfo error:: [") + gai_strerror(status) + "]";
     }
@@ -427,13 +1041,17 @@ namespace Sockets {
 			   static_cast<void *>(&val), sizeof(val) ) == 0 ){
 	    val = 1;
 	    if ( setsockopt( sock, IPPROTO_TCP, TCP_NODELAY,
-			     static_cast<void *>(&val), sizeof(val) ) == 0 ){
+			     static_cast<void *>(&val), sizeof(val) ) == 0
+		 && set_reuse_port( sock, reuse_port, mess ) ){
 	      if ( ::bind( sock, res->ai_addr, res->ai_addrlen ) == 0 ){
 		break;
 	      }
 	    }
 	  }
-	  mess = strerror( errno );
+	  if ( mess.empty() ){
+	    mess = strerror( errno );
+	  }
+	  ::close( sock );
 	  sock = -1;
 	}
 	res = res->ai_next;
@@ -443,18 +1061,28 @@ namespace Sockets {
     return isValid();
   }
 
-  bool ServerSocket::accept( ClientSocket& newSocket ){
+  bool ServerSocket::accept( ClientSocket& newSocket, bool resolve,
+			     bool nonblocking ){
     /// accept a connection on a socket
     /*!
       \param newSocket the socket to connect to
+      \param resolve when false, don't look up the name of the client, but
+      only use the numeric address. (a lookup may block for seconds)
+      \param nonblocking when true, newSocket is made non-blocking
       \return true on success, false otherwise
     */
     newSocket.sock = -1;
     struct sockaddr_storage cli_addr;
     socklen_t clilen = sizeof(cli_addr);
-    int newsock = ::accept( sock,
-			    reinterpret_cast<struct sockaddr*>(&cli_addr),
-			    &clilen );
+    int newsock;
+    if ( nonBlocking && TiCC::IoRing::active() ){
+      newsock = accept_pending( cli_addr, clilen, nonblocking );
+    }
+    else {
+      newsock = accept_socket( sock,
+			       reinterpret_cast<struct sockaddr*>(&cli_addr),
+			       &clilen, nonblocking );
+    }
     if ( newsock < 0 ){
       if ( errno == EINTR ){
 	mess = string("server-accept interrupted." );
@@ -466,17 +1094,27 @@ namespace Sockets {
     }
     else {
       char host_name[NI_MAXHOST];
-      int err = getnameinfo( reinterpret_cast<struct sockaddr *>(&cli_addr),
-			     clilen,
-			     host_name, sizeof(host_name),
-			     0, 0,
-			     0 );
       string name;
-      if ( err != 0 ){
-	name = string(" failed: getnameinfo ") + strerror(errno);
+      int err;
+      if ( cli_addr.ss_family == AF_UNIX ){
+	// a local client. It has no (useful) address
+	newSocket.sock = newsock;
+	newSocket.nonBlocking = nonblocking;
+	newSocket.clientName = "local:" + unixPath;
+	return true;
       }
-      else {
-	name = host_name;
+      if ( resolve ){
+	err = getnameinfo( reinterpret_cast<struct sockaddr *>(&cli_addr),
+			   clilen,
+			   host_name, sizeof(host_name),
+			   0, 0,
+			   0 );
+	if ( err != 0 ){
+	  name = string(" failed: getnameinfo ") + strerror(errno);
+	}
+	else {
+	  name = host_name;
+	}
       }
       err = getnameinfo( reinterpret_cast<struct sockaddr *>(&cli_addr),
 			 clilen,
@@ -484,9 +1122,10 @@ namespace Sockets {
 			 0, 0,
 			 NI_NUMERICHOST );
       if ( err == 0 ){
-	name += string(" [") + host_name + "]";
+	name += string( name.empty() ? "[" : " [" ) + host_name + "]";
       }
       newSocket.sock = newsock;
+      newSocket.nonBlocking = nonblocking;
       newSocket.clientName = name;
     }
     return newSocket.isValid();
@@ -495,22 +1134,24 @@ namespace Sockets {
 #else
 
   /// Converts ascii text to in_addr struct.
-  /// NULL is returned if the address can not be found.
-  struct in_addr *atoaddr( const string& address ){
-    struct hostent *host;
-    static struct in_addr saddr;
-
+  /// false is returned if the address can not be found.
+  bool atoaddr( const string& address, struct in_addr& saddr ){
     /* First try it as aaa.bbb.ccc.ddd. */
     const char *add = address.c_str();
     saddr.s_addr = inet_addr(add);
-    if (saddr.s_addr != (unsigned int)-1) {
-      return &saddr;
+    if (saddr.s_addr != (in_addr_t)-1) {
+      return true;
     }
-    host = gethostbyname(add);
-    if (host != NULL) {
-      return static_cast<struct in_addr *>(*host->h_addr_list);
+    // gethostbyname() returns a static buffer. Copy it while we hold the
+    // lock
+    static mutex host_lock;
+    lock_guard<mutex> lock( host_lock );
+    struct hostent *host = gethostbyname(add);
+    if ( host != NULL && host->h_addr_list[0] != NULL ) {
+      memcpy( &saddr, host->h_addr_list[0], sizeof(saddr) );
+      return true;
     }
-    return NULL;
+    return false;
   }
 
   bool ClientSocket::connect( const string& hostString,
@@ -521,48 +1162,37 @@ namespace Sockets {
       \param portString the number of the port of the server
       \return true on success, false otherwise
     */
-    int port = TiCC::stringTo<int>( portString );
-    if (port == -1) {
+    int port = -1;
+    if ( !TiCC::stringTo( portString, port ) || port <= 0 ) {
       mess = "ClientSocket connect: invalid port number";
       return false;
     }
-    const struct in_addr *addr = atoaddr( hostString );
-    if (addr == NULL) {
+    struct in_addr addr;
+    if ( !atoaddr( hostString, addr ) ) {
       mess = "ClientSocket connect:  Invalid host.";
       return false;
     }
 
     struct sockaddr_in address;
-    memset( static_cast<char *>(&address), 0, sizeof(address));
+    memset( &address, 0, sizeof(address));
     address.sin_family = AF_INET;
     address.sin_port = htons(port);
-    address.sin_addr.s_addr = addr->s_addr;
-    sock = socket(AF_INET, SOCK_STREAM, 0);
-    if ( sock < 0 ){
-      mess = "ClientSocket connect: socket failed";
-    }
-    else {
-      int val = 1;
-      setsockopt( sock, SOL_SOCKET, SO_REUSEADDR,
-		  static_cast<void *>(&val), sizeof(val) );
-      val = 1;
-      setsockopt( sock, IPPROTO_TCP, TCP_NODELAY,
-		  static_cast<void *>(&val), sizeof(val) );
-      int connected = ::connect( sock,
-				 static_cast<struct sockaddr *>(&address),
-				 sizeof(address));
-      if (connected < 0) {
-	mess = string( "ClientSocket connect: ") + host + ":" + portNum +
-	  " failed (" + strerror( errno ) + ")";
-      }
+    address.sin_addr = addr;
+    if ( !connect( reinterpret_cast<struct sockaddr *>(&address),
+		   sizeof(address) ) ){
+      mess = string( "ClientSocket connect: ") + hostString + ":"
+	+ portString + " failed (" + strerror( errno ) + ")";
     }
     return isValid();
   }
 
-  bool ServerSocket::connect( const string& port ){
+  bool ServerSocket::connect( const string& port, bool reuse_port,
+			      const string& host ){
     /// connect the Server to an port
     /*!
       \param port the number of the port of the server
+      \param reuse_port when true, set SO_REUSEPORT
+      \param host the address to listen on. Default all addresses
       \return true on success, false otherwise
     */
     sock = -1;
@@ -578,10 +1208,16 @@ namespace Sockets {
       val = 1;
       setsockopt( sock, IPPROTO_TCP, TCP_NODELAY,
 		  static_cast<void *>(&val), sizeof(val) );
+      if ( !set_reuse_port( sock, reuse_port, mess ) ){
+	::close( sock );
+	sock = -1;
+	return false;
+      }
       struct sockaddr_in serv_addr;
       memset( static_cast<char *>(&serv_addr), 0, sizeof(serv_addr));
       serv_addr.sin_family = AF_INET;
-      serv_addr.sin_addr.s_addr = htonl(INADDR_ANY);
+      serv_addr.sin_addr.s_addr = host.empty() ? htonl(INADDR_ANY)
+	: inet_addr( host.c_str() );
       int TCP_PORT = TiCC::stringTo<int>(port);
       serv_addr.sin_port = htons(TCP_PORT);
       if ( bind( sock,
@@ -594,18 +1230,21 @@ namespace Sockets {
     return isValid();
   }
 
-  bool ServerSocket::accept( ServerSocket& newSocket ){
+  bool ServerSocket::accept( ClientSocket& newSocket, bool resolve,
+			     bool nonblocking ){
     /// accept a connection on a socket
     /*!
       \param newSocket the socket to connect to
+      \param resolve when false, don't look up the name of the client
+      \param nonblocking when true, newSocket is made non-blocking
       \return true on success, false otherwise
     */
     newSocket.sock = -1;
     struct sockaddr_storage cli_addr;
     socklen_t clilen = sizeof(cli_addr);
-    int newsock = ::accept( sock,
-			    static_cast<struct sockaddr *>(&cli_addr),
-			    &clilen );
+    int newsock = accept_socket( sock,
+				 static_cast<struct sockaddr *>(&cli_addr),
+				 &clilen, nonblocking );
     if ( newsock < 0 ){
       if ( errno == EINTR ){
 	mess = string("server-accept interrupted." );
@@ -622,10 +1261,15 @@ namespace Sockets {
       if ( getpeername( newsock,
 			static_cast<struct sockaddr *>(&rem),
 			&remlen ) >= 0 ){
-	struct hostent *host
-	  = gethostbyaddr( static_cast<char *>(&rem.sin_addr),
-			   sizeof rem.sin_addr,
-			   AF_INET );
+	struct hostent *host = 0;
+	if ( resolve ){
+	  host = gethostbyaddr( static_cast<char *>(&rem.sin_addr),
+				sizeof rem.sin_addr,
+				AF_INET );
+	}
+	else {
+	  clientname = string("[") + inet_ntoa( rem.sin_addr ) + "]";
+	}
 	if ( host ){
 	  clientname = host->h_name;
 	  char **p;
@@ -638,12 +1282,317 @@ namespace Sockets {
       }
       newSocket.clientName = clientname;
       newSocket.sock = newsock;
+      newSocket.nonBlocking = nonblocking;
     }
     return newSocket.isValid();
   }
 
 #endif
 
+  bool resolveAddress( const string& host,
+		       const string& port,
+		       vector<Address>& addresses,
+		       string& mess ){
+    /// look up the addresses of a server
+    /*!
+      \param host the name or address of the server. A name starting
+      with '/' is the file of a Unix domain socket
+      \param port the port of the server. Not used for Unix domain sockets
+      \param addresses the addresses found, in the order of the resolver
+      \param mess on failure, the reason
+      \return true when at least one address is found
+
+      This may block on a DNS lookup.
+    */
+    addresses.clear();
+    if ( !host.empty() && host[0] == '/' ){
+      Address a;
+      memset( &a.addr, 0, sizeof(a.addr) );
+      struct sockaddr_un *sun = reinterpret_cast<struct sockaddr_un*>(&a.addr);
+      if ( host.size() >= sizeof(sun->sun_path) ){
+	mess = "path too long '" + host + "'";
+	return false;
+      }
+      sun->sun_family = AF_UNIX;
+      memcpy( sun->sun_path, host.c_str(), host.size() );
+      a.len = sizeof(struct sockaddr_un);
+      addresses.push_back( a );
+      return true;
+    }
+#ifdef HAVE_GETADDRINFO
+    struct addrinfo hints;
+    memset( &hints, 0, sizeof(hints) );
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo *res;
+    int eno = getaddrinfo( host.c_str(), port.c_str(), &hints, &res );
+    if ( eno != 0 ){
+      mess = "invalid hostname '" + host + "' (" + gai_strerror(eno) + ")";
+      return false;
+    }
+    for ( struct addrinfo *aip = res; aip; aip = aip->ai_next ){
+      Address a;
+      memcpy( &a.addr, aip->ai_addr, aip->ai_addrlen );
+      a.len = aip->ai_addrlen;
+      addresses.push_back( a );
+    }
+    freeaddrinfo( res );
+#else
+    struct in_addr in;
+    int port_num = -1;
+    if ( !TiCC::stringTo( port, port_num ) || port_num <= 0
+	 || !atoaddr( host, in ) ){
+      mess = "invalid host or port '" + host + ":" + port + "'";
+      return false;
+    }
+    Address a;
+    memset( &a.addr, 0, sizeof(a.addr) );
+    struct sockaddr_in *sin = reinterpret_cast<struct sockaddr_in*>(&a.addr);
+    sin->sin_family = AF_INET;
+    sin->sin_port = htons( port_num );
+    sin->sin_addr = in;
+    a.len = sizeof(struct sockaddr_in);
+    addresses.push_back( a );
+#endif
+    return !addresses.empty();
+  }
+
+  bool ClientSocket::connect( const string& host,
+			      const string& port,
+			      chrono::milliseconds timeout ){
+    /// connect a Client to a server, within a time limit
+    /*!
+      \param host the name of the server to use
+      \param port the number of the port of the server
+      \param timeout the maximum time to wait for the server. 0 means no
+      limit. This does not include the DNS lookup
+      \return true on success, false otherwise
+
+      All addresses of the server are tried, as connect( addresses,
+      timeout ) does. So a dead address delays the connection by
+      connect_attempt_delay at most, not by the TCP timeout.
+    */
+    vector<Address> addresses;
+    if ( !resolveAddress( host, port, addresses, mess ) ){
+      mess = "ClientSocket connect: " + mess;
+      return false;
+    }
+    if ( !connect( addresses, timeout ) ){
+      mess = "ClientSocket: Connection on " + host + ":" + port + " failed ("
+	+ strerror(errno) + ")";
+      return false;
+    }
+    return true;
+  }
+
+  bool ClientSocket::connect( const vector<Address>& addresses,
+			      chrono::milliseconds timeout,
+			      chrono::milliseconds delay ){
+    /// connect a Client to the first of some addresses that answers
+    /*!
+      \param addresses the addresses of one server, as given by
+      resolveAddress()
+      \param timeout the maximum time to wait. 0 means no limit
+      \param delay the time an attempt gets before the next address is
+      tried too
+      \return true on success, false otherwise. errno tells why. It is
+      ETIMEDOUT when the time is up
+
+      This is Happy Eyeballs (RFC 8305): the address families take turns,
+      starting with the one the resolver prefers, and when an address does
+      not answer within delay, the next one is tried in parallel. The
+      first connection made wins, the others are closed.
+    */
+    vector<Address> preferred;
+    vector<Address> others;
+    for ( const auto& a : addresses ){
+      if ( a.addr.ss_family == addresses[0].addr.ss_family ){
+	preferred.push_back( a );
+      }
+      else {
+	others.push_back( a );
+      }
+    }
+    vector<Address> ordered;
+    for ( size_t i=0; i < std::max( preferred.size(), others.size() ); ++i ){
+      if ( i < preferred.size() ){
+	ordered.push_back( preferred[i] );
+      }
+      if ( i < others.size() ){
+	ordered.push_back( others[i] );
+      }
+    }
+    return race( ordered, delay, timeout ) >= 0;
+  }
+
+  int ClientSocket::connectFirst( const vector<pair<string,string>>& backends,
+				  chrono::milliseconds timeout ){
+    /// connect a Client to the first of several servers that answers
+    /*!
+      \param backends the host and port of every server
+      \param timeout the maximum time to wait. 0 means no limit
+      \return the index in backends of the server connected to, or -1
+      when none answered in time
+
+      All servers are tried at the same time. Servers whose name can not
+      be resolved are skipped.
+    */
+    vector<Address> addresses;
+    vector<int> owner;
+    for ( size_t i=0; i < backends.size(); ++i ){
+      vector<Address> found;
+      string err;
+      if ( resolveAddress( backends[i].first, backends[i].second,
+			   found, err ) ){
+	addresses.insert( addresses.end(), found.begin(), found.end() );
+	owner.insert( owner.end(), found.size(), i );
+      }
+    }
+    if ( addresses.empty() ){
+      mess = "ClientSocket: none of the backends could be resolved";
+      return -1;
+    }
+    int won = race( addresses, chrono::milliseconds( 0 ), timeout );
+    if ( won < 0 ){
+      mess = "ClientSocket: none of the " + TiCC::toString( backends.size() )
+	+ " backends answered (" + strerror(errno) + ")";
+      return -1;
+    }
+    return owner[won];
+  }
+
+  int ClientSocket::race( const vector<Address>& addresses,
+			  chrono::milliseconds delay,
+			  chrono::milliseconds timeout ){
+    /// connect to the first of some addresses that answers
+    /*!
+      \param addresses the addresses, in the order to try them
+      \param delay the time between starting two attempts
+      \param timeout the maximum time to wait. 0 means no limit
+      \return the index of the address connected to, or -1. On failure
+      errno is set to the last error seen
+
+      Every attempt is a non-blocking connect(). Failed attempts make room
+      for the next address right away. The winning socket is made
+      blocking again, like the other connect functions leave it.
+    */
+    using clock = chrono::steady_clock;
+    if ( sock >= 0 ){
+      ::close( sock );
+      sock = -1;
+    }
+    const auto start = clock::now();
+    const auto deadline = start + timeout;
+    auto next_start = start;
+    vector<struct pollfd> fds;
+    vector<int> pending; // the address of every fd
+    size_t next = 0;
+    int last_error = addresses.empty() ? EINVAL : ECONNREFUSED;
+    int winner = -1;
+    while ( winner < 0 ){
+      auto now = clock::now();
+      if ( timeout.count() > 0 && now >= deadline ){
+	last_error = ETIMEDOUT;
+	break;
+      }
+      if ( next < addresses.size()
+	   && ( fds.empty() || now >= next_start ) ){
+	// start the next attempt
+	const Address& a = addresses[next];
+	const struct sockaddr *addr
+	  = reinterpret_cast<const struct sockaddr*>(&a.addr);
+	int fd = client_socket( addr->sa_family );
+	if ( fd < 0 ){
+	  last_error = errno;
+	}
+	else {
+	  fcntl( fd, F_SETFL, fcntl( fd, F_GETFL, 0 ) | O_NONBLOCK );
+	  int res;
+	  do {
+	    res = ::connect( fd, addr, a.len );
+	  } while ( res < 0 && errno == EINTR );
+	  if ( res == 0 ){
+	    sock = fd;
+	    winner = next;
+	  }
+	  else if ( errno == EINPROGRESS ){
+	    struct pollfd p;
+	    p.fd = fd;
+	    p.events = POLLOUT;
+	    p.revents = 0;
+	    fds.push_back( p );
+	    pending.push_back( next );
+	  }
+	  else {
+	    last_error = errno;
+	    ::close( fd );
+	  }
+	}
+	++next;
+	next_start = now + delay;
+	continue;
+      }
+      if ( fds.empty() ){
+	// nothing left to try
+	break;
+      }
+      int wait = -1;
+      if ( timeout.count() > 0 ){
+	wait = chrono::ceil<chrono::milliseconds>( deadline - now ).count();
+      }
+      if ( next < addresses.size() ){
+	int until_next
+	  = chrono::ceil<chrono::milliseconds>( next_start - now ).count();
+	if ( wait < 0 || until_next < wait ){
+	  wait = until_next;
+	}
+      }
+      int n = poll( fds.data(), fds.size(), wait );
+      if ( n < 0 ){
+	if ( errno == EINTR ){
+	  continue;
+	}
+	last_error = errno;
+	break;
+      }
+      for ( size_t i=0; i < fds.size(); ){
+	if ( fds[i].revents == 0 ){
+	  ++i;
+	  continue;
+	}
+	int err = 0;
+	socklen_t len = sizeof(err);
+	if ( getsockopt( fds[i].fd, SOL_SOCKET, SO_ERROR, &err, &len ) < 0 ){
+	  err = errno;
+	}
+	if ( err == 0 ){
+	  sock = fds[i].fd;
+	  winner = pending[i];
+	}
+	else {
+	  last_error = err;
+	  ::close( fds[i].fd );
+	}
+	fds.erase( fds.begin() + i );
+	pending.erase( pending.begin() + i );
+	if ( winner >= 0 ){
+	  break;
+	}
+      }
+    }
+    for ( const auto& p : fds ){
+      ::close( p.fd );
+    }
+    if ( winner < 0 ){
+      mess = string( "ClientSocket: Connection failed (" )
+	+ strerror(last_error) + ")";
+      errno = last_error;
+      return -1;
+    }
+    fcntl( sock, F_SETFL, fcntl( sock, F_GETFL, 0 ) & ~O_NONBLOCK );
+    return winner;
+  }
+
   bool ServerSocket::listen( unsigned int num ){
     /// start listening on a socket
     /*!
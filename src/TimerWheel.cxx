@@ -0,0 +1,198 @@
+/*
+  Copyright (c) 2006 - 2024
+  CLST  - Radboud University
+  ILK   - Tilburg University
+
+  This file is part of ticcutils
+
+  ticcutils is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  ticcutils is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+  For questions and suggestions, see:
+      https://github.com/LanguageMachines/ticcutils/issues
+  or send mail to:
+      lamasoftware (at ) science.ru.nl
+*/
+
+#include "ticcutils/TimerWheel.h"
+
+using namespace std;
+
+namespace TiCCServer {
+
+  TimerWheel::TimerWheel( chrono::milliseconds tick, size_t slots ):
+    _tick( tick ),
+    _slots( slots ),
+    _start( clock::now() ),
+    _current( 0 ),
+    _last_id( 0 ),
+    _running( 0 ),
+    _stopping( false )
+  {
+    /// create a wheel and start its thread
+    /*!
+      \param tick the resolution. (at least 1 ms)
+      \param slots the number of ticks in one turn of the wheel
+    */
+    if ( _tick.count() <= 0 ){
+      _tick = chrono::milliseconds( 1 );
+    }
+    if ( _slots.empty() ){
+      _slots.resize( 1 );
+    }
+    _thread = thread( &TimerWheel::run, this );
+  }
+
+  TimerWheel::~TimerWheel(){
+    /// stop the thread and destroy the wheel. Pending timers never run
+    stop();
+  }
+
+  void TimerWheel::stop(){
+    /// stop the thread. Pending timers never run
+    {
+      lock_guard<mutex> lock( _mutex );
+      _stopping = true;
+    }
+    _cond.notify_all();
+    if ( _thread.joinable() ){
+      _thread.join();
+    }
+  }
+
+  uint64_t TimerWheel::now_tick() const {
+    /// the number of ticks since the start
+    return ( clock::now() - _start ) / _tick;
+  }
+
+  void TimerWheel::place( Id id,
+			  chrono::milliseconds delay,
+			  const Callback& callback ){
+    /// put a timer in its slot. _mutex must be locked
+    // the first tick that ends after the delay. So never too early
+    clock::duration until = ( clock::now() - _start ) + delay;
+    uint64_t expires = ( until + _tick - clock::duration( 1 ) ) / _tick;
+    // the thread may be behind
+    expires = std::max( expires, _current + 1 );
+    size_t slot = expires % _slots.size();
+    // the number of times the slot is passed before it is our turn
+    uint64_t rounds = ( expires - _current - 1 ) / _slots.size();
+    Slot& s = _slots[slot];
+    s.push_front( Timer{ id, rounds, callback } );
+    _index[id] = make_pair( slot, s.begin() );
+  }
+
+  TimerWheel::Id TimerWheel::add( chrono::milliseconds delay,
+				  const Callback& callback ){
+    /// start a timer
+    /*!
+      \param delay the time after which callback is run
+      \param callback the function to run on the thread of the wheel
+      \return the id of the timer, to cancel it
+    */
+    Id id;
+    bool wake;
+    {
+      lock_guard<mutex> lock( _mutex );
+      wake = _index.empty();
+      if ( wake ){
+	// the thread is asleep. Skip the ticks that passed meanwhile
+	_current = std::max( _current, now_tick() );
+      }
+      id = ++_last_id;
+      place( id, delay, callback );
+    }
+    if ( wake ){
+      _cond.notify_all();
+    }
+    return id;
+  }
+
+  bool TimerWheel::cancel( Id id ){
+    /// stop a timer
+    /*!
+      \param id the timer, as returned by add()
+      \return true when the timer was still pending
+
+      When the callback is running right now, this waits until it is done.
+      So after cancel() the callback is not running, and never will again.
+    */
+    unique_lock<mutex> lock( _mutex );
+    _done.wait( lock, [this,id]{ return _running != id; } );
+    auto it = _index.find( id );
+    if ( it == _index.end() ){
+      return false;
+    }
+    Slot& slot = ( it->second.first == due_slot ) ? _due
+      : _slots[it->second.first];
+    slot.erase( it->second.second );
+    _index.erase( it );
+    return true;
+  }
+
+  size_t TimerWheel::size() const {
+    /*!
+      \return the number of pending timers
+    */
+    lock_guard<mutex> lock( _mutex );
+    return _index.size();
+  }
+
+  void TimerWheel::run(){
+    /// the thread of the wheel: handle the ticks as they pass
+    unique_lock<mutex> lock( _mutex );
+    while ( !_stopping ){
+      if ( _index.empty() ){
+	// nothing to do. Sleep until a timer is added
+	_current = now_tick();
+	_cond.wait( lock );
+	continue;
+      }
+      if ( _current >= now_tick() ){
+	_cond.wait_until( lock, _start + ( _current + 1 ) * _tick );
+	continue;
+      }
+      ++_current;
+      Slot& slot = _slots[_current % _slots.size()];
+      auto it = slot.begin();
+      while ( it != slot.end() ){
+	if ( it->rounds > 0 ){
+	  --it->rounds;
+	  ++it;
+	}
+	else {
+	  // expired. Move it to _due, where cancel() can still find it
+	  auto next = std::next( it );
+	  _due.splice( _due.end(), slot, it );
+	  _index[it->id].first = due_slot;
+	  it = next;
+	}
+      }
+      while ( !_due.empty() && !_stopping ){
+	Timer timer = std::move( _due.front() );
+	_due.pop_front();
+	_index.erase( timer.id );
+	_running = timer.id;
+	lock.unlock();
+	chrono::milliseconds again = timer.callback();
+	lock.lock();
+	if ( again.count() > 0 ){
+	  place( timer.id, again, timer.callback );
+	}
+	_running = 0;
+	_done.notify_all();
+      }
+    }
+  }
+
+}
@@ -0,0 +1,131 @@
+/*
+  Copyright (c) 2006 - 2024
+  CLST  - Radboud University
+  ILK   - Tilburg University
+
+  This file is part of ticcutils
+
+  ticcutils is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  ticcutils is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+  For questions and suggestions, see:
+      https://github.com/LanguageMachines/ticcutils/issues
+  or send mail to:
+      lamasoftware (at ) science.ru.nl
+*/
+
+
+#include "ticcutils/WorkerPool.h"
+
+using namespace std;
+
+namespace TiCCServer {
+
+  WorkerPool::WorkerPool( size_t num, const StartHook& start ):
+    _stopping( false ),
+    _busy( 0 ),
+    _executed( 0 ),
+    _total_wait( 0 ),
+    _max_wait( 0 )
+  {
+    /// create a pool and start its threads
+    /*!
+      \param num the number of threads. (at least 1)
+      \param start when set, every thread calls it with its number (0 to
+      num-1) before it takes tasks. To set the CPU affinity, for instance
+    */
+    if ( num == 0 ){
+      num = 1;
+    }
+    for ( size_t i=0; i < num; ++i ){
+      _threads.emplace_back( &WorkerPool::work, this, i, start );
+    }
+  }
+
+  WorkerPool::~WorkerPool(){
+    /// finish all queued tasks and destroy the pool
+    stop();
+  }
+
+  void WorkerPool::stop(){
+    /// stop the pool. Already queued tasks are still executed
+    {
+      lock_guard<mutex> lock( _mutex );
+      _stopping = true;
+    }
+    _cond.notify_all();
+    for ( auto& t : _threads ){
+      if ( t.joinable() ){
+	t.join();
+      }
+    }
+  }
+
+  void WorkerPool::submit( const function<void()>& task ){
+    /// queue a task for the next free worker
+    {
+      lock_guard<mutex> lock( _mutex );
+      _queue.emplace_back( task, clock::now() );
+    }
+    _cond.notify_one();
+  }
+
+  size_t WorkerPool::queued() const {
+    /// return the number of tasks waiting for a worker
+    lock_guard<mutex> lock( _mutex );
+    return _queue.size();
+  }
+
+  double WorkerPool::average_wait() const {
+    /// return the average time (in milliseconds) a task waited in the queue
+    uint64_t num = _executed;
+    if ( num == 0 ){
+      return 0.0;
+    }
+    return _total_wait / 1000.0 / num;
+  }
+
+  void WorkerPool::work( size_t index, const StartHook& start ){
+    /// the main loop of every worker thread
+    /*!
+      \param index the number of this thread
+      \param start the hook to call first, if any
+    */
+    if ( start ){
+      start( index );
+    }
+    unique_lock<mutex> lock( _mutex );
+    while ( true ){
+      _cond.wait( lock, [this]{ return _stopping || !_queue.empty(); } );
+      if ( _queue.empty() ){
+	return;
+      }
+      function<void()> task = std::move( _queue.front().first );
+      uint64_t waited = chrono::duration_cast<chrono::microseconds>
+	( clock::now() - _queue.front().second ).count();
+      _queue.pop_front();
+      lock.unlock();
+      ++_executed;
+      _total_wait += waited;
+      uint64_t longest = _max_wait;
+      while ( waited > longest
+	      && !_max_wait.compare_exchange_weak( longest, waited ) ){
+      }
+      ++_busy;
+      task();
+      --_busy;
+      lock.lock();
+    }
+  }
+
+}
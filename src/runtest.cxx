@@ -29,7 +29,10 @@
 #include "config.h"
 #include <iostream>
 #include <sstream>
+#include <fstream>
 #include <unistd.h>
+#include <fcntl.h>
+#include <thread>
 #include <stdexcept>
 
 #include "ticcutils/StringOps.h"
@@ -47,6 +50,20 @@
 #include "ticcutils/json.hpp"
 #include "ticcutils/enum_flags.h"
 #include "ticcutils/XMLtools.h"
+#include "ticcutils/WorkerPool.h"
+#include "ticcutils/TimerWheel.h"
+#include "ticcutils/CpuAffinity.h"
+#include "ticcutils/FdStream.h"
+#include "ticcutils/ServerMetrics.h"
+#include "ticcutils/SocketBasics.h"
+#include "ticcutils/ClientPool.h"
+#include "ticcutils/IoRing.h"
+#include "ticcutils/ServerBase.h"
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <poll.h>
+#include <signal.h>
+#include <netinet/in.h>
 
 using namespace std;
 using namespace TiCC;
@@ -881,6 +898,1295 @@ void test_logstream( const string& path ){
   *xxDbg( ls ) << "xx_debug 5" << endl;
   string cmd = "diff /tmp/testls.1 " + path + "testls.1.ok";
   assertEqual( system( cmd.c_str() ), 0 );
+  assertFalse( LogStream::Problems() );
+}
+
+void test_logstream_blocks(){
+  ostringstream uit;
+  LogStream ls( uit, NoStamp );
+  ls.set_block_size( 4 );
+  assertEqual( ls.get_block_size(), 4 );
+  *Log( ls ) << "a line longer than 4\r" << endl;
+  *Dbg( ls ) << "not shown" << endl;
+  ls.set_level( LogDebug );
+  *Dbg( ls ) << "debug" << endl;
+  ls.set_block_size( 0 );
+  *Log( ls ) << "one\ntwo" << endl;
+  assertEqual( uit.str(), "a line longer than 4\ndebug\none\ntwo\n" );
+}
+
+void test_logstream_rotate(){
+  string dir = "/tmp/testrotate/";
+  assertTrue( createPath( dir ) );
+  for ( const auto& f : searchFiles( dir ) ){
+    erase( f );
+  }
+  LogRotation rot;
+  rot.max_size = 20;
+  rot.compress = true;
+  LogStream *ls = LogStream().create( dir + "log", rot );
+  ls->set_stamp( NoStamp );
+  *Log( ls ) << "first line, rather long" << endl;
+  *Log( ls ) << "second line" << endl;
+  *Log( ls ) << "third" << endl;
+  delete ls; // waits for the compression
+  vector<string> files = searchFiles( dir );
+  assertEqual( files.size(), 2 );
+  int zipped = 0;
+  for ( const auto& f : files ){
+    if ( match_back( f, ".gz" ) ){
+      ++zipped;
+      assertEqual( gzReadFile( f ), "first line, rather long\n" );
+    }
+  }
+  assertEqual( zipped, 1 );
+  ifstream is( dir + "log" );
+  string line;
+  getline( is, line );
+  assertEqual( line, "second line" );
+}
+
+void test_logstream_limit(){
+  ostringstream uit;
+  LogStream ls( uit, NoStamp );
+  LogLimit limit( 2 );
+  for ( int i=0; i < 5; ++i ){
+    *Log( ls, limit ) << "message " << i << endl;
+  }
+  assertEqual( limit.suppressed(), 3 );
+  assertEqual( uit.str(), "message 0\nmessage 1\n" );
+  LogLimit none( 0, 0.0 );
+  *Dbg( ls, none ) << "never" << endl;
+  assertEqual( none.suppressed(), 1 );
+  sleep( 1 ); // start a new window
+  *Log( ls, limit ) << "message 5" << endl;
+  assertEqual( limit.suppressed(), 0 );
+  assertEqual( uit.str(), "message 0\nmessage 1\n(suppressed 3 messages)\nmessage 5\n" );
+}
+
+void test_logstream_trace(){
+  ostringstream uit;
+  LogStream ls( uit, NoStamp );
+  ls.set_level( LogExtreme );
+  assertTrue( ls.set_trace_mode( 8 ) );
+  assertFalse( ls.set_trace_mode( 8 ) );
+  vector<thread> threads;
+  for ( int t=0; t < 4; ++t ){
+    threads.emplace_back( [&ls,t]{
+	LogStream sub( &ls );
+	for ( int i=0; i < 10; ++i ){
+	  *xxDbg( sub ) << t << "-" << i << endl;
+	}
+      } );
+  }
+  for ( auto& th : threads ){
+    th.join();
+  }
+  assertTrue( uit.str().empty() );
+  ls.flush_trace();
+  vector<string> lines = split_at( uit.str(), "\n" );
+  assertEqual( lines.size(), 32 ); // only the last 8 per thread survive
+  int last[4] = { 1, 1, 1, 1 };
+  for ( const auto& line : lines ){
+    vector<string> parts = split_at( line, "-" );
+    int t = stringTo<int>( parts[0] );
+    int i = stringTo<int>( parts[1] );
+    assertTrue( i > last[t] );
+    last[t] = i;
+  }
+  ls.flush_trace();
+  assertEqual( split_at( uit.str(), "\n" ).size(), 32 );
+}
+
+void test_workerpool(){
+  atomic<int> sum( 0 );
+  {
+    TiCCServer::WorkerPool pool( 3 );
+    assertEqual( pool.size(), 3 );
+    for ( int i=1; i <= 100; ++i ){
+      pool.submit( [&sum,i]{ sum += i; } );
+    }
+  } // waits for all tasks
+  assertEqual( sum.load(), 5050 );
+  // every thread runs the start hook once, with its own number
+  atomic<int> started( 0 );
+  {
+    TiCCServer::WorkerPool pool( 4, [&started]( size_t i ){
+	started |= 1 << i;
+      } );
+  }
+  assertEqual( started.load(), 15 );
+}
+
+void test_cpu_affinity(){
+  TiCCServer::CpuList cpus;
+  assertTrue( TiCCServer::parseCpuList( "0-3,8, 10-11,2", cpus ) );
+  assertEqual( cpus.size(), 7 );
+  assertEqual( TiCCServer::formatCpuList( cpus ), "0-3,8,10-11" );
+  assertFalse( TiCCServer::parseCpuList( "", cpus ) );
+  assertFalse( TiCCServer::parseCpuList( "3-1", cpus ) );
+  assertFalse( TiCCServer::parseCpuList( "1-", cpus ) );
+  assertFalse( TiCCServer::parseCpuList( "-1", cpus ) );
+  assertFalse( TiCCServer::parseCpuList( "one", cpus ) );
+  TiCCServer::CpuList online = TiCCServer::onlineCpus();
+  assertFalse( online.empty() );
+  size_t in_nodes = 0;
+  for ( const auto& node : TiCCServer::numaNodes() ){
+    assertFalse( node.empty() );
+    in_nodes += node.size();
+  }
+  assertEqual( in_nodes, online.size() );
+#ifdef HAVE_SCHED_SETAFFINITY
+  // bind a thread to one CPU, and back
+  thread pinned( [&online]{
+      assertTrue( TiCCServer::pinThread( TiCCServer::CpuList( 1, online[0] ) ) );
+      assertEqual( TiCCServer::onlineCpus().size(), 1 );
+      assertFalse( TiCCServer::pinThread( TiCCServer::CpuList() ) );
+      assertTrue( TiCCServer::pinThread( online ) );
+      assertEqual( TiCCServer::onlineCpus().size(), online.size() );
+    } );
+  pinned.join();
+#endif
+}
+
+void test_timer_wheel(){
+  // a small wheel, so timers go round more than once
+  TiCCServer::TimerWheel wheel( chrono::milliseconds( 10 ), 8 );
+  mutex m;
+  vector<int> fired;
+  auto note = [&]( int i ){
+    lock_guard<mutex> lock( m );
+    fired.push_back( i );
+    return chrono::milliseconds( 0 );
+  };
+  auto start = chrono::steady_clock::now();
+  wheel.add( chrono::milliseconds( 150 ), [&]{ return note( 3 ); } );
+  wheel.add( chrono::milliseconds( 20 ), [&]{ return note( 1 ); } );
+  wheel.add( chrono::milliseconds( 90 ), [&]{ return note( 2 ); } );
+  auto gone = wheel.add( chrono::milliseconds( 50 ),
+			 [&]{ return note( 0 ); } );
+  int runs = 0;
+  wheel.add( chrono::milliseconds( 10 ),
+	     [&]{
+	       return ( ++runs < 5 ) ? chrono::milliseconds( 10 )
+		 : chrono::milliseconds( 0 );
+	     } );
+  assertEqual( wheel.size(), 5 );
+  assertTrue( wheel.cancel( gone ) );
+  assertFalse( wheel.cancel( gone ) );
+  while ( wheel.size() > 0
+	  && chrono::steady_clock::now() - start < chrono::seconds( 2 ) ){
+    this_thread::sleep_for( chrono::milliseconds( 10 ) );
+  }
+  auto took = chrono::steady_clock::now() - start;
+  assertEqual( wheel.size(), 0 );
+  assertEqual( fired.size(), 3 );
+  assertEqual( fired[0], 1 );
+  assertEqual( fired[1], 2 );
+  assertEqual( fired[2], 3 );
+  assertEqual( runs, 5 );
+  assertTrue( took >= chrono::milliseconds( 150 ) );
+}
+
+void test_fdstream(){
+  int fds[2];
+  assertEqual( pipe( fds ), 0 );
+  string big( 20000, 'x' );
+  {
+    fdostream os( fds[1] );
+    os << "een" << endl << "twee" << endl;
+    os << big << "\n";
+    os << "drie";
+  } // flushes the rest
+  close( fds[1] );
+  fdistream is( fds[0] );
+  is.set_buffer_size( 16 );
+  string line;
+  getline( is, line );
+  assertEqual( line, "een" );
+  getline( is, line );
+  assertEqual( line, "twee" );
+  string buf( big.size(), ' ' );
+  is.read( &buf[0], big.size() );
+  assertEqual( is.gcount(), (streamsize)big.size() );
+  assertTrue( buf == big );
+  getline( is, line );
+  assertEqual( line, "" );
+  getline( is, line );
+  assertEqual( line, "drie" );
+  assertFalse( bool( getline( is, line ) ) );
+  close( fds[0] );
+}
+
+void test_nb_getline(){
+  int fds[2];
+  assertEqual( pipe( fds ), 0 );
+  fcntl( fds[0], F_SETFL, O_NONBLOCK );
+  fdistream is( fds[0] );
+  fdostream os( fds[1] );
+  thread writer( [&os]{
+      this_thread::sleep_for( chrono::milliseconds( 50 ) );
+      os << "een\ntw" << flush;
+      this_thread::sleep_for( chrono::milliseconds( 50 ) );
+      os << "ee\n" << flush;
+    } );
+  string line;
+  chrono::milliseconds timeout( 5000 );
+  assertTrue( nb_getline( is, line, timeout ) );
+  assertEqual( line, "een" );
+  assertTrue( nb_getline( is, line, timeout ) );
+  assertEqual( line, "twee" );
+  // no waiting for 100 ms steps anymore
+  assertTrue( timeout.count() > 4500 );
+  writer.join();
+  timeout = chrono::milliseconds( 20 );
+  assertFalse( nb_getline( is, line, timeout ) );
+  assertEqual( timeout.count(), 0 );
+  close( fds[1] );
+  timeout = chrono::milliseconds( 20 );
+  assertFalse( nb_getline( is, line, timeout ) );
+  close( fds[0] );
+  // a prompt on the tied stream is sent before we wait for the answer
+  assertEqual( socketpair( AF_UNIX, SOCK_STREAM, 0, fds ), 0 );
+  fcntl( fds[0], F_SETFL, O_NONBLOCK );
+  {
+    fdistream cis( fds[0] );
+    fdostream cos( fds[0] );
+    cis.tie( &cos );
+    thread peer( [&fds]{
+	fdistream pis( fds[1] );
+	fdostream pos( fds[1] );
+	string prompt;
+	if ( getline( pis, prompt, '>' ) ){
+	  pos << "yes" << prompt << endl;
+	}
+      } );
+    cos << "sure>";
+    timeout = chrono::milliseconds( 2000 );
+    assertTrue( nb_getline( cis, line, timeout ) );
+    assertEqual( line, "yessure" );
+    peer.join();
+    cos << "more>";
+    timeout = chrono::milliseconds( 2000 );
+    string answer;
+    thread reader( [&fds,&answer]{
+	fdistream pis( fds[1] );
+	fdostream pos( fds[1] );
+	if ( getline( pis, answer, '>' ) ){
+	  pos << "ok" << flush;
+	}
+      } );
+    assertTrue( nb_read( cis, line, 2, timeout ) );
+    assertEqual( line, "ok" );
+    reader.join();
+    assertEqual( answer, "more" );
+  }
+  close( fds[0] );
+  close( fds[1] );
+}
+
+void test_server_metrics(){
+  using TiCCServer::LatencyHistogram;
+  using TiCCServer::ServerMetrics;
+  // small values get a bucket of their own
+  for ( uint64_t v=0; v < 32; ++v ){
+    assertEqual( LatencyHistogram::highest_value( LatencyHistogram::index(v) ),
+		 v );
+  }
+  // larger ones are within 1/16
+  uint64_t big = 1234567;
+  uint64_t high
+    = LatencyHistogram::highest_value( LatencyHistogram::index(big) );
+  assertTrue( high >= big && high - big <= big / 16 );
+  ServerMetrics metrics;
+  assertEqual( metrics.percentile( ServerMetrics::REQUEST, 50 ), 0 );
+  thread other( [&metrics]{
+      for ( int i=1; i <= 50; ++i ){
+	metrics.record( ServerMetrics::REQUEST, chrono::microseconds( i ) );
+      }
+    } );
+  for ( int i=51; i <= 100; ++i ){
+    metrics.record( ServerMetrics::REQUEST, chrono::microseconds( i ) );
+  }
+  other.join();
+  uint64_t median = metrics.percentile( ServerMetrics::REQUEST, 50 );
+  assertTrue( median >= 50 && median <= 53 );
+  uint64_t p99 = metrics.percentile( ServerMetrics::REQUEST, 99 );
+  assertTrue( p99 >= 99 && p99 <= 103 );
+  metrics.accepted();
+  metrics.add_bytes( 10, 20 );
+  ostringstream os;
+  metrics.report( os );
+  assertTrue( os.str().find( "connections_accepted 1\n" ) != string::npos );
+  assertTrue( os.str().find( "bytes_out 20\n" ) != string::npos );
+  assertTrue( os.str().find( "request_count 100\n" ) != string::npos );
+}
+
+class PairSocket: public Sockets::Socket {
+public:
+  explicit PairSocket( int fd ){ sock = fd; };
+};
+
+void test_socket_read_timeout(){
+  int fds[2];
+  assertEqual( socketpair( AF_UNIX, SOCK_STREAM, 0, fds ), 0 );
+  PairSocket receiver( fds[0] );
+  assertTrue( receiver.setNonBlocking() );
+  thread writer( [&fds]{
+      this_thread::sleep_for( chrono::milliseconds( 20 ) );
+      assertEqual( write( fds[1], "een\ntw", 6 ), 6 );
+      this_thread::sleep_for( chrono::milliseconds( 20 ) );
+      assertEqual( write( fds[1], "ee\n", 3 ), 3 );
+    } );
+  auto start = chrono::steady_clock::now();
+  string line;
+  assertTrue( receiver.read( line, 5 ) );
+  assertEqual( line, "een" );
+  assertTrue( receiver.read( line, 5 ) );
+  assertEqual( line, "twee" );
+  // poll() returns when the data arrives, not after a sleep
+  assertTrue( chrono::steady_clock::now() - start
+	      < chrono::milliseconds( 180 ) );
+  writer.join();
+  assertFalse( receiver.read( line, 1 ) );
+  assertTrue( receiver.getMessage().find( "timed out" ) != string::npos );
+  close( fds[1] );
+}
+
+void test_socket_write(){
+  int fds[2];
+  assertEqual( socketpair( AF_UNIX, SOCK_STREAM, 0, fds ), 0 );
+  PairSocket sender( fds[0] );
+  assertTrue( sender.setNonBlocking() );
+  string head = "header\n";
+  string body( 1024*1024, 'x' );
+  size_t received = 0;
+  thread reader( [&received,&fds]{
+      char buf[65536];
+      ssize_t n;
+      while ( ( n = read( fds[1], buf, sizeof(buf) ) ) > 0 ){
+	received += n;
+      }
+    } );
+  struct iovec iov[2];
+  iov[0].iov_base = const_cast<char*>( head.data() );
+  iov[0].iov_len = head.size();
+  iov[1].iov_base = const_cast<char*>( body.data() );
+  iov[1].iov_len = body.size();
+  chrono::milliseconds timeout( 5000 );
+  assertTrue( sender.writeBuffers( iov, 2, timeout ) );
+  assertTrue( timeout.count() > 0 );
+  shutdown( fds[0], SHUT_WR );
+  reader.join();
+  assertEqual( received, head.size() + body.size() );
+  close( fds[1] );
+  // nobody reads: the time is up
+  assertEqual( socketpair( AF_UNIX, SOCK_STREAM, 0, fds ), 0 );
+  PairSocket blocked( fds[0] );
+  assertTrue( blocked.setNonBlocking() );
+  auto start = chrono::steady_clock::now();
+  assertFalse( blocked.write( body + body, 1 ) );
+  auto took = chrono::steady_clock::now() - start;
+  assertTrue( took >= chrono::milliseconds( 990 ) );
+  assertTrue( took < chrono::milliseconds( 1500 ) );
+  assertFalse( blocked.isValid() );
+  close( fds[1] );
+}
+
+void test_send_file(){
+  string name = "/tmp/runtest.sendfile." + toString( getpid() );
+  string data;
+  for ( int i=0; i < 100000; ++i ){
+    data += toString( i ) + "\n";
+  }
+  {
+    ofstream os( name );
+    os << data;
+  }
+  int file = open( name.c_str(), O_RDONLY );
+  assertTrue( file >= 0 );
+  int fds[2];
+  assertEqual( socketpair( AF_UNIX, SOCK_STREAM, 0, fds ), 0 );
+  PairSocket sender( fds[0] );
+  assertTrue( sender.setNonBlocking() );
+  string received;
+  thread reader( [&received,&fds]{
+      char buf[65536];
+      ssize_t n;
+      while ( ( n = read( fds[1], buf, sizeof(buf) ) ) > 0 ){
+	received.append( buf, n );
+      }
+    } );
+  // a region in the middle
+  chrono::milliseconds timeout( 5000 );
+  assertTrue( sender.sendFile( file, 1000, data.size() - 2000, timeout ) );
+  assertTrue( timeout.count() > 0 );
+  shutdown( fds[0], SHUT_WR );
+  reader.join();
+  assertTrue( received == data.substr( 1000, data.size() - 2000 ) );
+  close( fds[1] );
+  // nobody reads: the time is up
+  assertEqual( socketpair( AF_UNIX, SOCK_STREAM, 0, fds ), 0 );
+  PairSocket blocked( fds[0] );
+  assertTrue( blocked.setNonBlocking() );
+  timeout = chrono::milliseconds( 100 );
+  assertFalse( blocked.sendFile( file, 0, data.size(), timeout ) );
+  assertEqual( timeout.count(), 0 );
+  assertFalse( blocked.isValid() );
+  close( fds[1] );
+  close( file );
+  erase( name );
+  // sendfile() can't read from /proc files, so these are copied with pread()
+  file = open( "/proc/self/cmdline", O_RDONLY );
+  if ( file >= 0 ){
+    char buf[4096];
+    ssize_t len = pread( file, buf, sizeof(buf), 0 );
+    assertTrue( len > 2 );
+    assertEqual( socketpair( AF_UNIX, SOCK_STREAM, 0, fds ), 0 );
+    PairSocket copier( fds[0] );
+    timeout = chrono::milliseconds( 5000 );
+    assertTrue( copier.sendFile( file, 1, len - 1, timeout ) );
+    char copy[4096];
+    assertEqual( read( fds[1], copy, sizeof(copy) ), len - 1 );
+    assertTrue( string( copy, len - 1 ) == string( buf + 1, len - 1 ) );
+    close( fds[1] );
+    close( file );
+  }
+}
+
+void test_frames(){
+  int fds[2];
+  assertEqual( socketpair( AF_UNIX, SOCK_STREAM, 0, fds ), 0 );
+  PairSocket sender( fds[0] );
+  PairSocket receiver( fds[1] );
+  string binary( "een\0twee\ndrie", 14 );
+  string big( 1000000, 'x' );
+  thread writer( [&]{
+      sender.writeFrame( binary );
+      sender.writeFrame( "" );
+      sender.writeFrame( big );
+      sender.writeFrame( string( 2000, 'y' ) );
+    } );
+  string frame;
+  assertTrue( receiver.readFrame( frame ) );
+  assertEqual( frame.size(), binary.size() );
+  assertTrue( frame == binary );
+  assertTrue( receiver.readFrame( frame ) );
+  assertEqual( frame, "" );
+  assertTrue( receiver.readFrame( frame ) );
+  assertTrue( frame == big );
+  // too large: the connection is given up
+  assertFalse( receiver.readFrame( frame, 1000 ) );
+  assertFalse( receiver.isValid() );
+  writer.join();
+  char head[Sockets::frame_header_size];
+  Sockets::encodeFrameLength( head, 258 );
+  assertEqual( head[2], 1 );
+  assertEqual( head[3], 2 );
+  assertEqual( Sockets::decodeFrameLength( head ), 258 );
+}
+
+class EchoHttp: public TiCCServer::HttpServerBase {
+public:
+  explicit EchoHttp( const TiCC::Configuration *c ):
+    HttpServerBase( c, 0 ){};
+  void http_request( TiCCServer::childArgs *,
+		     const TiCCServer::HttpRequest& request,
+		     TiCCServer::HttpResponse& response ) override {
+    if ( request.target.compare( 0, 6, "/file/" ) == 0 ){
+      response.file = request.target.substr( 5 );
+    }
+    else {
+      response.body = request.method + " " + request.target + " "
+	+ request.body;
+    }
+  }
+};
+
+class PairClient: public Sockets::ClientSocket {
+public:
+  explicit PairClient( int fd ){ sock = fd; };
+};
+
+class LineServer: public TiCCServer::TcpServerBase {
+  // collects the lines it gets in event mode
+public:
+  explicit LineServer( const TiCC::Configuration *c ):
+    TcpServerBase( c, 0 ){};
+  void callback( TiCCServer::childArgs * ) override {};
+  void line_callback( TiCCServer::eventArgs *,
+		      const string& line ) override {
+    lines.push_back( line );
+  };
+  vector<string> lines;
+};
+
+void test_event_lines(){
+  TiCC::Configuration *config = new TiCC::Configuration();
+  config->setatt( "port", "1" );
+  config->setatt( "max_line", "10" );
+  LineServer server( config );
+  int fds[2];
+  assertEqual( socketpair( AF_UNIX, SOCK_STREAM, 0, fds ), 0 );
+  {
+    TiCCServer::eventArgs args( &server, new PairClient( fds[0] ) );
+    args.input() = "abc";
+    server.event_input( &args );
+    assertEqual( server.lines.size(), 0 );
+    args.input() += "def\r\ngh";
+    server.event_input( &args );
+    assertEqual( server.lines.size(), 1 );
+    assertEqual( server.lines[0], "abcdef" );
+    assertEqual( args.input(), "gh" );
+    assertFalse( args.closing() );
+    // a partial line may not grow endlessly
+    args.input() += string( 9, 'x' );
+    server.event_input( &args );
+    assertTrue( args.closing() );
+    assertEqual( args.input(), "" );
+    assertEqual( server.lines.size(), 1 );
+  }
+  {
+    // neither may a complete one
+    TiCCServer::eventArgs args( &server, new PairClient( fds[1] ) );
+    args.input() = string( 11, 'y' ) + "\nshort\n";
+    server.event_input( &args );
+    assertTrue( args.closing() );
+    assertEqual( server.lines.size(), 1 );
+  }
+}
+
+static string http_exchange( const string& input,
+			     const string& max_body = "" ){
+  // serve one connection with input from the client, and return the output
+  TiCC::Configuration *config = new TiCC::Configuration();
+  config->setatt( "port", "1" );
+  config->setatt( "http_timeout", "1" );
+  if ( !max_body.empty() ){
+    config->setatt( "http_max_body", max_body );
+  }
+  EchoHttp server( config );
+  int fds[2];
+  assertEqual( socketpair( AF_UNIX, SOCK_STREAM, 0, fds ), 0 );
+  assertEqual( write( fds[1], input.data(), input.size() ),
+	       ssize_t(input.size()) );
+  shutdown( fds[1], SHUT_WR );
+  {
+    // the connection is closed when args is destroyed
+    TiCCServer::childArgs args( &server, new PairClient( fds[0] ) );
+    args.socket()->setNonBlocking();
+    server.callback( &args );
+  }
+  string output;
+  char buf[4096];
+  ssize_t n;
+  while ( ( n = read( fds[1], buf, sizeof(buf) ) ) > 0 ){
+    output.append( buf, n );
+  }
+  close( fds[1] );
+  return output;
+}
+
+static size_t count_of( const string& text, const string& what ){
+  size_t result = 0;
+  for ( size_t pos = text.find( what ); pos != string::npos;
+	pos = text.find( what, pos + 1 ) ){
+    ++result;
+  }
+  return result;
+}
+
+void test_http_server(){
+  // two requests in one write: both answered, in order
+  string out = http_exchange( "GET /a HTTP/1.1\r\nHost: x\r\n\r\n"
+			      "POST /b HTTP/1.1\r\nContent-Length: 3\r\n"
+			      "\r\nabc" );
+  assertEqual( count_of( out, "HTTP/1.1 200 OK" ), 2 );
+  assertEqual( count_of( out, "Connection: keep-alive" ), 2 );
+  assertTrue( out.find( "GET /a " ) < out.find( "POST /b abc" ) );
+  assertTrue( out.find( "POST /b abc" ) != string::npos );
+  // HTTP/1.1 closes on request
+  out = http_exchange( "GET /a HTTP/1.1\r\nConnection: close\r\n\r\n"
+		       "GET /b HTTP/1.1\r\n\r\n" );
+  assertEqual( count_of( out, "HTTP/1.1 200 OK" ), 1 );
+  assertEqual( count_of( out, "Connection: close" ), 1 );
+  // HTTP/1.0 closes, unless asked to keep the connection
+  out = http_exchange( "GET /a HTTP/1.0\r\n\r\nGET /b HTTP/1.0\r\n\r\n" );
+  assertEqual( count_of( out, "HTTP/1.1 200 OK" ), 1 );
+  assertEqual( count_of( out, "Connection: close" ), 1 );
+  out = http_exchange( "GET /a HTTP/1.0\r\nConnection: keep-alive\r\n\r\n"
+		       "GET /b HTTP/1.0\r\nConnection: Keep-Alive\r\n\r\n" );
+  assertEqual( count_of( out, "HTTP/1.1 200 OK" ), 2 );
+  // errors end the connection
+  out = http_exchange( "NONSENSE\r\n\r\nGET /b HTTP/1.1\r\n\r\n" );
+  assertEqual( count_of( out, "HTTP/1.1 400 Bad Request" ), 1 );
+  assertEqual( count_of( out, "HTTP/1.1 " ), 1 );
+  out = http_exchange( "GET /a HTTP/2.0\r\n\r\n" );
+  assertEqual( count_of( out, "HTTP/1.1 505 " ), 1 );
+  // a body that is too large is not read at all
+  out = http_exchange( "POST /a HTTP/1.1\r\n"
+		       "Content-Length: 999999999999999\r\n\r\n" );
+  assertEqual( count_of( out, "HTTP/1.1 413 Payload Too Large" ), 1 );
+  out = http_exchange( "POST /a HTTP/1.1\r\nContent-Length: 11\r\n\r\n"
+		       "hello world", "10" );
+  assertEqual( count_of( out, "HTTP/1.1 413 " ), 1 );
+  out = http_exchange( "POST /a HTTP/1.1\r\nContent-Length: 10\r\n\r\n"
+		       "helloworld", "10" );
+  assertEqual( count_of( out, "POST /a helloworld" ), 1 );
+  // a chunked body is not supported, and ends the connection
+  out = http_exchange( "POST /a HTTP/1.1\r\nTransfer-Encoding: chunked\r\n"
+		       "\r\n5\r\nhello\r\n0\r\n\r\nGET /b HTTP/1.1\r\n\r\n" );
+  assertEqual( count_of( out, "HTTP/1.1 501 Not Implemented" ), 1 );
+  assertEqual( count_of( out, "Connection: close" ), 1 );
+  assertEqual( count_of( out, "HTTP/1.1 " ), 1 );
+  // and so are endless lines
+  out = http_exchange( "GET /" + string( 10000, 'a' ) + " HTTP/1.1\r\n\r\n" );
+  assertEqual( count_of( out, "HTTP/1.1 414 " ), 1 );
+  out = http_exchange( "GET / HTTP/1.1\r\nX-Big: " + string( 10000, 'b' )
+		       + "\r\n\r\n" );
+  assertEqual( count_of( out, "HTTP/1.1 431 " ), 1 );
+}
+
+void test_http_file(){
+  string name = "/tmp/runtest.httpfile." + toString( getpid() );
+  string data( 50000, 'f' ); // fits in the socket buffer
+  {
+    ofstream os( name );
+    os << data;
+  }
+  string out = http_exchange( "GET /file" + name + " HTTP/1.1\r\n\r\n" );
+  assertEqual( count_of( out, "HTTP/1.1 200 OK" ), 1 );
+  assertEqual( count_of( out, "Content-Length: 50000\r\n" ), 1 );
+  assertTrue( out.size() > data.size()
+	      && out.substr( out.size() - data.size() ) == data );
+  // and straight from childArgs
+  TiCC::Configuration *config = new TiCC::Configuration();
+  config->setatt( "port", "1" );
+  EchoHttp server( config );
+  int fds[2];
+  assertEqual( socketpair( AF_UNIX, SOCK_STREAM, 0, fds ), 0 );
+  string received;
+  thread reader( [&received,&fds]{
+      char buf[65536];
+      ssize_t n;
+      while ( ( n = read( fds[1], buf, sizeof(buf) ) ) > 0 ){
+	received.append( buf, n );
+      }
+    } );
+  {
+    TiCCServer::childArgs args( &server, new PairClient( fds[0] ) );
+    args.os() << "head:";
+    assertTrue( args.sendFile( name ) );
+  }
+  reader.join();
+  assertTrue( received == "head:" + data );
+  close( fds[1] );
+  erase( name );
+}
+
+void test_client_pool(){
+  Sockets::ServerSocket server;
+  assertTrue( server.connect( "0", false, "127.0.0.1" ) );
+  assertTrue( server.listen( 5 ) );
+  struct sockaddr_storage addr;
+  socklen_t len = sizeof(addr);
+  getsockname( server.getSockId(), (struct sockaddr*)&addr, &len );
+  string port = toString( ntohs( ((struct sockaddr_in*)&addr)->sin_port ) );
+  Sockets::ClientPool pool;
+  string mess;
+  Sockets::ClientSocket *c1 = pool.acquire( "127.0.0.1", port, mess );
+  assertTrue( c1 != 0 );
+  Sockets::ClientSocket peer;
+  assertTrue( server.accept( peer, false ) );
+  assertTrue( c1->write( "een\n" ) );
+  string line;
+  assertTrue( peer.read( line ) );
+  assertEqual( line, "een" );
+  pool.release( c1 );
+  assertEqual( pool.idle(), 1 );
+  // the same connection again
+  Sockets::ClientSocket *c2 = pool.acquire( "127.0.0.1", port, mess );
+  assertEqual( c2, c1 );
+  assertEqual( pool.reuses(), 1 );
+  pool.release( c2 );
+  // the server closes it. The pool notices, and connects again
+  shutdown( peer.getSockId(), SHUT_RDWR );
+  Sockets::ClientSocket *c3 = pool.acquire( "127.0.0.1", port, mess );
+  assertTrue( c3 != 0 );
+  assertEqual( pool.connects(), 2 );
+  pool.release( c3, false );
+  assertEqual( pool.idle(), 0 );
+  assertTrue( pool.acquire( "127.0.0.1", "0", mess ) == 0 );
+  assertFalse( mess.empty() );
+}
+
+static string local_port( const Sockets::ServerSocket& server ){
+  struct sockaddr_storage addr;
+  socklen_t len = sizeof(addr);
+  getsockname( server.getSockId(), (struct sockaddr*)&addr, &len );
+  return toString( ntohs( ((struct sockaddr_in*)&addr)->sin_port ) );
+}
+
+void test_connect_timeout(){
+  Sockets::ServerSocket server;
+  assertTrue( server.connect( "0", false, "127.0.0.1" ) );
+  assertTrue( server.listen( 5 ) );
+  string port = local_port( server );
+  // bound, but not listening: refused
+  Sockets::ServerSocket closed;
+  assertTrue( closed.connect( "0", false, "127.0.0.1" ) );
+  string closed_port = local_port( closed );
+  chrono::milliseconds timeout( 2000 );
+  Sockets::ClientSocket client;
+  assertTrue( client.connect( "127.0.0.1", port, timeout ) );
+  Sockets::ClientSocket peer;
+  assertTrue( server.accept( peer, false ) );
+  // blocking again, so a plain read waits for the data
+  assertTrue( peer.write( "hallo\n" ) );
+  string line;
+  assertTrue( client.read( line ) );
+  assertEqual( line, "hallo" );
+  auto start = chrono::steady_clock::now();
+  Sockets::ClientSocket refused;
+  assertFalse( refused.connect( "127.0.0.1", closed_port, timeout ) );
+  assertFalse( refused.isValid() );
+  assertTrue( chrono::steady_clock::now() - start < timeout );
+  // a dead address is skipped
+  vector<Sockets::Address> addresses;
+  string mess;
+  assertTrue( Sockets::resolveAddress( "127.0.0.1", closed_port,
+				       addresses, mess ) );
+  vector<Sockets::Address> good;
+  assertTrue( Sockets::resolveAddress( "127.0.0.1", port, good, mess ) );
+  addresses.insert( addresses.end(), good.begin(), good.end() );
+  Sockets::ClientSocket second;
+  assertTrue( second.connect( addresses, timeout ) );
+  assertFalse( Sockets::resolveAddress( "no.such.host.invalid", port,
+					addresses, mess ) );
+  // the first backend that answers
+  Sockets::ClientSocket any;
+  vector<pair<string,string>> backends = { { "127.0.0.1", closed_port },
+					   { "no.such.host.invalid", port },
+					   { "127.0.0.1", port } };
+  assertEqual( any.connectFirst( backends, timeout ), 2 );
+  assertTrue( any.isValid() );
+  backends.pop_back();
+  assertEqual( any.connectFirst( backends, timeout ), -1 );
+  assertFalse( any.isValid() );
+}
+
+void test_unix_socket(){
+  string path = "/tmp/runtest." + toString( getpid() ) + ".sock";
+  Sockets::ServerSocket server;
+  assertTrue( server.connectUnix( path ) );
+  assertTrue( server.listen( 5 ) );
+  Sockets::ClientPool pool;
+  string mess;
+  Sockets::ClientSocket *client = pool.acquire( path, "", mess );
+  assertTrue( client != 0 );
+  Sockets::ClientSocket peer;
+  assertTrue( server.accept( peer ) );
+  assertEqual( peer.getClientName(), "local:" + path );
+  fdostream os( peer.getSockId() );
+  os << "hello" << endl;
+  string line;
+  assertTrue( client->read( line ) );
+  assertEqual( line, "hello" );
+  pool.release( client );
+  Sockets::ServerSocket second;
+  assertFalse( second.connectUnix( path ) ); // in use
+}
+
+class QueueServer: public TiCCServer::ServerBase {
+  // every connection is told its turn, and is held until it sends a line
+public:
+  explicit QueueServer( const TiCC::Configuration *c ):
+    ServerBase( c, 0 ), _accepted( 0 ), _served( 0 ){};
+  int priority( const Sockets::ClientSocket * ) override {
+    // later connections go first
+    return _accepted++;
+  };
+  void callback( TiCCServer::childArgs *args ) override {
+    args->os() << "served " << _served++ << endl;
+    string line;
+    getline( args->is(), line );
+  };
+private:
+  std::atomic<int> _accepted;
+  std::atomic<int> _served;
+};
+
+static pid_t fork_server( const function<TiCCServer::ServerBase*
+			  ( const TiCC::Configuration * )>& make,
+			  const map<string,string>& settings ){
+  // run a server in a child process, without a log and stderr
+  pid_t pid = fork();
+  if ( pid == 0 ){
+    int null = open( "/dev/null", O_WRONLY );
+    dup2( null, 2 );
+    int result = EXIT_FAILURE;
+    try {
+      TiCC::Configuration *config = new TiCC::Configuration();
+      config->setatt( "drain_timeout", "1" );
+      config->setatt( "daemonize", "no" );
+      config->setatt( "logfile", "/dev/null" );
+      for ( const auto& it : settings ){
+	config->setatt( it.first, it.second );
+      }
+      unique_ptr<TiCCServer::ServerBase> server( make( config ) );
+      if ( server ){
+	result = server->Run();
+      }
+    }
+    catch ( ... ){
+    }
+    _exit( result );
+  }
+  return pid;
+}
+
+static pid_t start_queue_server( const string& path,
+				 const string& queue_size,
+				 const string& queue_timeout ){
+  // run a QueueServer with maxconn=1 in a child process
+  return fork_server( []( const TiCC::Configuration *c ){
+      return new QueueServer( c );
+    },
+    { { "unix_socket", path }, { "maxconn", "1" },
+      { "queue_size", queue_size }, { "queue_timeout", queue_timeout } } );
+}
+
+static Sockets::ClientSocket *server_client( const string& where ){
+  // connect to a Unix socket file, or to a port on this host, and wait
+  // for the server to come up when needed
+  for ( int i=0; i < 100; ++i ){
+    Sockets::ClientSocket *client = new Sockets::ClientSocket();
+    bool ok = where[0] == '/'
+      ? client->connectUnix( where )
+      : client->connect( "127.0.0.1", where );
+    if ( ok && client->setNonBlocking() ){
+      return client;
+    }
+    delete client;
+    this_thread::sleep_for( chrono::milliseconds(20) );
+  }
+  return 0;
+}
+
+static bool stop_server( pid_t pid ){
+  int status = 0;
+  kill( pid, SIGTERM );
+  return waitpid( pid, &status, 0 ) == pid
+    && WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS;
+}
+
+void test_admission_queue(){
+  const string reject = "Maximum connections exceeded.";
+  string base = "/tmp/runtest." + toString( getpid() ) + ".queue";
+  string line;
+  {
+    // the waiting connection with the highest priority goes first
+    string path = base + "1";
+    pid_t pid = start_queue_server( path, "2", "5000" );
+    unique_ptr<Sockets::ClientSocket> held( server_client( path ) );
+    assertTrue( held != nullptr );
+    assertTrue( held->read( line, 2 ) );
+    assertEqual( line, "served 0" );
+    unique_ptr<Sockets::ClientSocket> low( server_client( path ) );
+    unique_ptr<Sockets::ClientSocket> high( server_client( path ) );
+    // the queue is full now
+    unique_ptr<Sockets::ClientSocket> full( server_client( path ) );
+    assertTrue( full->read( line, 2 ) );
+    assertEqual( line, reject );
+    assertTrue( held->write( "bye\n" ) );
+    assertTrue( high->read( line, 2 ) );
+    assertEqual( line, "served 1" );
+    assertTrue( high->write( "bye\n" ) );
+    assertTrue( low->read( line, 2 ) );
+    assertEqual( line, "served 2" );
+    assertTrue( low->write( "bye\n" ) );
+    held.reset();
+    low.reset();
+    high.reset();
+    full.reset();
+    assertTrue( stop_server( pid ) );
+  }
+  {
+    // a connection waits at most queue_timeout for a slot
+    string path = base + "2";
+    pid_t pid = start_queue_server( path, "1", "300" );
+    unique_ptr<Sockets::ClientSocket> held( server_client( path ) );
+    assertTrue( held != nullptr );
+    assertTrue( held->read( line, 2 ) );
+    assertEqual( line, "served 0" );
+    auto start = chrono::steady_clock::now();
+    unique_ptr<Sockets::ClientSocket> late( server_client( path ) );
+    assertTrue( late->read( line, 2 ) );
+    assertEqual( line, reject );
+    assertTrue( chrono::steady_clock::now() - start
+		>= chrono::milliseconds(250) );
+    assertTrue( held->write( "bye\n" ) );
+    held.reset();
+    late.reset();
+    assertTrue( stop_server( pid ) );
+  }
+  {
+    // without a queue, a busy server refuses at once
+    string path = base + "3";
+    pid_t pid = start_queue_server( path, "0", "5000" );
+    unique_ptr<Sockets::ClientSocket> held( server_client( path ) );
+    assertTrue( held != nullptr );
+    assertTrue( held->read( line, 2 ) );
+    assertEqual( line, "served 0" );
+    auto start = chrono::steady_clock::now();
+    unique_ptr<Sockets::ClientSocket> refused( server_client( path ) );
+    assertTrue( refused->read( line, 2 ) );
+    assertEqual( line, reject );
+    assertTrue( chrono::steady_clock::now() - start
+		< chrono::milliseconds(1000) );
+    assertTrue( held->write( "bye\n" ) );
+    held.reset();
+    refused.reset();
+    assertTrue( stop_server( pid ) );
+  }
+}
+
+void test_worker_pool(){
+  // with more connections than workers, the others wait for a worker
+  string path = "/tmp/runtest." + toString( getpid() ) + ".workers";
+  pid_t pid = fork_server( []( const TiCC::Configuration *c ){
+      return new QueueServer( c );
+    },
+    { { "unix_socket", path }, { "maxconn", "4" }, { "workers", "2" } } );
+  string line;
+  unique_ptr<Sockets::ClientSocket> first( server_client( path ) );
+  assertTrue( first != nullptr );
+  assertTrue( first->read( line, 2 ) );
+  assertEqual( line, "served 0" );
+  unique_ptr<Sockets::ClientSocket> second( server_client( path ) );
+  assertTrue( second != nullptr );
+  assertTrue( second->read( line, 2 ) );
+  assertEqual( line, "served 1" );
+  unique_ptr<Sockets::ClientSocket> third( server_client( path ) );
+  assertTrue( third != nullptr );
+  // accepted, but not served, and not refused
+  assertFalse( third->read( line, 1 ) );
+  assertTrue( first->write( "bye\n" ) );
+  assertTrue( third->read( line, 2 ) );
+  assertEqual( line, "served 2" );
+  assertTrue( second->write( "bye\n" ) );
+  assertTrue( third->write( "bye\n" ) );
+  first.reset();
+  second.reset();
+  third.reset();
+  assertTrue( stop_server( pid ) );
+}
+
+void test_acceptors(){
+  // several acceptors, on one socket or each on its own port socket
+  string path = "/tmp/runtest." + toString( getpid() ) + ".acceptors";
+  string port = toString( 30000 + getpid() % 20000 );
+  vector<map<string,string>> setups
+    = { { { "unix_socket", path }, { "acceptors", "2" } },
+	{ { "port", port }, { "acceptors", "2" }, { "reuseport", "yes" } } };
+  for ( auto& settings : setups ){
+    settings["maxconn"] = "8";
+    pid_t pid = fork_server( []( const TiCC::Configuration *c ){
+	return new QueueServer( c );
+      },
+      settings );
+    string where = settings.count( "port" ) ? port : path;
+    vector<unique_ptr<Sockets::ClientSocket>> clients;
+    for ( int i=0; i < 6; ++i ){
+      clients.emplace_back( server_client( where ) );
+      assertTrue( clients.back() != nullptr );
+    }
+    set<string> served;
+    string line;
+    for ( const auto& client : clients ){
+      assertTrue( client->read( line, 2 ) );
+      served.insert( line );
+    }
+    assertEqual( served.size(), 6 );
+    for ( const auto& client : clients ){
+      assertTrue( client->write( "bye\n" ) );
+    }
+    clients.clear();
+    assertTrue( stop_server( pid ) );
+  }
+}
+
+class ReloadServer: public TiCCServer::ServerBase {
+  // tells every connection the settings in use, and holds it for a line
+public:
+  explicit ReloadServer( const TiCC::Configuration *c ):
+    ServerBase( c, 0 ){};
+  void callback( TiCCServer::childArgs *args ) override {
+    args->os() << "maxconn=" << maxConn()
+	       << " debug=" << doDebug() << endl;
+    string line;
+    getline( args->is(), line );
+  };
+};
+
+void test_reload(){
+  string path = "/tmp/runtest." + toString( getpid() ) + ".reload";
+  string name = "runtest." + toString( getpid() ) + ".conf";
+  auto write_config = [&]( const string& max_conn ){
+    ofstream os( "/tmp/" + name );
+    os << "unix_socket=" << path << endl
+       << "maxconn=" << max_conn << endl
+       << "workers=4" << endl
+       << "queue_size=1" << endl
+       << "queue_timeout=5000" << endl
+       << "debug=no" << endl
+       << "daemonize=no" << endl
+       << "logfile=/dev/null" << endl
+       << "drain_timeout=1" << endl;
+  };
+  write_config( "1" );
+  pid_t pid = fork_server( [&]( const TiCC::Configuration *c )
+			   -> TiCCServer::ServerBase* {
+      // a relative config file and a command line override, like a
+      // dæmon started by hand, which then moves to /
+      delete c;
+      TiCC::CL_Options opts;
+      opts.init( "--config=" + name + " --debug=yes" );
+      if ( chdir( "/tmp" ) != 0 ){
+	return 0;
+      }
+      TiCC::Configuration *config = TiCCServer::initServerConfig( opts );
+      if ( !config || chdir( "/" ) != 0 ){
+	return 0;
+      }
+      return new ReloadServer( config );
+    },
+    {} );
+  string line;
+  unique_ptr<Sockets::ClientSocket> first( server_client( path ) );
+  assertTrue( first != nullptr );
+  assertTrue( first->read( line, 2 ) );
+  assertEqual( line, "maxconn=1 debug=1" );
+  unique_ptr<Sockets::ClientSocket> second( server_client( path ) );
+  assertTrue( second != nullptr );
+  assertFalse( second->read( line, 1 ) );
+  // a larger maxconn takes effect, and starts the waiting connection.
+  // --debug survives the reload
+  write_config( "2" );
+  kill( pid, SIGHUP );
+  assertTrue( second->read( line, 2 ) );
+  assertEqual( line, "maxconn=2 debug=1" );
+  assertTrue( first->write( "bye\n" ) );
+  assertTrue( second->write( "bye\n" ) );
+  first.reset();
+  second.reset();
+  assertTrue( stop_server( pid ) );
+  remove( ("/tmp/" + name).c_str() );
+}
+
+static string read_all( Sockets::ClientSocket *client ){
+  // everything the server sends, until it closes the connection
+  string result;
+  auto deadline = chrono::steady_clock::now() + chrono::seconds(5);
+  while ( chrono::steady_clock::now() < deadline ){
+    struct pollfd pfd;
+    pfd.fd = client->getSockId();
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    poll( &pfd, 1, 100 );
+    char buf[4096];
+    ssize_t n = read( client->getSockId(), buf, sizeof(buf) );
+    if ( n == 0 ){
+      break;
+    }
+    if ( n > 0 ){
+      result.append( buf, n );
+    }
+  }
+  return result;
+}
+
+static string http_event_exchange( const string& path,
+				   const vector<string>& parts ){
+  // send a request in parts to a HTTP server in event mode
+  unique_ptr<Sockets::ClientSocket> client( server_client( path ) );
+  if ( !client ){
+    return "";
+  }
+  for ( const auto& part : parts ){
+    client->write( part );
+    this_thread::sleep_for( chrono::milliseconds(20) );
+  }
+  return read_all( client.get() );
+}
+
+void test_http_events(){
+  string path = "/tmp/runtest." + toString( getpid() ) + ".http";
+  string name = "/tmp/runtest.httpevent." + toString( getpid() );
+  {
+    ofstream os( name );
+    os << "from a file";
+  }
+  pid_t pid = fork_server( []( const TiCC::Configuration *c ){
+      return new EchoHttp( c );
+    },
+    { { "unix_socket", path }, { "iomode", "epoll" },
+      { "http_max_body", "10" } } );
+  // pipelined requests, and a body that arrives in pieces
+  string out = http_event_exchange( path,
+				    { "GET /a HTTP/1.1\r\n\r\nPOST /b HTTP/1.1\r\n"
+				      "Content-Length: 5\r\n\r\nhel",
+				      "lo\r\nGET /file" + name + " HTTP/1.1\r\n",
+				      "Connection: close\r\n\r\n" } );
+  assertEqual( count_of( out, "HTTP/1.1 200 OK" ), 3 );
+  assertEqual( count_of( out, "GET /a " ), 1 );
+  assertEqual( count_of( out, "POST /b hello" ), 1 );
+  assertEqual( count_of( out, "from a file" ), 1 );
+  assertEqual( count_of( out, "Connection: close" ), 1 );
+  // HTTP/1.0 closes by default
+  out = http_event_exchange( path, { "GET /a HTTP/1.0\r\n\r\n" } );
+  assertEqual( count_of( out, "HTTP/1.1 200 OK" ), 1 );
+  assertEqual( count_of( out, "Connection: close" ), 1 );
+  // errors end the connection
+  out = http_event_exchange( path, { "POST /a HTTP/1.1\r\n"
+				     "Content-Length: 11\r\n\r\n" } );
+  assertEqual( count_of( out, "HTTP/1.1 413 " ), 1 );
+  out = http_event_exchange( path, { "POST /a HTTP/1.1\r\n"
+				     "Transfer-Encoding: chunked\r\n\r\n" } );
+  assertEqual( count_of( out, "HTTP/1.1 501 " ), 1 );
+  out = http_event_exchange( path, { "GET /" + string( 10000, 'a' ) } );
+  assertEqual( count_of( out, "HTTP/1.1 414 " ), 1 );
+  out = http_event_exchange( path, { "GET / HTTP/1.1\r\nX-Big: ",
+				     string( 10000, 'b' ) } );
+  assertEqual( count_of( out, "HTTP/1.1 431 " ), 1 );
+  out = http_event_exchange( path, { "GET / HTTP/3\r\n\r\n" } );
+  assertEqual( count_of( out, "HTTP/1.1 505 " ), 1 );
+  assertTrue( stop_server( pid ) );
+  remove( name.c_str() );
+}
+
+void test_idle_timeout(){
+  // a silent client is cut off, and its slot goes to the next one
+  string base = "/tmp/runtest." + toString( getpid() ) + ".idle";
+  {
+    string path = base + "1";
+    pid_t pid = fork_server( []( const TiCC::Configuration *c ){
+	return new QueueServer( c );
+      },
+      { { "unix_socket", path }, { "maxconn", "1" },
+	{ "idle_timeout", "1" } } );
+    string line;
+    unique_ptr<Sockets::ClientSocket> silent( server_client( path ) );
+    assertTrue( silent != nullptr );
+    assertTrue( silent->read( line, 2 ) );
+    assertEqual( line, "served 0" );
+    auto start = chrono::steady_clock::now();
+    assertEqual( read_all( silent.get() ), "" );
+    auto waited = chrono::steady_clock::now() - start;
+    assertTrue( waited >= chrono::milliseconds(900) );
+    assertTrue( waited < chrono::seconds(3) );
+    unique_ptr<Sockets::ClientSocket> next( server_client( path ) );
+    assertTrue( next->read( line, 2 ) );
+    assertEqual( line, "served 1" );
+    assertTrue( next->write( "bye\n" ) );
+    silent.reset();
+    next.reset();
+    assertTrue( stop_server( pid ) );
+  }
+  {
+    // the same in event mode
+    string path = base + "2";
+    pid_t pid = fork_server( []( const TiCC::Configuration *c ){
+	return new EchoHttp( c );
+      },
+      { { "unix_socket", path }, { "maxconn", "1" }, { "iomode", "epoll" },
+	{ "idle_timeout", "1" } } );
+    unique_ptr<Sockets::ClientSocket> silent( server_client( path ) );
+    assertTrue( silent != nullptr );
+    auto start = chrono::steady_clock::now();
+    assertEqual( read_all( silent.get() ), "" );
+    auto waited = chrono::steady_clock::now() - start;
+    assertTrue( waited >= chrono::milliseconds(900) );
+    assertTrue( waited < chrono::seconds(3) );
+    string out = http_event_exchange( path, { "GET /a HTTP/1.0\r\n\r\n" } );
+    assertEqual( count_of( out, "HTTP/1.1 200 OK" ), 1 );
+    silent.reset();
+    assertTrue( stop_server( pid ) );
+  }
+}
+
+void test_io_ring(){
+  if ( !IoRing::available() ){
+    return;
+  }
+  assertTrue( IoRing::setBackend( "io_uring" ) );
+  assertTrue( IoRing::active() );
+  assertFalse( IoRing::setBackend( "ring" ) );
+  int fds[2];
+  assertEqual( pipe( fds ), 0 );
+  {
+    fdostream os( fds[1] );
+    os << "via de ring" << endl;
+  }
+  close( fds[1] );
+  {
+    fdistream is( fds[0] );
+    string line;
+    assertTrue( getline( is, line ).good() );
+    assertEqual( line, "via de ring" );
+  }
+  close( fds[0] );
+  // non-blocking still works
+  assertEqual( socketpair( AF_UNIX, SOCK_STREAM, 0, fds ), 0 );
+  PairSocket sender( fds[0] );
+  assertTrue( sender.setNonBlocking() );
+  char c;
+  assertEqual( IoRing::read( fds[0], &c, 1 ), -1 );
+  assertEqual( errno, EAGAIN );
+  // also when the caller tells the status
+  assertEqual( IoRing::read( fds[0], &c, 1, true ), -1 );
+  assertEqual( errno, EAGAIN );
+  assertEqual( IoRing::send( fds[0], &c, 0, MSG_DONTWAIT ), 0 );
+  string body( 100000, 'x' );
+  struct iovec iov[1];
+  iov[0].iov_base = const_cast<char*>( body.data() );
+  iov[0].iov_len = body.size();
+  size_t received = 0;
+  thread reader( [&received,&fds]{
+      char buf[65536];
+      ssize_t n;
+      while ( ( n = read( fds[1], buf, sizeof(buf) ) ) > 0 ){
+	received += n;
+      }
+    } );
+  chrono::milliseconds timeout( 5000 );
+  assertTrue( sender.writeBuffers( iov, 1, timeout ) );
+  shutdown( fds[0], SHUT_WR );
+  reader.join();
+  assertEqual( received, body.size() );
+  close( fds[1] );
+  // accept a batch of connections
+  Sockets::ServerSocket server;
+  assertTrue( server.connect( "0", false, "127.0.0.1" ) );
+  assertTrue( server.listen( 5 ) );
+  assertTrue( server.setNonBlocking() );
+  struct sockaddr_storage addr;
+  socklen_t len = sizeof(addr);
+  getsockname( server.getSockId(), (struct sockaddr*)&addr, &len );
+  string port = toString( ntohs( ((struct sockaddr_in*)&addr)->sin_port ) );
+  Sockets::ClientSocket clients[3];
+  for ( auto& cl : clients ){
+    assertTrue( cl.connect( "127.0.0.1", port ) );
+  }
+  Sockets::ClientSocket peers[3];
+  for ( auto& peer : peers ){
+    assertTrue( server.accept( peer, false ) );
+    assertTrue( peer.isValid() );
+  }
+  Sockets::ClientSocket none;
+  assertFalse( server.accept( none, false ) );
+  assertTrue( IoRing::setBackend( IoRing::DEFAULT ) );
+  assertFalse( IoRing::active() );
 }
 
 void test_unicode( const string& path ){
@@ -1321,6 +2627,33 @@ int main( const int argc, const char* argv[] ){
   test_configuration( testdir );
   test_pretty_print();
   test_logstream( testdir );
+  test_logstream_blocks();
+  test_logstream_rotate();
+  test_logstream_limit();
+  test_logstream_trace();
+  test_workerpool();
+  test_cpu_affinity();
+  test_timer_wheel();
+  test_fdstream();
+  test_nb_getline();
+  test_server_metrics();
+  test_socket_read_timeout();
+  test_socket_write();
+  test_send_file();
+  test_frames();
+  test_event_lines();
+  test_http_server();
+  test_http_file();
+  test_client_pool();
+  test_connect_timeout();
+  test_unix_socket();
+  test_admission_queue();
+  test_worker_pool();
+  test_reload();
+  test_acceptors();
+  test_http_events();
+  test_idle_timeout();
+  test_io_ring();
   test_unicode( testdir );
   test_unicode_split();
   test_unicode_split_exact();
@@ -0,0 +1,307 @@
+/*
+  Copyright (c) 2006 - 2024
+  CLST  - Radboud University
+  ILK   - Tilburg University
+
+  This file is part of ticcutils
+
+  ticcutils is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 3 of the License, or
+  (at your option) any later version.
+
+  ticcutils is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+  For questions and suggestions, see:
+      https://github.com/LanguageMachines/ticcutils/issues
+  or send mail to:
+      lamasoftware (at ) science.ru.nl
+
+*/
+
+// serverbench: a load generator for ServerBase.
+// It starts an echo server in a child process and drives it with a number
+// of parallel connections, then reports the throughput and latencies.
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <stdexcept>
+#include <cstdlib>
+#include <csignal>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "ticcutils/CommandLine.h"
+#include "ticcutils/Configuration.h"
+#include "ticcutils/StringOps.h"
+#include "ticcutils/SocketBasics.h"
+#include "ticcutils/ServerBase.h"
+
+using namespace std;
+using namespace TiCCServer;
+
+/// \brief EchoServer sends every line back, after an optional pause
+class EchoServer: public TcpServerBase {
+public:
+  EchoServer( const TiCC::Configuration *c, int pause ):
+    TcpServerBase( c, 0 ), _pause( pause ){};
+  void callback( childArgs *args ) override {
+    string line;
+    while ( getline( args->is(), line ) ){
+      wait();
+      args->os() << line << endl;
+    }
+  }
+  void line_callback( eventArgs *args, const string& line ) override {
+    wait();
+    args->write( line + "\n" );
+  }
+private:
+  void wait() const {
+    if ( _pause > 0 ){
+      this_thread::sleep_for( chrono::microseconds( _pause ) );
+    }
+  }
+  int _pause;
+};
+
+/// \brief HttpEchoServer returns the body of every request
+class HttpEchoServer: public HttpServerBase {
+public:
+  HttpEchoServer( const TiCC::Configuration *c, int pause ):
+    HttpServerBase( c, 0 ), _pause( pause ){};
+  void http_request( childArgs *,
+		     const HttpRequest& request,
+		     HttpResponse& response ) override {
+    if ( _pause > 0 ){
+      this_thread::sleep_for( chrono::microseconds( _pause ) );
+    }
+    response.headers["Content-Type"] = "text/plain";
+    response.body = request.body;
+  }
+private:
+  int _pause;
+};
+
+/// \brief the settings of one benchmark run
+struct Bench {
+  string protocol = "tcp";
+  string port = "7777";
+  int connections = 8;
+  int requests = 10000;
+  int duration = 0;
+  size_t size = 64;
+  int pause = 0;
+};
+
+static void usage( const string& name ){
+  cerr << "usage: " << name << " [options]" << endl;
+  cerr << "starts an echo server and measures it under load" << endl;
+  cerr << "-c <num> or --connections=<num> parallel connections"
+       << " (default 8)" << endl;
+  cerr << "-n <num> or --requests=<num> requests per connection"
+       << " (default 10000)" << endl;
+  cerr << "-d <secs> or --duration=<secs> run this long, instead of a number"
+       << " of requests" << endl;
+  cerr << "-s <bytes> or --size=<bytes> the size of a request"
+       << " (default 64)" << endl;
+  cerr << "--pause=<usec> the time the server spends on a request"
+       << " (default 0)" << endl;
+  cerr << "--protocol=[tcp|http] (default tcp)" << endl;
+  cerr << "--port=<port> (default 7777)" << endl;
+  cerr << "--set=<key>=<value> any server configuration, like workers=4,"
+       << " maxconn=100 or" << endl;
+  cerr << "  io_backend=io_uring. May be repeated" << endl;
+  cerr << "--logfile=<file> the server log (default: none)" << endl;
+}
+
+static int run_server( const Bench& bench, TiCC::Configuration *config ){
+  /// run the server, in the child process. config becomes its property
+  try {
+    if ( bench.protocol == "http" ){
+      HttpEchoServer server( config, bench.pause );
+      return server.Run();
+    }
+    EchoServer server( config, bench.pause );
+    return server.Run();
+  }
+  catch ( const exception& e ){
+    cerr << "server: " << e.what() << endl;
+  }
+  return EXIT_FAILURE;
+}
+
+static bool wait_for_server( const Bench& bench, pid_t pid ){
+  /// wait until the server accepts connections, or has died
+  for ( int i=0; i < 100; ++i ){
+    if ( waitpid( pid, 0, WNOHANG ) == pid ){
+      return false;
+    }
+    Sockets::ClientSocket probe;
+    if ( probe.connect( "127.0.0.1", bench.port ) ){
+      return true;
+    }
+    this_thread::sleep_for( chrono::milliseconds( 50 ) );
+  }
+  return false;
+}
+
+static void run_client( const Bench& bench,
+			chrono::steady_clock::time_point stop,
+			ServerMetrics& latencies,
+			atomic<uint64_t>& done,
+			atomic<uint64_t>& errors ){
+  /// one connection: send a request, wait for the answer, and again
+  Sockets::ClientSocket sock;
+  if ( !sock.connect( "127.0.0.1", bench.port ) ){
+    ++errors;
+    return;
+  }
+  // the payload is one line, so the echo ends with it
+  string payload( bench.size > 0 ? bench.size - 1 : 0, 'x' );
+  payload += "\n";
+  string request;
+  if ( bench.protocol == "http" ){
+    request = "POST /echo HTTP/1.1\r\nHost: localhost\r\n"
+      "Content-Length: " + TiCC::toString( payload.size() ) + "\r\n\r\n";
+  }
+  request += payload;
+  string line;
+  for ( int i=0; bench.duration > 0 || i < bench.requests; ++i ){
+    auto start = chrono::steady_clock::now();
+    if ( bench.duration > 0 && start >= stop ){
+      break;
+    }
+    bool ok = sock.writeBuffer( request.data(), request.size() );
+    if ( ok && bench.protocol == "http" ){
+      // skip the status line and the headers
+      while ( ( ok = sock.read( line ) ) && !line.empty() ){
+      }
+    }
+    ok = ok && sock.read( line ) && line.size() + 1 == payload.size();
+    if ( !ok ){
+      ++errors;
+      return;
+    }
+    latencies.record( ServerMetrics::REQUEST,
+		      chrono::steady_clock::now() - start );
+    ++done;
+  }
+}
+
+int main( int argc, const char *argv[] ){
+  TiCC::CL_Options opts( "hc:n:d:s:",
+			 "help,connections:,requests:,duration:,size:,"
+			 "pause:,protocol:,port:,set:,logfile:" );
+  Bench bench;
+  string logfile = "/dev/null";
+  TiCC::Configuration *config = new TiCC::Configuration();
+  try {
+    opts.init( argc, argv );
+    if ( opts.extract( 'h' ) || opts.extract( "help" ) ){
+      usage( opts.prog_name() );
+      return EXIT_SUCCESS;
+    }
+    opts.extract( 'c', bench.connections );
+    opts.extract( "connections", bench.connections );
+    opts.extract( 'n', bench.requests );
+    opts.extract( "requests", bench.requests );
+    opts.extract( 'd', bench.duration );
+    opts.extract( "duration", bench.duration );
+    opts.extract( 's', bench.size );
+    opts.extract( "size", bench.size );
+    opts.extract( "pause", bench.pause );
+    opts.extract( "protocol", bench.protocol );
+    opts.extract( "port", bench.port );
+    opts.extract( "logfile", logfile );
+    string value;
+    while ( opts.extract( "set", value ) ){
+      vector<string> parts = TiCC::split_at( value, "=" );
+      if ( parts.size() != 2 ){
+	throw TiCC::OptionError( "expected --set=<key>=<value>, not '"
+				 + value + "'" );
+      }
+      config->setatt( parts[0], parts[1] );
+    }
+    if ( bench.protocol != "tcp" && bench.protocol != "http" ){
+      throw TiCC::OptionError( "unsupported protocol: " + bench.protocol );
+    }
+    if ( bench.connections <= 0 || bench.requests <= 0 || bench.size == 0 ){
+      throw TiCC::OptionError( "connections, requests and size must be"
+			       " positive" );
+    }
+  }
+  catch ( const TiCC::OptionError& e ){
+    cerr << e.what() << endl;
+    usage( opts.prog_name() );
+    return EXIT_FAILURE;
+  }
+  config->setatt( "port", bench.port );
+  config->setatt( "protocol", bench.protocol );
+  config->setatt( "daemonize", "no" );
+  config->setatt( "logfile", logfile );
+  if ( config->lookUp( "maxconn" ).empty() ){
+    config->setatt( "maxconn", TiCC::toString( bench.connections ) );
+  }
+  if ( bench.protocol == "http" ){
+    // keep the connections open during the whole run
+    config->setatt( "http_max_requests", "2000000000" );
+  }
+  pid_t pid = fork();
+  if ( pid < 0 ){
+    cerr << "fork failed" << endl;
+    return EXIT_FAILURE;
+  }
+  if ( pid == 0 ){
+    _exit( run_server( bench, config ) );
+  }
+  delete config;
+  if ( !wait_for_server( bench, pid ) ){
+    cerr << "the server did not start. (is port " << bench.port
+	 << " in use?)" << endl;
+    kill( pid, SIGKILL );
+    waitpid( pid, 0, 0 );
+    return EXIT_FAILURE;
+  }
+  ServerMetrics latencies;
+  atomic<uint64_t> done( 0 );
+  atomic<uint64_t> errors( 0 );
+  auto start = chrono::steady_clock::now();
+  auto stop = start + chrono::seconds( bench.duration );
+  vector<thread> clients;
+  for ( int i=0; i < bench.connections; ++i ){
+    clients.emplace_back( [&]{
+	run_client( bench, stop, latencies, done, errors );
+      } );
+  }
+  for ( auto& t : clients ){
+    t.join();
+  }
+  double secs = chrono::duration<double>( chrono::steady_clock::now()
+					  - start ).count();
+  kill( pid, SIGTERM );
+  waitpid( pid, 0, 0 );
+  cout << bench.protocol << " server, " << bench.connections
+       << " connections, " << bench.size << " byte requests" << endl;
+  cout << fixed << setprecision(2);
+  cout << "requests: " << done << " in " << secs << " s, "
+       << done / secs << " requests/s, errors: " << errors << endl;
+  cout << "latency (usec):";
+  for ( double p : { 50.0, 90.0, 99.0, 99.9 } ){
+    cout << " p" << setprecision( p == 99.9 ? 1 : 0 ) << p << "="
+	 << latencies.percentile( ServerMetrics::REQUEST, p );
+  }
+  cout << " max=" << latencies.percentile( ServerMetrics::REQUEST, 100 )
+       << endl;
+  return errors > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}